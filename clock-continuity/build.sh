@@ -1,4 +1,3 @@
 #!/bin/sh
 
-gcc -O2 clock_continuity.c -lrt -o clock_continuity
-
+make
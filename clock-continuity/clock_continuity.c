@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -34,67 +35,420 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include "bench_core.h"
+#include "trace.h"
+#include "runtime_config.h"
 
-int main(int argc, const char* argv[])
+/** Gaps whose ends are further apart than this are not looked at together */
+#define CORRELATION_SETTLE_NS	1000000000ULL
+
+/** Gaps kept for correlation, older ones are reported as they are pushed out */
+#define MAX_RECENT_GAPS			4096
+
+/** Latest reading of one CPU's detector, on its own cache line so only the readers of that CPU see it change */
+struct CpuSlot
+{
+	unsigned long long LastNs;
+} BENCH_CACHE_ALIGNED;
+
+/** Work of one detector thread */
+struct Detector
+{
+	int Index;
+	int Cpu;
+	unsigned long long ThresholdNs;
+	pthread_t Thread;
+} BENCH_CACHE_ALIGNED;
+
+/** Gap waiting to be correlated with the gaps seen on other CPUs */
+struct RecentGap
+{
+	struct TraceEvent Event;
+	int Reported;
+};
+
+struct Tracer Tracer;
+struct RuntimeConfig Runtime;
+struct CpuSlot* CpuSlots = NULL;
+struct Detector* Detectors = NULL;
+int NumDetectors = 1;
+
+/** Drainer thread only */
+struct RecentGap RecentGaps[MAX_RECENT_GAPS];
+int NumRecentGaps = 0;
+
+/** Prints a gap the way this tool always has. */
+void PrintGap(const struct TraceEvent* Event)
+{
+	char Cause[256];
+
+	printf("pid %u: too large difference between clock readings, %llu nsec (largest tolerable difference is %llu nsec) on cpu %d%s at %s",
+		Event->Pid,
+		Event->Value, Event->Expected,
+		Event->Cpu,
+		SchedDeltasFormat(Cause, sizeof(Cause), &Event->Sched, Event->Value),
+		UtcTimeStringAt(Event->RealTimeNs)
+	);
+}
+
+/**
+ * Prints a gap together with how many detectors stalled over the same time: all of them means the whole VM was paused,
+ * only this one means its vCPU was descheduled (steal), anything in between is a partial stall.
+ */
+void PrintCorrelatedGap(int IdxGap)
+{
+	const struct TraceEvent* Event = &RecentGaps[IdxGap].Event;
+	unsigned long long Start = Event->Arg, End = Event->Arg + Event->Value;
+	int IdxOther, NumStalled = 1;
+	char Cause[256];
+	int* StalledRings = (int*)calloc(NumDetectors, sizeof(int));
+
+	StalledRings[Event->Ring] = 1;
+	for (IdxOther = 0; IdxOther < NumRecentGaps; ++IdxOther)
+	{
+		const struct TraceEvent* Other = &RecentGaps[IdxOther].Event;
+		unsigned long long OtherStart = Other->Arg, OtherEnd = Other->Arg + Other->Value;
+		unsigned long long OverlapStart = (OtherStart > Start) ? OtherStart : Start;
+		unsigned long long OverlapEnd = (OtherEnd < End) ? OtherEnd : End;
+		unsigned long long Shorter = (Other->Value < Event->Value) ? Other->Value : Event->Value;
+
+		/* stalls of different CPUs count as the same one if they overlap for at least half of the shorter one */
+		if (!StalledRings[Other->Ring] && OverlapEnd > OverlapStart && (OverlapEnd - OverlapStart) * 2 >= Shorter)
+		{
+			StalledRings[Other->Ring] = 1;
+			++NumStalled;
+		}
+	}
+	free(StalledRings);
+
+	printf("pid %u: too large difference between clock readings, %llu nsec (largest tolerable difference is %llu nsec) on cpu %d, stalled cpus %d of %d (%s)%s at %s",
+		Event->Pid,
+		Event->Value, Event->Expected,
+		Event->Cpu,
+		NumStalled, NumDetectors,
+		(NumDetectors == 1) ? "Stall" : (NumStalled == NumDetectors) ? "VmPause" : (NumStalled == 1) ? "VcpuStall" : "PartialStall",
+		SchedDeltasFormat(Cause, sizeof(Cause), &Event->Sched, Event->Value),
+		UtcTimeStringAt(Event->RealTimeNs)
+	);
+}
+
+/** Prints a backward step between CPUs. */
+void PrintBackwards(const struct TraceEvent* Event)
+{
+	printf("pid %u: clock on cpu %d read %llu nsec behind a reading published earlier by cpu %llu (worst so far on this cpu) at %s",
+		Event->Pid,
+		Event->Cpu,
+		Event->Value,
+		Event->Arg,
+		UtcTimeStringAt(Event->RealTimeNs)
+	);
+}
+
+/** Called by the drainer for each event in all-core mode, holds gaps back until the other CPUs had time to report theirs. */
+void CollectEvent(const struct TraceEvent* Event)
+{
+	if (Event->Type != TraceEvent_ClockGap)
+	{
+		PrintBackwards(Event);
+		return;
+	}
+
+	if (NumRecentGaps == MAX_RECENT_GAPS)
+	{
+		if (!RecentGaps[0].Reported)
+		{
+			PrintCorrelatedGap(0);
+		}
+		memmove(RecentGaps, RecentGaps + 1, (MAX_RECENT_GAPS - 1) * sizeof(struct RecentGap));
+		--NumRecentGaps;
+	}
+
+	RecentGaps[NumRecentGaps].Event = *Event;
+	RecentGaps[NumRecentGaps].Reported = 0;
+	++NumRecentGaps;
+}
+
+/** Called by the drainer after each pass in all-core mode, reports settled gaps and forgets the ones too old to matter. */
+void ReportSettledGaps(void)
+{
+	unsigned long long Now = GetTimeInNs();
+	int IdxGap, NumKept = 0;
+
+	for (IdxGap = 0; IdxGap < NumRecentGaps; ++IdxGap)
+	{
+		unsigned long long End = RecentGaps[IdxGap].Event.Arg + RecentGaps[IdxGap].Event.Value;
+		if (!RecentGaps[IdxGap].Reported && Now > End + CORRELATION_SETTLE_NS)
+		{
+			PrintCorrelatedGap(IdxGap);
+			RecentGaps[IdxGap].Reported = 1;
+		}
+	}
+
+	/* reported gaps are still needed by gaps reported later, until they are too old to overlap with them */
+	for (IdxGap = 0; IdxGap < NumRecentGaps; ++IdxGap)
+	{
+		unsigned long long End = RecentGaps[IdxGap].Event.Arg + RecentGaps[IdxGap].Event.Value;
+		if (!RecentGaps[IdxGap].Reported || Now <= End + 2 * CORRELATION_SETTLE_NS)
+		{
+			RecentGaps[NumKept++] = RecentGaps[IdxGap];
+		}
+	}
+	NumRecentGaps = NumKept;
+}
+
+/**
+ * Watches the clock on one CPU. Each reading is published in the CPU's slot, and checked against the reading
+ * last published by one other CPU (a different one each time): that reading was taken before ours, so
+ * ours must not be smaller unless the CPUs' clocks are skewed.
+ */
+void* DetectorThread(void* Arg)
+{
+	const char* Failed = "";
+	struct Detector* Detector = (struct Detector*)Arg;
+	unsigned long long PrevNs, CurrentNs, DiffNs, PeerNs, WorstBackwardsNs = 0;
+	int Peer = Detector->Index;
+	int Result;
+
+	Result = PinThreadToCpu(Detector->Cpu);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not pin detector to cpu %d, error %d (%s)\n", Detector->Cpu, Result, strerror(Result));
+		exit(1);
+	}
+	Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s on cpu %d, error %d (%s)\n", Failed, Detector->Cpu, Result, strerror(Result));
+		exit(1);
+	}
+	TracerRegisterThread(&Tracer, Detector->Index);
+
+	PrevNs = GetTimeInNs();
+	__atomic_store_n(&CpuSlots[Detector->Index].LastNs, PrevNs, __ATOMIC_RELEASE);
+
+	for (;;)
+	{
+		Peer = (Peer + 1 == NumDetectors) ? 0 : Peer + 1;
+		PeerNs = __atomic_load_n(&CpuSlots[Peer].LastNs, __ATOMIC_ACQUIRE);
+
+		CurrentNs = GetTimeInNs();
+		__atomic_store_n(&CpuSlots[Detector->Index].LastNs, CurrentNs, __ATOMIC_RELEASE);
+
+		DiffNs = CurrentNs - PrevNs;
+
+		if (DiffNs > Detector->ThresholdNs)
+		{
+			TraceRecord(&Tracer, Detector->Index, TraceEvent_ClockGap, DiffNs, Detector->ThresholdNs, PrevNs);
+		}
+
+		/* only each new worst step is recorded, skewed clocks would otherwise flood the ring */
+		if (PeerNs > CurrentNs && PeerNs - CurrentNs > WorstBackwardsNs)
+		{
+			WorstBackwardsNs = PeerNs - CurrentNs;
+			TraceRecord(&Tracer, Detector->Index, TraceEvent_ClockBackwards, WorstBackwardsNs, 0, (unsigned long long)Detectors[Peer].Cpu);
+		}
+
+		PrevNs = CurrentNs;
+	}
+
+	return NULL;
+}
+
+void PrintUsage(const char* Name)
+{
+	printf("Usage: %s [-k cpu] " RUNTIME_CONFIG_SYNOPSIS " [threshold_ms] [trace_file|-] [all]\n", Name);
+	printf("  -k cpu        with all, cpu left without a detector for the trace drainer and sched sampling (default: the first allowed cpu, -1 for none)\n");
+	RuntimeConfigPrintUsage();
+}
+
+int main(int argc, char* const argv[])
 {
-	struct timespec TimeSpec;
 	unsigned long long ResolutionNs = 0, PrevNs = 0, CurrentNs = 0;
 	unsigned long long DiffNs = 0;
 	unsigned long long ThresholdNs = 100000000;	// 100 ms
-	time_t Time;
-	struct tm* UtcTime;
-	int Cooldown = 2;	/* skip first two readings */
+	char TracePath[256];
+	const char* Failed = "";
+	int AllCores = 0, IdxDetector, Opt, Result;
+	int Cpus[CPU_SETSIZE];
+	/* -2 until given, picks the first allowed cpu if there is more than one */
+	int HousekeepingCpu = -2;
+	cpu_set_t HousekeepingSet;
+
+	/* runtime options may come anywhere, the rest are positional */
+	RuntimeConfigInit(&Runtime);
+	while ((Opt = getopt(argc, argv, "k:h" RUNTIME_CONFIG_OPTIONS)) != -1)
+	{
+		if (Opt == 'k')
+		{
+			HousekeepingCpu = (atoi(optarg) < 0) ? -1 : atoi(optarg);
+		}
+		else if (RuntimeConfigParseOption(&Runtime, Opt, optarg) != 0)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
 
 	/* Read threshold in millseconds from commandline, if any */
-	if (argc > 1)
+	if (optind < argc)
 	{
-		ThresholdNs = atol(argv[1]) * 1000000;
+		ThresholdNs = atol(argv[optind]) * 1000000;
 	}
 
-	clock_getres(CLOCK_MONOTONIC_RAW, &TimeSpec);
-	ResolutionNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+	/* Every gap is also written to a binary trace, see trace-dump */
+	if (optind + 1 < argc && strcmp(argv[optind + 1], "-") != 0)
+	{
+		snprintf(TracePath, sizeof(TracePath), "%s", argv[optind + 1]);
+	}
+	else
+	{
+		snprintf(TracePath, sizeof(TracePath), "clock_continuity.%d.trace", getpid());
+	}
+
+	/* "all" runs a detector pinned to each CPU instead of a single one wherever the scheduler puts it */
+	if (optind + 2 < argc && strcmp(argv[optind + 2], "all") == 0)
+	{
+		AllCores = 1;
+	}
+
+	Result = RuntimeConfigApply(&Runtime, &Failed);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s, error %d (%s)\n", Failed, Result, strerror(Result));
+		return 1;
+	}
+
+	ResolutionNs = GetClockResolutionNs(BENCH_CLOCK_ID);
 
 	printf("%d: Resolution of CLOCK_MONOTONIC_RAW is %llu nsec\n", getpid(), ResolutionNs);
 
 	printf("%d: Largest tolerable difference between clock readings is %llu nsec (%llu ms)\n", getpid(), ThresholdNs, ThresholdNs / 1000000);
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-	PrevNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+	if (AllCores)
+	{
+		NumDetectors = GetAllowedCpus(Cpus, CPU_SETSIZE);
+		if (NumDetectors <= 0)
+		{
+			fprintf(stderr, "Could not get the CPUs to run on\n");
+			return 1;
+		}
 
-	printf("Checking if we ever see too large difference between clock readings (program never exits)\n");
+		/* the drainer wakes up every few ms and reads /proc, on a detector's cpu that would preempt it and show up as a stall */
+		if (HousekeepingCpu == -2)
+		{
+			HousekeepingCpu = (NumDetectors > 1) ? Cpus[0] : -1;
+		}
+		if (HousekeepingCpu >= 0)
+		{
+			for (IdxDetector = 0; IdxDetector < NumDetectors && Cpus[IdxDetector] != HousekeepingCpu; ++IdxDetector)
+			{
+			}
+			if (IdxDetector == NumDetectors || NumDetectors == 1)
+			{
+				fprintf(stderr, "Housekeeping cpu %d is not one of the allowed cpus, or the only one\n", HousekeepingCpu);
+				return 1;
+			}
+			memmove(&Cpus[IdxDetector], &Cpus[IdxDetector + 1], (NumDetectors - IdxDetector - 1) * sizeof(int));
+			--NumDetectors;
+		}
+	}
 
-	for (;;)
+	Result = AllCores ? TracerStart(&Tracer, TracePath, "clock_continuity", NumDetectors, CollectEvent, ReportSettledGaps)
+		: TracerStart(&Tracer, TracePath, "clock_continuity", 1, PrintGap, NULL);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not start tracing to %s, error %d (%s)\n", TracePath, Result, strerror(Result));
+		return 1;
+	}
+	printf("%d: Tracing gaps to %s\n", getpid(), TracePath);
+	if (AllCores && HousekeepingCpu >= 0)
+	{
+		CPU_ZERO(&HousekeepingSet);
+		CPU_SET(HousekeepingCpu, &HousekeepingSet);
+		Result = pthread_setaffinity_np(Tracer.Drainer, sizeof(HousekeepingSet), &HousekeepingSet);
+		if (Result == 0)
+		{
+			Result = PinThreadToCpu(HousekeepingCpu);
+		}
+		if (Result != 0)
+		{
+			fprintf(stderr, "Could not pin housekeeping to cpu %d, error %d (%s)\n", HousekeepingCpu, Result, strerror(Result));
+			return 1;
+		}
+		printf("%d: Trace drainer and sched sampling on cpu %d, no detector there\n", getpid(), HousekeepingCpu);
+	}
+	else if (AllCores)
 	{
-		clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-		CurrentNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+		printf("%d: No housekeeping cpu, the trace drainer shares the detectors' cpus and can cause gaps of its own\n", getpid());
+	}
+	RuntimeConfigPrint(&Runtime);
 
-		DiffNs = CurrentNs - PrevNs;
+	if (AllCores)
+	{
+		CpuSlots = (struct CpuSlot*)aligned_alloc(BENCH_CACHE_LINE_SIZE, NumDetectors * sizeof(struct CpuSlot));
+		Detectors = (struct Detector*)aligned_alloc(BENCH_CACHE_LINE_SIZE, NumDetectors * sizeof(struct Detector));
+		memset(CpuSlots, 0, NumDetectors * sizeof(struct CpuSlot));
+
+		printf("Checking clock readings on %d cpus, and against each other (program never exits)\n", NumDetectors);
+		fflush(stdout);
 
-		if (Cooldown == 0)
+		for (IdxDetector = 0; IdxDetector < NumDetectors; ++IdxDetector)
 		{
-			/* Check if we're ever too far off (larger than threshold) */
-			if (DiffNs > ThresholdNs)
+			Detectors[IdxDetector].Index = IdxDetector;
+			Detectors[IdxDetector].Cpu = Cpus[IdxDetector];
+			Detectors[IdxDetector].ThresholdNs = ThresholdNs;
+		}
+
+		/* slots are zero until each detector publishes, which never looks like a step backwards */
+		for (IdxDetector = 0; IdxDetector < NumDetectors; ++IdxDetector)
+		{
+			Result = pthread_create(&Detectors[IdxDetector].Thread, NULL, DetectorThread, &Detectors[IdxDetector]);
+			if (Result != 0)
 			{
-				Time = time(NULL);
-				UtcTime = gmtime(&Time);
-			
-				printf("pid %d: too large difference between clock readings, %llu nsec (largest tolerable difference is %llu nsec) at %s",
-					getpid(),
-					DiffNs, ThresholdNs,
-					asctime(UtcTime)
-				);
-
-				Cooldown = 2;	/* skip next two readings because printing off the result might have taken too long. */
+				fprintf(stderr, "Could not start detector for cpu %d, error %d (%s)\n", Cpus[IdxDetector], Result, strerror(Result));
+				return 1;
 			}
 		}
-		else
+
+		for (IdxDetector = 0; IdxDetector < NumDetectors; ++IdxDetector)
+		{
+			pthread_join(Detectors[IdxDetector].Thread, NULL);
+		}
+
+		TracerStop(&Tracer);
+		return 0;
+	}
+
+	Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s, error %d (%s)\n", Failed, Result, strerror(Result));
+		return 1;
+	}
+	TracerRegisterThread(&Tracer, 0);
+
+	printf("Checking if we ever see too large difference between clock readings (program never exits)\n");
+	fflush(stdout);
+
+	/* only after the banner is out, a slow terminal or pipe would otherwise show up as the first gap */
+	PrevNs = GetTimeInNs();
+
+	for (;;)
+	{
+		CurrentNs = GetTimeInNs();
+
+		DiffNs = CurrentNs - PrevNs;
+
+		/* Check if we're ever too far off (larger than threshold). Recording does not block, so no readings need to be skipped after it */
+		if (DiffNs > ThresholdNs)
 		{
-			--Cooldown;
+			TraceRecord(&Tracer, 0, TraceEvent_ClockGap, DiffNs, ThresholdNs, PrevNs);
 		}
 
 		PrevNs = CurrentNs;
 	}
 
+	TracerStop(&Tracer);
 	return 0;
 };
-
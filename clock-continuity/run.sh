@@ -1,5 +1,15 @@
 #!/bin/bash
 # Assumes at least 8 core machine, uses cores 0,2,4,6
+# With "all" as the first argument runs a single instance with a detector on every core instead, with given threshold in ms (default 1).
+# The first allowed core is kept for the trace drainer and sched sampling, so the tool does not preempt its own detectors:
+# pass the core to keep as the third argument, or -1 to put a detector on it too (its gaps then include the drainer's wakeups)
+
+if [ "$1" == "all" ]; then
+	if [ -n "$3" ]; then
+		exec ./clock_continuity -k $3 ${2:-1} - all
+	fi
+	exec ./clock_continuity ${2:-1} - all
+fi
 
 trap CtrlCHandler INT
 trap CtrlCHandler TERM
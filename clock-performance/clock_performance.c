@@ -27,57 +27,251 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include "bench_core.h"
+
+/** Reads timed together - amortizes the cost of the timer while keeping enough samples for a distribution */
+#define DEFAULT_BATCH_SIZE		32
+
+/** Empty batches timed to find the cost of the timer itself */
+#define TIMER_OVERHEAD_TRIES	1000
+
+/** Work and results of one thread, each in its own cache lines so that threads do not slow each other down */
+struct ThreadData
+{
+	enum ClockBackend Backend;
+	/** Clock the batches are timed with, rdtscp where available */
+	enum ClockBackend Timer;
+	double TimerNsPerTick;
+	unsigned long long NumIterations;
+	unsigned int BatchSize;
+	/** CPU to pin to, -1 to leave it to the scheduler */
+	int Cpu;
+	/** All threads start reading at once */
+	pthread_barrier_t* StartBarrier;
+
+	int Pinned;
+	/** Wall clock span of the reads */
+	unsigned long long StartNs, EndNs;
+	/** Timer ticks spent in all batches, cost of the timer taken out */
+	unsigned long long TotalTicks;
+	unsigned long long NumReads;
+	/** Average cost of a call in each batch, in picoseconds */
+	struct LatencyHistogram Histogram;
+} BENCH_CACHE_ALIGNED;
+
+/** Throughput of one run */
+struct RunResult
+{
+	double NsPerRead;
+	double ReadsPerSec;
+};
 
 void *ThreadFunc(void *Data) 
 {
-	unsigned long long IdxIter, NumIterations = *(unsigned long long *)Data;
-	struct timespec TimeSpec;
+	struct ThreadData* Thread = (struct ThreadData *)Data;
+	unsigned long long IdxBatch, NumBatches, Start, End, Ticks, OverheadTicks = ~0ULL;
+	volatile unsigned long long Sink = 0;
+	unsigned int IdxRead;
+	int IdxTry;
 
-	for (IdxIter = 0; IdxIter < NumIterations; ++IdxIter)
+	if (Thread->Cpu >= 0)
 	{
-		clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
+		Thread->Pinned = (PinThreadToCpu(Thread->Cpu) == 0);
+	}
+
+	/* on the CPU it will run on, since the timer cost can differ between them */
+	for (IdxTry = 0; IdxTry < TIMER_OVERHEAD_TRIES; ++IdxTry)
+	{
+		Start = ReadClockTicks(Thread->Timer);
+		End = ReadClockTicks(Thread->Timer);
+		if (End - Start < OverheadTicks)
+		{
+			OverheadTicks = End - Start;
+		}
+	}
+
+	pthread_barrier_wait(Thread->StartBarrier);
+	Thread->StartNs = GetTimeInNs();
+
+	NumBatches = (Thread->NumIterations + Thread->BatchSize - 1) / Thread->BatchSize;
+	for (IdxBatch = 0; IdxBatch < NumBatches; ++IdxBatch)
+	{
+		Start = ReadClockTicks(Thread->Timer);
+		for (IdxRead = 0; IdxRead < Thread->BatchSize; ++IdxRead)
+		{
+			Sink += ReadClockTicks(Thread->Backend);
+		}
+		End = ReadClockTicks(Thread->Timer);
+
+		Ticks = (End - Start > OverheadTicks) ? End - Start - OverheadTicks : 0;
+		Thread->TotalTicks += Ticks;
+		UpdateHistogram(&Thread->Histogram, (unsigned long long)((double)Ticks * Thread->TimerNsPerTick * 1000.0 / Thread->BatchSize));
 	}
+
+	Thread->EndNs = GetTimeInNs();
+	Thread->NumReads = NumBatches * Thread->BatchSize;
+
+	(void)Sink;
+	return NULL;
 }
 
-int main(int argc, char **argv) 
+/**
+ * Reads the clock NumIterations times on each of NumThreads threads, pinned to distinct CPUs where there are enough,
+ * in batches timed by each thread. Prints the average cost of a read, the combined throughput and its efficiency
+ * against BaselineReadsPerSec per thread, and the distribution of per-batch costs.
+ *
+ * @param Cpus CPUs to pin the threads to, or NULL not to pin them
+ * @param BaselineReadsPerSec throughput of a single thread, 0 if this is the single thread run
+ */
+struct RunResult RunBackend(enum ClockBackend Backend, unsigned long long NumIterations, int NumThreads, unsigned int BatchSize, double TscNsPerCycle,
+	const int* Cpus, int NumCpus, double BaselineReadsPerSec)
 {
 	pthread_t* Threads;
-	int NumThreads = 1, IdxThread;
+	struct ThreadData* Data;
+	struct LatencyHistogram* Histogram;
+	pthread_barrier_t StartBarrier;
+	unsigned long long TotalTicks = 0, NumReads = 0, StartNs = ~0ULL, EndNs = 0;
+	double CyclesPerRead = 0, Efficiency = 100.0;
+	struct RunResult Result;
+	int IdxThread, AllPinned = 1;
+
+	Threads = (pthread_t *)malloc(NumThreads * sizeof(pthread_t));
+	Data = (struct ThreadData *)aligned_alloc(BENCH_CACHE_LINE_SIZE, NumThreads * sizeof(struct ThreadData));
+	memset(Data, 0, NumThreads * sizeof(struct ThreadData));
+	Histogram = (struct LatencyHistogram *)calloc(1, sizeof(struct LatencyHistogram));
+	pthread_barrier_init(&StartBarrier, NULL, NumThreads);
+
+	for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+	{
+		Data[IdxThread].Backend = Backend;
+		Data[IdxThread].Timer = (TscNsPerCycle > 0 && ClockBackendAvailable(ClockBackend_Rdtscp)) ? ClockBackend_Rdtscp : ClockBackend_ClockGettime;
+		Data[IdxThread].TimerNsPerTick = ClockBackendNsPerTick(Data[IdxThread].Timer, TscNsPerCycle);
+		Data[IdxThread].NumIterations = NumIterations;
+		Data[IdxThread].BatchSize = BatchSize;
+		Data[IdxThread].Cpu = (Cpus != NULL) ? Cpus[IdxThread % NumCpus] : -1;
+		Data[IdxThread].StartBarrier = &StartBarrier;
+		pthread_create(Threads + IdxThread, NULL, ThreadFunc, Data + IdxThread);
+	}
+
+	for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+	{
+		pthread_join(Threads[IdxThread], NULL);
+		TotalTicks += Data[IdxThread].TotalTicks;
+		NumReads += Data[IdxThread].NumReads;
+		StartNs = (Data[IdxThread].StartNs < StartNs) ? Data[IdxThread].StartNs : StartNs;
+		EndNs = (Data[IdxThread].EndNs > EndNs) ? Data[IdxThread].EndNs : EndNs;
+		AllPinned = AllPinned && Data[IdxThread].Pinned;
+		MergeHistogram(Histogram, &Data[IdxThread].Histogram);
+	}
+
+	Result.NsPerRead = (double)TotalTicks * Data[0].TimerNsPerTick / (double)NumReads;
+	Result.ReadsPerSec = (EndNs > StartNs) ? (double)NumReads * 1e9 / (double)(EndNs - StartNs) : 0;
+	if (IsTscClockBackend(Data[0].Timer))
+	{
+		CyclesPerRead = (double)TotalTicks / (double)NumReads;
+	}
+	if (BaselineReadsPerSec > 0)
+	{
+		Efficiency = 100.0 * Result.ReadsPerSec / (BaselineReadsPerSec * NumThreads);
+	}
+
+	printf("Backend, %s, NumThreads, %d, Pinned, %s, NumIter, %llu, BatchSize, %u, NsPerRead, %.2f, CyclesPerRead, %.1f, MReadsPerSec, %.2f, Efficiency(%%), %.1f, ",
+		ClockBackendName(Backend), NumThreads, !AllPinned ? "no" : (NumThreads > NumCpus) ? "shared" : "yes", NumIterations, BatchSize, Result.NsPerRead, CyclesPerRead,
+		Result.ReadsPerSec / 1e6, Efficiency);
+	PrintPercentiles(Histogram, 1000.0, "ns");
+	printf("\n");
+
+	pthread_barrier_destroy(&StartBarrier);
+	free(Histogram);
+	free(Data);
+	free(Threads);
+	Threads = NULL;
+
+	return Result;
+}
+
+int main(int argc, char **argv) 
+{
+	int MaxThreads = 1, NumThreads, IdxBackend, NumCpus;
 	unsigned long long NumIterations = 1000000ULL;
+	unsigned int BatchSize = DEFAULT_BATCH_SIZE;
+	enum ClockBackend Backend = ClockBackend_ClockGettime;
+	int AllBackends = 0;
+	int Cpus[CPU_SETSIZE];
+	double TscNsPerCycle, NsPerRead[ClockBackend_Count];
 
 	if (argc > 1)
 	{
 		NumIterations = atol(argv[1]);
 	}
 
+	/* threads are added one at a time up to this, giving the scaling curve */
 	if (argc > 2)
 	{
-		NumThreads = atoi(argv[2]);
+		MaxThreads = atoi(argv[2]);
 	}
 
-	Threads = (pthread_t *)malloc(NumThreads * sizeof(pthread_t));
+	if (argc > 3)
+	{
+		if (strcmp(argv[3], "all") == 0)
+		{
+			AllBackends = 1;
+		}
+		else if (ParseClockBackend(argv[3], &Backend) != 0 || !ClockBackendAvailable(Backend))
+		{
+			fprintf(stderr, "Clock backend '%s' is not available, use all or one of: ", argv[3]);
+			PrintClockBackendNames(stderr);
+			fprintf(stderr, "\n");
+			return 1;
+		}
+	}
 
-	for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+	if (argc > 4 && atoi(argv[4]) > 0)
 	{
-		pthread_create(Threads + IdxThread, NULL, ThreadFunc, &NumIterations);
+		BatchSize = atoi(argv[4]);
 	}
 
-	for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+	NumCpus = GetAllowedCpus(Cpus, CPU_SETSIZE);
+	if (MaxThreads > NumCpus)
 	{
-		pthread_join(Threads[IdxThread], NULL);
+		fprintf(stderr, "Only %d CPUs available, threads past that will share CPUs\n", NumCpus);
 	}
 
-	free(Threads);
-	Threads = NULL;
+	/* batches are timed with the TSC, and clocksource tells whether clock_gettime can stay in the vDSO */
+	TscNsPerCycle = CalibrateTsc(100000000ULL);
+	PrintClockInfo(TscNsPerCycle);
 
-	return 0;
-}
+	memset(NsPerRead, 0, sizeof(NsPerRead));
+	for (IdxBackend = 0; IdxBackend < ClockBackend_Count; ++IdxBackend)
+	{
+		if ((AllBackends && ClockBackendAvailable((enum ClockBackend)IdxBackend)) || IdxBackend == Backend)
+		{
+			struct RunResult Baseline = RunBackend((enum ClockBackend)IdxBackend, NumIterations, 1, BatchSize, TscNsPerCycle,
+				NumCpus > 0 ? Cpus : NULL, NumCpus, 0);
+			NsPerRead[IdxBackend] = Baseline.NsPerRead;
 
+			for (NumThreads = 2; NumThreads <= MaxThreads; ++NumThreads)
+			{
+				RunBackend((enum ClockBackend)IdxBackend, NumIterations, NumThreads, BatchSize, TscNsPerCycle,
+					NumCpus > 0 ? Cpus : NULL, NumCpus, Baseline.ReadsPerSec);
+			}
+		}
+	}
 
+	/* a vDSO read is a few times cheaper than entering the kernel - if it is not, the clocksource forced the fallback */
+	if (NsPerRead[ClockBackend_ClockGettime] > 0 && NsPerRead[ClockBackend_Syscall] > 0)
+	{
+		double Speedup = NsPerRead[ClockBackend_Syscall] / NsPerRead[ClockBackend_ClockGettime];
+		printf("VdsoSpeedup, %.2f, VdsoAccelerated, %s\n", Speedup, (Speedup >= 2.0) ? "yes" : "no");
+	}
 
+	return 0;
+}
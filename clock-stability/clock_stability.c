@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -34,121 +35,159 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
-#include <math.h>
+#include "bench_core.h"
+#include "series.h"
+#include "runtime_config.h"
 
-/** State for online mean and variance */
-struct StabilityParams
+void PrintUsage(const char* Name)
 {
-	double NumObservations;
-	double Mean, Mean2;
-	double Min, Max;
-};
+	printf("Usage: %s " RUNTIME_CONFIG_SYNOPSIS " [period_seconds] [clock_backend] [series_file]\n", Name);
+	RuntimeConfigPrintUsage();
+}
 
-/** Updates state of an online std dev calculation. */
-void UpdateObservation(struct StabilityParams* Params, double Value)
+int main(int argc, char* const argv[])
 {
-	double Delta;
-
-	++Params->NumObservations;
-
-	Delta = Value - Params->Mean;
-
-	Params->Mean += Delta / Params->NumObservations;
-	Params->Mean2 += Delta * (Value - Params->Mean);
-
-	if (Params->NumObservations > 1)
+	unsigned long long ResolutionNs = 0, PrevTicks = 0, CurrentTicks = 0, LastPeriodStarted = 0;
+	double DiffNs = 0, NsPerTick = 1.0, TscNsPerCycle = 0;
+	unsigned long long PeriodInSeconds = 600, PeriodInNs;
+	int Cooldown = 100;	/* skip first readings */
+	struct StabilityParams AllTime, LastPeriod;
+	struct LatencyHistogram AllTimeHistogram, LastPeriodHistogram;
+	enum ClockBackend Backend = ClockBackend_ClockGettime;
+	int IdxBackend, Result;
+	struct SeriesWriter Series;
+	const struct SeriesInfo SeriesInfo = { "ReadIntervals", "ns", 1.0 };
+	const char* SeriesPath = NULL;
+	struct RuntimeConfig Runtime;
+	const char* Failed = "";
+	int Opt;
+
+	/* runtime options may come anywhere, the rest are positional */
+	RuntimeConfigInit(&Runtime);
+	while ((Opt = getopt(argc, argv, "h" RUNTIME_CONFIG_OPTIONS)) != -1)
 	{
-		Params->Min = (Value < Params->Min) ? Value : Params->Min;
-		Params->Max = (Value > Params->Max) ? Value : Params->Max;
+		if (RuntimeConfigParseOption(&Runtime, Opt, optarg) != 0)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
 	}
-	else
+
+	if (optind < argc)
 	{
-		Params->Min = Value;
-		Params->Max = Value;
+		PeriodInSeconds = atol(argv[optind]);
 	}
-}
-
-/** Calculates values and prints them. */
-void PrintValues(struct StabilityParams* Params)
-{
-	double Variance = 0, StandardDeviation = 0, RelativeStdDev = 0;
+	PeriodInNs = PeriodInSeconds * 1000000000ULL;
 
-	if (Params->NumObservations > 1)
+	/* Clock backend to check, clock_gettime by default */
+	if (optind + 1 < argc && (ParseClockBackend(argv[optind + 1], &Backend) != 0 || !ClockBackendAvailable(Backend)))
 	{
-		Variance = Params->Mean2 / (Params->NumObservations - 1);
-		StandardDeviation = sqrt( Variance );
+		fprintf(stderr, "Clock backend '%s' is not available, use one of: ", argv[optind + 1]);
+		PrintClockBackendNames(stderr);
+		fprintf(stderr, "\n");
+		return 1;
+	}
 
-		if (Params->Mean * Params->Mean > 0.0001)
+	/* Each period's stats are also appended to this binary series file, if given */
+	if (optind + 2 < argc)
+	{
+		SeriesPath = argv[optind + 2];
+		Result = SeriesOpen(&Series, SeriesPath, "clock_stability", &SeriesInfo, 1);
+		if (Result != 0)
 		{
-			RelativeStdDev = 100.0 * StandardDeviation / Params->Mean;
+			fprintf(stderr, "Cannot open series file %s: %s\n", SeriesPath, (Result == EINVAL) ? "written by another tool or version" : strerror(Result));
+			return 1;
 		}
 	}
 
-	printf("Min(ns), %.1f, Max(ns), %.1f, Mean(ns), %.1f, StdDev(ns), %.1f, RelStdDev(%%), %.1f, DataSize(M), %.f", 
-		Params->Min, Params->Max, Params->Mean, StandardDeviation, RelativeStdDev, Params->NumObservations / 1000000);
-}
-
-
-int main(int argc, const char* argv[])
-{
-	struct timespec TimeSpec;
-	unsigned long long ResolutionNs = 0, PrevNs = 0, CurrentNs = 0, LastPeriodStarted = 0;
-	double DiffNs = 0;
-	time_t Time;
-	unsigned long long PeriodInSeconds = 600, PeriodInNs;
-	struct tm* UtcTime;
-	int Cooldown = 100;	/* skip first readings */
-	struct StabilityParams AllTime, LastPeriod;
-
-	if (argc > 1)
+	/* the only thread measures, so it takes the per-thread settings too */
+	Result = RuntimeConfigApply(&Runtime, &Failed);
+	if (Result == 0)
 	{
-		PeriodInSeconds = atol(argv[1]);
+		Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+	}
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s, error %d (%s)\n", Failed, Result, strerror(Result));
+		return 1;
 	}
-	PeriodInNs = PeriodInSeconds * 1000000000ULL;
-
 
 	memset(&AllTime, 0, sizeof(AllTime));
 	memset(&LastPeriod, 0, sizeof(LastPeriod));
+	memset(&AllTimeHistogram, 0, sizeof(AllTimeHistogram));
+	memset(&LastPeriodHistogram, 0, sizeof(LastPeriodHistogram));
 
-	clock_getres(CLOCK_MONOTONIC_RAW, &TimeSpec);
-	ResolutionNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+	ResolutionNs = GetClockResolutionNs(BENCH_CLOCK_ID);
 
 	printf("%d: Resolution of CLOCK_MONOTONIC_RAW is %llu nsec\n", getpid(), ResolutionNs);
 	printf("%d: Print interval in seconds is %llu\n", getpid(), PeriodInNs / 1000000000ULL);
+	RuntimeConfigPrint(&Runtime);
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-	PrevNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
-	LastPeriodStarted = PrevNs;
+	TscNsPerCycle = CalibrateTsc(100000000ULL);
+	NsPerTick = ClockBackendNsPerTick(Backend, TscNsPerCycle);
+	PrintClockInfo(TscNsPerCycle);
+
+	/* Cost of a read through each backend, so they can be compared side by side */
+	for (IdxBackend = 0; IdxBackend < ClockBackend_Count; ++IdxBackend)
+	{
+		if (ClockBackendAvailable((enum ClockBackend)IdxBackend))
+		{
+			double CyclesPerRead, NsPerRead = MeasureClockReadCost((enum ClockBackend)IdxBackend, 1000000ULL, &CyclesPerRead);
+			printf("Backend, %s, NsPerRead, %.2f, CyclesPerRead, %.1f\n", ClockBackendName((enum ClockBackend)IdxBackend), NsPerRead, CyclesPerRead);
+		}
+	}
+
+	if (IsTscClockBackend(Backend) && NsPerTick <= 0)
+	{
+		fprintf(stderr, "Could not calibrate the TSC\n");
+		return 1;
+	}
+	printf("%d: Checking %s\n", getpid(), ClockBackendName(Backend));
+
+	PrevTicks = ReadClockTicks(Backend);
+	LastPeriodStarted = PrevTicks;
 
 	printf("Checking stability of the clock (program never exits)\n");
 
 	for (;;)
 	{
-		clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-		CurrentNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+		CurrentTicks = ReadClockTicks(Backend);
 
-		DiffNs = (double)(CurrentNs - PrevNs);
+		DiffNs = (double)(CurrentTicks - PrevTicks) * NsPerTick;
 
 		if (Cooldown == 0)
 		{
 			UpdateObservation(&AllTime, DiffNs);
 			UpdateObservation(&LastPeriod, DiffNs);
+			UpdateHistogram(&AllTimeHistogram, (unsigned long long)(DiffNs + 0.5));
+			UpdateHistogram(&LastPeriodHistogram, (unsigned long long)(DiffNs + 0.5));
 
 			/* Check if we're ever too far off (larger than threshold) */
-			if (CurrentNs - LastPeriodStarted > PeriodInNs)
+			if ((double)(CurrentTicks - LastPeriodStarted) * NsPerTick > (double)PeriodInNs)
 			{
-				Time = time(NULL);
-				UtcTime = gmtime(&Time);
-			
 				printf("pid, %d, All time, ", getpid());
-				PrintValues(&AllTime);
+				PrintValues(&AllTime, "ns");
+				printf(", ");
+				PrintPercentiles(&AllTimeHistogram, 1.0, "ns");
 				printf(", Period, " );
-				PrintValues(&LastPeriod);
-				printf(", %s", asctime(UtcTime));
+				PrintValues(&LastPeriod, "ns");
+				printf(", ");
+				PrintPercentiles(&LastPeriodHistogram, 1.0, "ns");
+				printf(", %s", UtcTimeString());
 				fflush(stdout);
 
+				if (SeriesPath != NULL)
+				{
+					Result = SeriesAppend(&Series, 0, (unsigned long long)((double)(CurrentTicks - LastPeriodStarted) * NsPerTick), &LastPeriod, &LastPeriodHistogram);
+					if (Result != 0)
+					{
+						fprintf(stderr, "Cannot append to series file %s: %s\n", SeriesPath, strerror(Result));
+					}
+				}
+
 				memset(&LastPeriod, 0, sizeof(LastPeriod));
-				LastPeriodStarted = CurrentNs;
+				memset(&LastPeriodHistogram, 0, sizeof(LastPeriodHistogram));
+				LastPeriodStarted = CurrentTicks;
 
 				Cooldown = 100;	/* skip next hundred readings because printing off the result might have taken too long. */
 			}
@@ -158,7 +197,7 @@ int main(int argc, const char* argv[])
 			--Cooldown;
 		}
 
-		PrevNs = CurrentNs;
+		PrevTicks = CurrentTicks;
 	}
 
 	return 0;
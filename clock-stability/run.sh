@@ -11,7 +11,7 @@ CtrlCHandler()
 
 RunForever()
 {
-	./clock_stability 30 > >(tee stability.log) &
+	./clock_stability 30 clock_gettime stability.series > >(tee stability.log) &
 	TESTPID=$!
 	taskset -c -p 5 $TESTPID
 
@@ -28,7 +28,7 @@ RunForever()
 
 taskset -c -p 0 $$
 
-gcc -O2 clock_stability.c -lm -lrt -o clock_stability
+make
 if [ $? -ne 0 ]; then
 	exit 1
 fi
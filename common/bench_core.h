@@ -0,0 +1,679 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Header-only core shared by all the benchmarks: clock reads, sleeping, and the online stats and
+ * histogram accumulators. Everything here is static inline so it compiles into each tool (C or C++)
+ * without a library, and a change here applies to every benchmark at once.
+ */
+
+#ifndef BENCH_CORE_H
+#define BENCH_CORE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+/** Clock used for all measurements, unaffected by NTP slewing */
+#define BENCH_CLOCK_ID			CLOCK_MONOTONIC_RAW
+
+/** Clock used for sleeping - one cannot sleep on CLOCK_MONOTONIC_RAW */
+#define BENCH_SLEEP_CLOCK_ID	CLOCK_MONOTONIC
+
+/** Data written by different threads is kept this far apart so they do not share cache lines */
+#define BENCH_CACHE_LINE_SIZE	64
+#define BENCH_CACHE_ALIGNED		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)))
+
+/** Converts a timespec to nanoseconds. */
+static inline unsigned long long TimespecToNs(const struct timespec* TimeSpec)
+{
+	return (unsigned long long)(TimeSpec->tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec->tv_nsec);
+}
+
+/** Converts nanoseconds to a timespec. */
+static inline void NsToTimespec(unsigned long long Ns, struct timespec* TimeSpec)
+{
+	TimeSpec->tv_sec = (time_t)(Ns / 1000000000ULL);
+	TimeSpec->tv_nsec = (long)(Ns % 1000000000ULL);
+}
+
+/** Reads given clock in ns, exits if the clock cannot be used. */
+static inline unsigned long long GetClockInNs(clockid_t Clock)
+{
+	struct timespec TimeSpec;
+
+	if (__builtin_expect(clock_gettime(Clock, &TimeSpec) != 0, 0))
+	{
+		fprintf(stderr, "Cannot use clock source %d\n", (int)Clock);
+		exit(1);
+	}
+
+	return TimespecToNs(&TimeSpec);
+}
+
+/** Gets current time in ns */
+static inline unsigned long long GetTimeInNs(void)
+{
+	return GetClockInNs(BENCH_CLOCK_ID);
+}
+
+/** Resolution of given clock in ns. */
+static inline unsigned long long GetClockResolutionNs(clockid_t Clock)
+{
+	struct timespec TimeSpec;
+
+	clock_getres(Clock, &TimeSpec);
+	return TimespecToNs(&TimeSpec);
+}
+
+/**
+ * Sleeps no less than TimeToSleepNs nanoseconds, properly accounting for signals.
+ *
+ * @return 0 on success, or the error clock_nanosleep() failed with
+ */
+static inline int SleepNs(unsigned long long TimeToSleepNs)
+{
+	struct timespec TimeSpec, TimeSpecRemain;
+	int SleepResult;
+
+	NsToTimespec(TimeToSleepNs, &TimeSpec);
+	for (;;)
+	{
+		SleepResult = clock_nanosleep(BENCH_SLEEP_CLOCK_ID, 0, &TimeSpec, &TimeSpecRemain);
+		if (SleepResult != EINTR)
+		{
+			return SleepResult;
+		}
+
+		// got interrupted, repeat
+		memcpy(&TimeSpec, &TimeSpecRemain, sizeof(TimeSpec));
+	}
+}
+
+/**
+ * Sleeps until BENCH_SLEEP_CLOCK_ID reaches DeadlineNs, so time lost to oversleeping does not add up over
+ * successive sleeps. Signals just restart the same sleep.
+ *
+ * @return 0 on success, or the error clock_nanosleep() failed with
+ */
+static inline int SleepUntilNs(unsigned long long DeadlineNs)
+{
+	struct timespec TimeSpec;
+	int SleepResult;
+
+	NsToTimespec(DeadlineNs, &TimeSpec);
+	do
+	{
+		SleepResult = clock_nanosleep(BENCH_SLEEP_CLOCK_ID, TIMER_ABSTIME, &TimeSpec, NULL);
+	}
+	while (SleepResult == EINTR);
+
+	return SleepResult;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define BENCH_HAS_TSC			1
+#else
+#define BENCH_HAS_TSC			0
+#endif
+
+/** Ways of reading time. TSC based ones count cycles and need calibrating to get nanoseconds. */
+enum ClockBackend
+{
+	/** clock_gettime(BENCH_CLOCK_ID), normally served by the vDSO - unless the hypervisor's clocksource forces a syscall */
+	ClockBackend_ClockGettime,
+	/** clock_gettime(CLOCK_MONOTONIC), NTP-slewed */
+	ClockBackend_Monotonic,
+	/** clock_gettime(CLOCK_MONOTONIC_COARSE), last tick's time, never needs the clocksource */
+	ClockBackend_MonotonicCoarse,
+	/** clock_gettime(CLOCK_REALTIME) */
+	ClockBackend_Realtime,
+	/** clock_gettime(CLOCK_BOOTTIME), includes suspend, not accelerated by the vDSO on older kernels */
+	ClockBackend_Boottime,
+	/** clock_gettime(CLOCK_THREAD_CPUTIME_ID), CPU time of the thread, always a syscall */
+	ClockBackend_ThreadCputime,
+	/** gettimeofday(), microsecond resolution */
+	ClockBackend_Gettimeofday,
+	/** syscall(SYS_clock_gettime, BENCH_CLOCK_ID), bypasses the vDSO - what clock_gettime costs when it falls back */
+	ClockBackend_Syscall,
+	/** rdtscp, waits for earlier instructions to finish */
+	ClockBackend_Rdtscp,
+	/** lfence; rdtsc, for CPUs or hypervisors without rdtscp */
+	ClockBackend_LfenceRdtsc,
+
+	ClockBackend_Count
+};
+
+/** Name of the backend as used on the command line. */
+static inline const char* ClockBackendName(enum ClockBackend Backend)
+{
+	switch (Backend)
+	{
+		case ClockBackend_Monotonic:		return "monotonic";
+		case ClockBackend_MonotonicCoarse:	return "monotonic_coarse";
+		case ClockBackend_Realtime:			return "realtime";
+		case ClockBackend_Boottime:			return "boottime";
+		case ClockBackend_ThreadCputime:	return "thread_cputime";
+		case ClockBackend_Gettimeofday:		return "gettimeofday";
+		case ClockBackend_Syscall:			return "syscall";
+		case ClockBackend_Rdtscp:			return "rdtscp";
+		case ClockBackend_LfenceRdtsc:		return "lfence_rdtsc";
+		default:							return "clock_gettime";
+	}
+}
+
+/** Parses a backend name, returns 0 on success. */
+static inline int ParseClockBackend(const char* Name, enum ClockBackend* Backend)
+{
+	int IdxBackend;
+
+	for (IdxBackend = 0; IdxBackend < ClockBackend_Count; ++IdxBackend)
+	{
+		if (strcmp(Name, ClockBackendName((enum ClockBackend)IdxBackend)) == 0)
+		{
+			*Backend = (enum ClockBackend)IdxBackend;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Whether the CPU has a TSC that ticks at a constant rate through P- and C-states (CPUID 0x80000007 EDX bit 8). */
+static inline int HasInvariantTsc(void)
+{
+#if BENCH_HAS_TSC
+	unsigned int Eax, Ebx, Ecx, Edx;
+	return __get_cpuid(0x80000007, &Eax, &Ebx, &Ecx, &Edx) && (Edx & (1U << 8)) != 0;
+#else
+	return 0;
+#endif
+}
+
+/** Whether the backend reads the TSC directly. */
+static inline int IsTscClockBackend(enum ClockBackend Backend)
+{
+	return Backend == ClockBackend_Rdtscp || Backend == ClockBackend_LfenceRdtsc;
+}
+
+/** Whether the backend can be used here. */
+static inline int ClockBackendAvailable(enum ClockBackend Backend)
+{
+#if BENCH_HAS_TSC
+	unsigned int Eax, Ebx, Ecx, Edx;
+
+	switch (Backend)
+	{
+		case ClockBackend_Rdtscp:
+			return __get_cpuid(0x80000001, &Eax, &Ebx, &Ecx, &Edx) && (Edx & (1U << 27)) != 0;
+		case ClockBackend_LfenceRdtsc:
+			return 1;
+		default:
+			return 1;
+	}
+#else
+	return !IsTscClockBackend(Backend);
+#endif
+}
+
+/** Prints the names of the backends available here, comma separated. */
+static inline void PrintClockBackendNames(FILE* Out)
+{
+	int IdxBackend;
+
+	for (IdxBackend = 0; IdxBackend < ClockBackend_Count; ++IdxBackend)
+	{
+		if (ClockBackendAvailable((enum ClockBackend)IdxBackend))
+		{
+			fprintf(Out, "%s%s", IdxBackend ? ", " : "", ClockBackendName((enum ClockBackend)IdxBackend));
+		}
+	}
+}
+
+/** Reads the clock: nanoseconds for the OS clocks, cycles for the TSC backends. */
+static inline unsigned long long ReadClockTicks(enum ClockBackend Backend)
+{
+	struct timespec TimeSpec;
+	struct timeval TimeVal;
+#if BENCH_HAS_TSC
+	unsigned int Aux;
+#endif
+
+	switch (Backend)
+	{
+		case ClockBackend_Monotonic:
+			return GetClockInNs(CLOCK_MONOTONIC);
+		case ClockBackend_MonotonicCoarse:
+			return GetClockInNs(CLOCK_MONOTONIC_COARSE);
+		case ClockBackend_Realtime:
+			return GetClockInNs(CLOCK_REALTIME);
+		case ClockBackend_Boottime:
+			return GetClockInNs(CLOCK_BOOTTIME);
+		case ClockBackend_ThreadCputime:
+			return GetClockInNs(CLOCK_THREAD_CPUTIME_ID);
+		case ClockBackend_Gettimeofday:
+			gettimeofday(&TimeVal, NULL);
+			return (unsigned long long)TimeVal.tv_sec * 1000000000ULL + (unsigned long long)TimeVal.tv_usec * 1000ULL;
+		case ClockBackend_Syscall:
+			if (__builtin_expect(syscall(SYS_clock_gettime, BENCH_CLOCK_ID, &TimeSpec) != 0, 0))
+			{
+				fprintf(stderr, "syscall(SYS_clock_gettime) failed, errno = %d (%s)\n", errno, strerror(errno));
+				exit(1);
+			}
+			return TimespecToNs(&TimeSpec);
+#if BENCH_HAS_TSC
+		case ClockBackend_Rdtscp:
+			return __rdtscp(&Aux);
+		case ClockBackend_LfenceRdtsc:
+			_mm_lfence();
+			return __rdtsc();
+#endif
+		default:
+			break;
+	}
+
+	return GetTimeInNs();
+}
+
+/** Reads TSC cycles, or 0 where there is no TSC. Hypervisors may hide RDTSCP, lfence + rdtsc is used then. */
+static inline unsigned long long ReadTscCycles(void)
+{
+#if BENCH_HAS_TSC
+	/* -1 until checked, cpuid can trap to the hypervisor so it is only asked once */
+	static int HaveRdtscp = -1;
+	unsigned int Aux;
+
+	if (HaveRdtscp < 0)
+	{
+		HaveRdtscp = ClockBackendAvailable(ClockBackend_Rdtscp);
+	}
+	if (HaveRdtscp)
+	{
+		return __rdtscp(&Aux);
+	}
+	_mm_lfence();
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Measures nanoseconds per TSC cycle against BENCH_CLOCK_ID, over about CalibrationNs.
+ * Each end point is the pair of readings with the smallest TSC gap around the clock read, out of a few tries.
+ *
+ * @return nanoseconds per cycle, or 0 where there is no TSC
+ */
+static inline double CalibrateTsc(unsigned long long CalibrationNs)
+{
+#if BENCH_HAS_TSC
+	unsigned long long PointNs[2] = { 0, 0 }, PointCycles[2] = { 0, 0 };
+	unsigned long long Before, After, Ns, BestGap;
+	int IdxEnd, IdxTry;
+
+	for (IdxEnd = 0; IdxEnd < 2; ++IdxEnd)
+	{
+		BestGap = ~0ULL;
+		for (IdxTry = 0; IdxTry < 16; ++IdxTry)
+		{
+			_mm_lfence();
+			Before = __rdtsc();
+			Ns = GetTimeInNs();
+			_mm_lfence();
+			After = __rdtsc();
+
+			if (After - Before < BestGap)
+			{
+				BestGap = After - Before;
+				PointNs[IdxEnd] = Ns;
+				PointCycles[IdxEnd] = Before + (After - Before) / 2;
+			}
+		}
+
+		if (IdxEnd == 0)
+		{
+			SleepNs(CalibrationNs);
+		}
+	}
+
+	return (PointCycles[1] > PointCycles[0]) ? (double)(PointNs[1] - PointNs[0]) / (double)(PointCycles[1] - PointCycles[0]) : 0;
+#else
+	(void)CalibrationNs;
+	return 0;
+#endif
+}
+
+/** Nanoseconds per tick of the backend, given the calibrated TSC rate. */
+static inline double ClockBackendNsPerTick(enum ClockBackend Backend, double TscNsPerCycle)
+{
+	return IsTscClockBackend(Backend) ? TscNsPerCycle : 1.0;
+}
+
+/**
+ * Times NumReads back to back reads through the backend.
+ *
+ * @param CyclesPerRead receives TSC cycles per read, 0 where there is no TSC
+ * @return nanoseconds per read
+ */
+static inline double MeasureClockReadCost(enum ClockBackend Backend, unsigned long long NumReads, double* CyclesPerRead)
+{
+	unsigned long long IdxRead, StartNs, StartCycles, EndNs, EndCycles;
+	volatile unsigned long long Sink = 0;
+
+	StartNs = GetTimeInNs();
+	StartCycles = ReadTscCycles();
+	for (IdxRead = 0; IdxRead < NumReads; ++IdxRead)
+	{
+		Sink += ReadClockTicks(Backend);
+	}
+	EndCycles = ReadTscCycles();
+	EndNs = GetTimeInNs();
+
+	(void)Sink;
+	*CyclesPerRead = (double)(EndCycles - StartCycles) / (double)NumReads;
+	return (double)(EndNs - StartNs) / (double)NumReads;
+}
+
+/** Name of the kernel clocksource (tsc, kvm-clock, hyperv_clocksource_tsc_page, xen...) or "unknown". */
+static inline const char* GetKernelClocksource(char* Buffer, size_t BufferSize)
+{
+	FILE* File = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+	size_t Length;
+
+	if (File == NULL || fgets(Buffer, (int)BufferSize, File) == NULL)
+	{
+		snprintf(Buffer, BufferSize, "unknown");
+	}
+	if (File != NULL)
+	{
+		fclose(File);
+	}
+
+	Length = strlen(Buffer);
+	if (Length > 0 && Buffer[Length - 1] == '\n')
+	{
+		Buffer[Length - 1] = 0;
+	}
+	return Buffer;
+}
+
+/** Prints the kernel clocksource, TSC capabilities and calibrated frequency on one line. */
+static inline void PrintClockInfo(double TscNsPerCycle)
+{
+	char Clocksource[64];
+
+	printf("KernelClocksource, %s, InvariantTsc, %s, Rdtscp, %s, TscFrequency(MHz), %.1f\n",
+		GetKernelClocksource(Clocksource, sizeof(Clocksource)),
+		HasInvariantTsc() ? "yes" : "no",
+		ClockBackendAvailable(ClockBackend_Rdtscp) ? "yes" : "no",
+		(TscNsPerCycle > 0) ? 1000.0 / TscNsPerCycle : 0.0);
+}
+
+#ifdef _GNU_SOURCE
+/* CPU placement, needs _GNU_SOURCE defined before the first include (always the case for g++) */
+#include <sched.h>
+#include <pthread.h>
+
+/** Fills Cpus with the CPUs this process may run on, returns their number. */
+static inline int GetAllowedCpus(int* Cpus, int MaxCpus)
+{
+	cpu_set_t CpuSet;
+	int IdxCpu, NumCpus = 0;
+
+	if (sched_getaffinity(0, sizeof(CpuSet), &CpuSet) != 0)
+	{
+		return 0;
+	}
+
+	for (IdxCpu = 0; IdxCpu < CPU_SETSIZE && NumCpus < MaxCpus; ++IdxCpu)
+	{
+		if (CPU_ISSET(IdxCpu, &CpuSet))
+		{
+			Cpus[NumCpus++] = IdxCpu;
+		}
+	}
+
+	return NumCpus;
+}
+
+/** Pins the calling thread to one CPU, returns 0 on success or an errno value. */
+static inline int PinThreadToCpu(int Cpu)
+{
+	cpu_set_t CpuSet;
+
+	CPU_ZERO(&CpuSet);
+	CPU_SET(Cpu, &CpuSet);
+	return pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet);
+}
+#endif /* _GNU_SOURCE */
+
+/** Current UTC time as returned by asctime(), including the trailing newline. Not reentrant. */
+static inline const char* UtcTimeString(void)
+{
+	time_t Time = time(NULL);
+	return asctime(gmtime(&Time));
+}
+
+/** Same as UtcTimeString(), for a CLOCK_REALTIME reading in ns. */
+static inline const char* UtcTimeStringAt(unsigned long long RealTimeNs)
+{
+	time_t Time = (time_t)(RealTimeNs / 1000000000ULL);
+	return asctime(gmtime(&Time));
+}
+
+/** State for online mean and variance */
+struct StabilityParams
+{
+	double NumObservations;
+	double Mean, Mean2;
+	double Min, Max;
+};
+
+/** Updates state of an online std dev calculation. */
+static inline void UpdateObservation(struct StabilityParams* Params, double Value)
+{
+	double Delta;
+
+	++Params->NumObservations;
+
+	Delta = Value - Params->Mean;
+
+	Params->Mean += Delta / Params->NumObservations;
+	Params->Mean2 += Delta * (Value - Params->Mean);
+
+	if (Params->NumObservations > 1)
+	{
+		Params->Min = (Value < Params->Min) ? Value : Params->Min;
+		Params->Max = (Value > Params->Max) ? Value : Params->Max;
+	}
+	else
+	{
+		Params->Min = Value;
+		Params->Max = Value;
+	}
+}
+
+/** Folds state of one online std dev calculation into another (parallel variant of the update above). */
+static inline void MergeObservations(struct StabilityParams* Params, const struct StabilityParams* Other)
+{
+	double NumObservations, Delta;
+
+	if (Other->NumObservations == 0)
+	{
+		return;
+	}
+
+	if (Params->NumObservations == 0)
+	{
+		*Params = *Other;
+		return;
+	}
+
+	NumObservations = Params->NumObservations + Other->NumObservations;
+	Delta = Other->Mean - Params->Mean;
+
+	Params->Mean += Delta * Other->NumObservations / NumObservations;
+	Params->Mean2 += Other->Mean2 + Delta * Delta * Params->NumObservations * Other->NumObservations / NumObservations;
+	Params->NumObservations = NumObservations;
+
+	Params->Min = (Other->Min < Params->Min) ? Other->Min : Params->Min;
+	Params->Max = (Other->Max > Params->Max) ? Other->Max : Params->Max;
+}
+
+/** Calculates values and prints them. Unit is only used for labels. */
+static inline void PrintValues(const struct StabilityParams* Params, const char* Unit)
+{
+	double Variance = 0, StandardDeviation = 0, RelativeStdDev = 0;
+
+	if (Params->NumObservations > 1)
+	{
+		Variance = Params->Mean2 / (Params->NumObservations - 1);
+		StandardDeviation = sqrt( Variance );
+
+		if (Params->Mean * Params->Mean > 0.0001)
+		{
+			RelativeStdDev = 100.0 * StandardDeviation / Params->Mean;
+		}
+	}
+
+	printf("Min(%s), %.1f, Max(%s), %.1f, Mean(%s), %.1f, StdDev(%s), %.1f, RelStdDev(%%), %.1f, DataSize, %.f",
+		Unit, Params->Min, Unit, Params->Max, Unit, Params->Mean, Unit, StandardDeviation, RelativeStdDev, Params->NumObservations);
+}
+
+/** Linear sub-buckets per power of two: 2^7 = 128, so values are kept to within ~0.8% */
+#define HISTOGRAM_SUB_BUCKET_BITS	7
+#define HISTOGRAM_SUB_BUCKETS		(1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/** Enough buckets to cover the whole unsigned 64-bit range */
+#define HISTOGRAM_NUM_BUCKETS		((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Fixed-size log-bucketed histogram (HDR style) of integer values. Values below 256 are exact, above that each
+ * power of two is split into 128 buckets. The layout never changes, so histograms of several threads or
+ * processes are merged just by adding up counts.
+ */
+struct LatencyHistogram
+{
+	unsigned long long TotalCount;
+	unsigned long long Counts[HISTOGRAM_NUM_BUCKETS];
+};
+
+/** Index of the bucket holding Value. */
+static inline int HistogramBucket(unsigned long long Value)
+{
+	int Exponent;
+
+	if (Value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return (int)Value;
+	}
+
+	Exponent = 63 - __builtin_clzll(Value);
+	return (Exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + (int)((Value >> (Exponent - HISTOGRAM_SUB_BUCKET_BITS)) - HISTOGRAM_SUB_BUCKETS);
+}
+
+/** Middle of the range of values that land in the bucket. */
+static inline double HistogramBucketValue(int IdxBucket)
+{
+	int Exponent;
+	unsigned long long Width;
+
+	if (IdxBucket < 2 * HISTOGRAM_SUB_BUCKETS)
+	{
+		return (double)IdxBucket;
+	}
+
+	Exponent = IdxBucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+	Width = 1ULL << (Exponent - HISTOGRAM_SUB_BUCKET_BITS);
+	return (double)((HISTOGRAM_SUB_BUCKETS + IdxBucket % HISTOGRAM_SUB_BUCKETS) * Width) + (double)(Width - 1) / 2.0;
+}
+
+/** Records a value, does not allocate. */
+static inline void UpdateHistogram(struct LatencyHistogram* Histogram, unsigned long long Value)
+{
+	++Histogram->Counts[HistogramBucket(Value)];
+	++Histogram->TotalCount;
+}
+
+/** Adds counts of Other to Histogram. */
+static inline void MergeHistogram(struct LatencyHistogram* Histogram, const struct LatencyHistogram* Other)
+{
+	int IdxBucket;
+
+	for (IdxBucket = 0; IdxBucket < HISTOGRAM_NUM_BUCKETS; ++IdxBucket)
+	{
+		Histogram->Counts[IdxBucket] += Other->Counts[IdxBucket];
+	}
+	Histogram->TotalCount += Other->TotalCount;
+}
+
+/** Value below which Percentile percent of recorded values fall, as the middle of the bucket it lands in. */
+static inline double HistogramPercentile(const struct LatencyHistogram* Histogram, double Percentile)
+{
+	unsigned long long Target, Seen = 0;
+	int IdxBucket;
+
+	if (Histogram->TotalCount == 0)
+	{
+		return 0;
+	}
+
+	Target = (unsigned long long)ceil(Percentile / 100.0 * (double)Histogram->TotalCount);
+	Target = (Target < 1) ? 1 : Target;
+
+	for (IdxBucket = 0; IdxBucket < HISTOGRAM_NUM_BUCKETS - 1; ++IdxBucket)
+	{
+		Seen += Histogram->Counts[IdxBucket];
+		if (Seen >= Target)
+		{
+			break;
+		}
+	}
+
+	return HistogramBucketValue(IdxBucket);
+}
+
+/** Prints tail percentiles of a histogram of nanoseconds, divided by NsPerUnit. Unit is only used for labels. */
+static inline void PrintPercentiles(const struct LatencyHistogram* Histogram, double NsPerUnit, const char* Unit)
+{
+	printf("P50(%s), %.2f, P90(%s), %.2f, P99(%s), %.2f, P99.9(%s), %.2f, P99.99(%s), %.2f",
+		Unit, HistogramPercentile(Histogram, 50.0) / NsPerUnit, Unit, HistogramPercentile(Histogram, 90.0) / NsPerUnit,
+		Unit, HistogramPercentile(Histogram, 99.0) / NsPerUnit, Unit, HistogramPercentile(Histogram, 99.9) / NsPerUnit,
+		Unit, HistogramPercentile(Histogram, 99.99) / NsPerUnit);
+}
+
+#endif // BENCH_CORE_H
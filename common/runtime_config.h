@@ -0,0 +1,450 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Header-only runtime configuration shared by the long-running tools: timer slack, scheduling policy,
+ * memory locking, the CPUs to run on and prefaulting. Every tool takes the same options for them
+ * (RUNTIME_CONFIG_OPTIONS), applies the process-wide ones once from main() and the per-thread ones on each
+ * measuring thread, and prints what is actually in effect in its header, so tuned and untuned runs of the
+ * same binaries can be told apart and compared. Needs _GNU_SOURCE defined before the first include.
+ */
+
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/** Options of every tool, to append to its getopt() string */
+#define RUNTIME_CONFIG_OPTIONS			"T:P:MC:F"
+
+/** Stack each measuring thread touches when prefaulting */
+#define RUNTIME_CONFIG_STACK_PREFAULT	(256 * 1024)
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE					6
+#endif
+
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK		0x01
+#endif
+
+enum RuntimePolicy
+{
+	/** Leave the policy the thread was started with */
+	RuntimePolicy_Default,
+	RuntimePolicy_Fifo,
+	RuntimePolicy_RoundRobin,
+	RuntimePolicy_Deadline,
+};
+
+struct RuntimeConfig
+{
+	/** Timer slack of measuring threads, 0 to leave the kernel's default */
+	unsigned long long TimerSlackNs;
+	enum RuntimePolicy Policy;
+	/** Priority for fifo and rr */
+	int Priority;
+	/** Runtime and period for deadline, the deadline is the end of the period */
+	unsigned long long RuntimeNs, PeriodNs;
+	/** mlockall() everything, current and future */
+	int LockMemory;
+	/** Touch working sets and the stacks of measuring threads before measuring */
+	int Prefault;
+	/** Whether the process is restricted to Cpus */
+	int HaveCpus;
+	cpu_set_t Cpus;
+};
+
+/** Layout sched_setattr() takes, glibc only wraps it in recent versions */
+struct RuntimeSchedAttr
+{
+	uint32_t Size;
+	uint32_t Policy;
+	uint64_t Flags;
+	int32_t Nice;
+	uint32_t Priority;
+	uint64_t Runtime;
+	uint64_t Deadline;
+	uint64_t Period;
+};
+
+static inline void RuntimeConfigInit(struct RuntimeConfig* Config)
+{
+	memset(Config, 0, sizeof(*Config));
+	Config->Policy = RuntimePolicy_Default;
+}
+
+/** Parses a cpu list like the kernel prints them ("0-3,6"), returns 0 on success. */
+static inline int RuntimeConfigParseCpuList(const char* List, cpu_set_t* Cpus)
+{
+	char* End;
+	long First, Last, Cpu;
+
+	CPU_ZERO(Cpus);
+	while (*List != 0 && *List != '\n')
+	{
+		First = strtol(List, &End, 10);
+		if (End == List || First < 0)
+		{
+			return -1;
+		}
+		Last = First;
+		if (*End == '-')
+		{
+			List = End + 1;
+			Last = strtol(List, &End, 10);
+			if (End == List || Last < First)
+			{
+				return -1;
+			}
+		}
+		if (Last >= CPU_SETSIZE)
+		{
+			return -1;
+		}
+		for (Cpu = First; Cpu <= Last; ++Cpu)
+		{
+			CPU_SET(Cpu, Cpus);
+		}
+
+		List = (*End == ',') ? End + 1 : End;
+		if (*End != ',' && *End != 0 && *End != '\n')
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Prints a cpu set in the kernel's list format into Buffer, "none" if empty. */
+static inline const char* RuntimeConfigFormatCpuList(const cpu_set_t* Cpus, char* Buffer, size_t BufferSize)
+{
+	size_t Length = 0;
+	int Cpu, Last;
+
+	Buffer[0] = 0;
+	for (Cpu = 0; Cpu < CPU_SETSIZE && Length < BufferSize; ++Cpu)
+	{
+		if (!CPU_ISSET(Cpu, Cpus))
+		{
+			continue;
+		}
+		for (Last = Cpu; Last + 1 < CPU_SETSIZE && CPU_ISSET(Last + 1, Cpus); ++Last)
+		{
+		}
+		Length += snprintf(Buffer + Length, BufferSize - Length, (Last > Cpu) ? "%s%d-%d" : "%s%d", (Length > 0) ? "," : "", Cpu, Last);
+		Cpu = Last;
+	}
+
+	return (Buffer[0] != 0) ? Buffer : "none";
+}
+
+/** Reads a cpu list from sysfs, the set is empty if the file is missing (kernel without the feature). */
+static inline void RuntimeConfigReadCpuList(const char* Path, cpu_set_t* Cpus)
+{
+	char Line[1024];
+	FILE* File = fopen(Path, "r");
+
+	CPU_ZERO(Cpus);
+	if (File == NULL)
+	{
+		return;
+	}
+	if (fgets(Line, sizeof(Line), File) != NULL && RuntimeConfigParseCpuList(Line, Cpus) != 0)
+	{
+		CPU_ZERO(Cpus);
+	}
+	fclose(File);
+}
+
+/**
+ * Handles one of RUNTIME_CONFIG_OPTIONS.
+ *
+ * @return 0 if handled, 1 if Option is not one of them, -1 if its argument is invalid
+ */
+static inline int RuntimeConfigParseOption(struct RuntimeConfig* Config, int Option, const char* Arg)
+{
+	double RuntimeUs = 0, PeriodUs = 0;
+
+	switch (Option)
+	{
+		case 'T':
+			Config->TimerSlackNs = strtoull(Arg, NULL, 10);
+			return (Config->TimerSlackNs > 0) ? 0 : -1;
+
+		case 'P':
+			if (strncmp(Arg, "fifo:", 5) == 0 || strncmp(Arg, "rr:", 3) == 0)
+			{
+				Config->Policy = (Arg[0] == 'f') ? RuntimePolicy_Fifo : RuntimePolicy_RoundRobin;
+				Config->Priority = atoi(strchr(Arg, ':') + 1);
+				return (Config->Priority >= 1 && Config->Priority <= 99) ? 0 : -1;
+			}
+			if (sscanf(Arg, "deadline:%lf:%lf", &RuntimeUs, &PeriodUs) == 2 && RuntimeUs > 0 && PeriodUs >= RuntimeUs)
+			{
+				Config->Policy = RuntimePolicy_Deadline;
+				Config->RuntimeNs = (unsigned long long)(RuntimeUs * 1000.0);
+				Config->PeriodNs = (unsigned long long)(PeriodUs * 1000.0);
+				return 0;
+			}
+			return -1;
+
+		case 'M':
+			Config->LockMemory = 1;
+			return 0;
+
+		case 'C':
+			Config->HaveCpus = 1;
+			return (RuntimeConfigParseCpuList(Arg, &Config->Cpus) == 0 && CPU_COUNT(&Config->Cpus) > 0) ? 0 : -1;
+
+		case 'F':
+			Config->Prefault = 1;
+			return 0;
+
+		default:
+			return 1;
+	}
+}
+
+/** Synopsis of the options, for the first usage line */
+#define RUNTIME_CONFIG_SYNOPSIS	"[-T slack_ns] [-P fifo:prio|rr:prio|deadline:runtime_us:period_us] [-M] [-C cpus] [-F]"
+
+/** Prints the options, one line each, in the format of the tools' usage texts. */
+static inline void RuntimeConfigPrintUsage(void)
+{
+	printf("  -T ns         timer slack of measuring threads (default: the kernel's, usually 50000), real-time policies always have none\n");
+	printf("  -P policy     scheduling policy of measuring threads: fifo:prio, rr:prio or deadline:runtime_us:period_us (default: unchanged)\n");
+	printf("  -M            lock all memory, current and future, with mlockall()\n");
+	printf("  -C cpus       run only on these cpus, as a list like 2-3,6; the header shows whether the kernel isolates them\n");
+	printf("  -F            prefault working sets and thread stacks before measuring\n");
+}
+
+/**
+ * Applies the process-wide settings: the cpus to run on and memory locking. Call from main() before any
+ * thread is created, they inherit its affinity.
+ *
+ * @param Failed set to the name of the setting that could not be applied
+ * @return 0 on success, otherwise an errno value
+ */
+static inline int RuntimeConfigApply(const struct RuntimeConfig* Config, const char** Failed)
+{
+	if (Config->HaveCpus && sched_setaffinity(0, sizeof(Config->Cpus), &Config->Cpus) != 0)
+	{
+		*Failed = "cpu affinity";
+		return errno;
+	}
+
+	if (Config->LockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		*Failed = "mlockall";
+		return errno;
+	}
+
+	return 0;
+}
+
+/** Touches every page of Memory if prefaulting, keeping its contents. */
+static inline void RuntimeConfigPrefault(const struct RuntimeConfig* Config, void* Memory, size_t Size)
+{
+	volatile char* Bytes = (volatile char*)Memory;
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE), Offset;
+
+	if (!Config->Prefault || Size == 0)
+	{
+		return;
+	}
+
+	for (Offset = 0; Offset < Size; Offset += PageSize)
+	{
+		Bytes[Offset] = Bytes[Offset];
+	}
+	Bytes[Size - 1] = Bytes[Size - 1];
+}
+
+/** Timer slack measuring threads run with: real-time policies always get none. */
+static inline unsigned long long RuntimeConfigEffectiveSlackNs(const struct RuntimeConfig* Config)
+{
+	if (Config->Policy != RuntimePolicy_Default)
+	{
+		return 0;
+	}
+	return (Config->TimerSlackNs > 0) ? Config->TimerSlackNs : (unsigned long long)prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+}
+
+/**
+ * Applies the per-thread settings to the calling thread and reads them back: scheduling policy, timer
+ * slack and the stack prefault. Call first thing on each measuring thread. Deadline threads are set to
+ * reset on fork, the kernel does not let them create threads otherwise.
+ *
+ * @param Failed set to the name of the setting that could not be applied or did not stick
+ * @return 0 on success, otherwise an errno value
+ */
+static inline int RuntimeConfigApplyThread(const struct RuntimeConfig* Config, const char** Failed)
+{
+	struct sched_param Param;
+	struct RuntimeSchedAttr Attr;
+	int Policy = SCHED_OTHER;
+
+	/* policy first, the kernel drops the slack of real-time threads and restores the default when they leave it */
+	if (Config->Policy == RuntimePolicy_Fifo || Config->Policy == RuntimePolicy_RoundRobin)
+	{
+		Policy = (Config->Policy == RuntimePolicy_Fifo) ? SCHED_FIFO : SCHED_RR;
+		memset(&Param, 0, sizeof(Param));
+		Param.sched_priority = Config->Priority;
+		if (sched_setscheduler(0, Policy, &Param) != 0)
+		{
+			*Failed = "scheduling policy";
+			return errno;
+		}
+	}
+	else if (Config->Policy == RuntimePolicy_Deadline)
+	{
+		Policy = SCHED_DEADLINE;
+		memset(&Attr, 0, sizeof(Attr));
+		Attr.Size = sizeof(Attr);
+		Attr.Policy = SCHED_DEADLINE;
+		Attr.Flags = SCHED_FLAG_RESET_ON_FORK;
+		Attr.Runtime = Config->RuntimeNs;
+		Attr.Deadline = Config->PeriodNs;
+		Attr.Period = Config->PeriodNs;
+		if (syscall(SYS_sched_setattr, 0, &Attr, 0) != 0)
+		{
+			*Failed = "deadline scheduling (admission control, or affinity narrower than the root domain)";
+			return errno;
+		}
+	}
+
+	if (Config->Policy != RuntimePolicy_Default && (sched_getscheduler(0) & ~SCHED_RESET_ON_FORK) != Policy)
+	{
+		*Failed = "scheduling policy (did not stick)";
+		return EINVAL;
+	}
+
+	if (Config->TimerSlackNs > 0 && Config->Policy == RuntimePolicy_Default)
+	{
+		if (prctl(PR_SET_TIMERSLACK, Config->TimerSlackNs, 0, 0, 0) != 0)
+		{
+			*Failed = "timer slack";
+			return errno;
+		}
+		if ((unsigned long long)prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) != Config->TimerSlackNs)
+		{
+			*Failed = "timer slack (did not stick)";
+			return EINVAL;
+		}
+	}
+
+	if (Config->Prefault)
+	{
+		volatile char Stack[RUNTIME_CONFIG_STACK_PREFAULT];
+		size_t Offset;
+
+		for (Offset = 0; Offset < sizeof(Stack); Offset += 1024)
+		{
+			Stack[Offset] = 0;
+		}
+	}
+
+	return 0;
+}
+
+/** Value of a "Name: value kB" line of /proc/self/status, 0 if not found. */
+static inline unsigned long long RuntimeConfigStatusKb(const char* Name)
+{
+	char Line[256];
+	unsigned long long Value = 0;
+	size_t NameLength = strlen(Name);
+	FILE* File = fopen("/proc/self/status", "r");
+
+	if (File == NULL)
+	{
+		return 0;
+	}
+	while (fgets(Line, sizeof(Line), File) != NULL)
+	{
+		if (strncmp(Line, Name, NameLength) == 0 && Line[NameLength] == ':')
+		{
+			Value = strtoull(Line + NameLength + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(File);
+
+	return Value;
+}
+
+/**
+ * Prints what is in effect, as one line: settings of measuring threads as they were verified, memory locked so
+ * far, the cpus the process runs on against the ones the kernel isolates, and page faults taken during setup.
+ */
+static inline void RuntimeConfigPrint(const struct RuntimeConfig* Config)
+{
+	char Cpus[256], Isolated[256], NohzFull[256];
+	cpu_set_t Allowed, IsolatedCpus, NohzFullCpus, Quiet;
+	struct rusage Usage;
+	const char* Isolation;
+
+	sched_getaffinity(0, sizeof(Allowed), &Allowed);
+	RuntimeConfigReadCpuList("/sys/devices/system/cpu/isolated", &IsolatedCpus);
+	RuntimeConfigReadCpuList("/sys/devices/system/cpu/nohz_full", &NohzFullCpus);
+
+	/* cpus are only quiet if the scheduler leaves them alone and the tick is off */
+	CPU_AND(&Quiet, &IsolatedCpus, &NohzFullCpus);
+	CPU_AND(&Quiet, &Quiet, &Allowed);
+	Isolation = (CPU_COUNT(&Quiet) == CPU_COUNT(&Allowed)) ? "yes" : (CPU_COUNT(&Quiet) > 0) ? "partly" : "no";
+
+	getrusage(RUSAGE_SELF, &Usage);
+
+	printf("Runtime, TimerSlack(ns), %llu, Policy, ", RuntimeConfigEffectiveSlackNs(Config));
+	switch (Config->Policy)
+	{
+		case RuntimePolicy_Fifo:		printf("fifo:%d", Config->Priority); break;
+		case RuntimePolicy_RoundRobin:	printf("rr:%d", Config->Priority); break;
+		case RuntimePolicy_Deadline:	printf("deadline:%.1f:%.1f", (double)Config->RuntimeNs / 1000.0, (double)Config->PeriodNs / 1000.0); break;
+		default:						printf("default"); break;
+	}
+	printf(", MemoryLocked(KB), %llu, Prefault, %s, Cpus, %s, Isolated, %s, NohzFull, %s, CpusIsolated, %s, MinorFaults, %ld, MajorFaults, %ld\n",
+		RuntimeConfigStatusKb("VmLck"), Config->Prefault ? "yes" : "no",
+		RuntimeConfigFormatCpuList(&Allowed, Cpus, sizeof(Cpus)),
+		RuntimeConfigFormatCpuList(&IsolatedCpus, Isolated, sizeof(Isolated)),
+		RuntimeConfigFormatCpuList(&NohzFullCpus, NohzFull, sizeof(NohzFull)),
+		Isolation, Usage.ru_minflt, Usage.ru_majflt);
+}
+
+#endif /* RUNTIME_CONFIG_H */
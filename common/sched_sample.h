@@ -0,0 +1,477 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Header-only sampler of the counters that explain a stall: steal and interrupt time of each CPU (/proc/stat),
+ * interrupts delivered to each CPU (/proc/interrupts), and, for each watched thread, the time it spent runnable
+ * but waiting for a CPU and its voluntary and involuntary context switches (/proc/self/task/<tid>/schedstat
+ * and status). A background thread takes a sample every so often into a history; afterwards, the deltas over
+ * any stall still in the history come from the samples around it. The watched threads never touch /proc.
+ */
+
+#ifndef SCHED_SAMPLE_H
+#define SCHED_SAMPLE_H
+
+#include <fcntl.h>
+#include "bench_core.h"
+
+/** Samples kept, at the tracer's drain interval this covers the last 12.8 seconds */
+#define SCHED_SAMPLE_HISTORY	256
+
+/** Threads that can be watched */
+#define SCHED_SAMPLE_MAX_THREADS	4096
+
+/** What happened around a stall, over the window between the samples taken before and after it. All zero if unsampled */
+struct SchedDeltas
+{
+	/** Time between the two samples, covers the stall (unless it started before the oldest sample) */
+	unsigned long long WindowNs;
+	/** Time the hypervisor ran something else on the stalled CPU */
+	unsigned long long StealNs;
+	/** Time the stalled CPU spent in hard and soft interrupt handlers */
+	unsigned long long IrqTimeNs;
+	/** Interrupts delivered to the stalled CPU */
+	unsigned long long NumInterrupts;
+	/** Time the stalled thread was runnable but another task had its CPU */
+	unsigned long long RunDelayNs;
+	unsigned int NumVoluntarySwitches;
+	unsigned int NumInvoluntarySwitches;
+};
+
+struct SchedSampler
+{
+	int NumCpus;
+	int NumThreads;
+	double NsPerTick;
+
+	int StatFd;
+	int InterruptsFd;
+	/** Per watched thread: its tid (0 if none), and its schedstat and status files once opened */
+	int* Tids;
+	int* SchedstatFds;
+	int* StatusFds;
+
+	/** Buffer the /proc files are read into, grows as needed */
+	char* Text;
+	size_t TextSize;
+
+	/**
+	 * Ring of samples, each SampleSize values: the time taken, steal ticks, irq ticks and interrupts of
+	 * each CPU, then run delay, voluntary and involuntary switches of each thread
+	 */
+	unsigned long long* Samples;
+	size_t SampleSize;
+	/** Samples taken so far, the newest is at (NumSamples - 1) % SCHED_SAMPLE_HISTORY */
+	unsigned long long NumSamples;
+};
+
+/** Reads the whole of a /proc file through an fd kept open, into Sampler->Text. Returns the length, or -1. */
+static inline ssize_t SchedSamplerRead(struct SchedSampler* Sampler, int Fd)
+{
+	size_t Length = 0;
+
+	for (;;)
+	{
+		ssize_t Result;
+
+		if (Length + 1 >= Sampler->TextSize)
+		{
+			char* Grown = (char*)realloc(Sampler->Text, Sampler->TextSize * 2);
+			if (Grown == NULL)
+			{
+				return -1;
+			}
+			Sampler->Text = Grown;
+			Sampler->TextSize *= 2;
+		}
+
+		/* proc files regenerate from the start when read at offset 0 */
+		Result = pread(Fd, Sampler->Text + Length, Sampler->TextSize - Length - 1, (off_t)Length);
+		if (Result < 0)
+		{
+			return -1;
+		}
+		if (Result == 0)
+		{
+			break;
+		}
+		Length += (size_t)Result;
+	}
+
+	Sampler->Text[Length] = 0;
+	return (ssize_t)Length;
+}
+
+/** Value following Label in a "Label: value" file, 0 if not found */
+static inline unsigned long long SchedSamplerField(const char* Text, const char* Label)
+{
+	const char* Found = strstr(Text, Label);
+	return (Found != NULL) ? strtoull(Found + strlen(Label), NULL, 10) : 0;
+}
+
+/**
+ * Opens the system wide files. Threads are watched once given to SchedSamplerWatch().
+ *
+ * @return 0 on success, otherwise an errno value (a sampler that failed to initialize samples nothing)
+ */
+static inline int SchedSamplerInit(struct SchedSampler* Sampler, int NumThreads)
+{
+	int IdxThread;
+
+	memset(Sampler, 0, sizeof(*Sampler));
+	Sampler->StatFd = -1;
+	Sampler->InterruptsFd = -1;
+
+	if (NumThreads > SCHED_SAMPLE_MAX_THREADS)
+	{
+		return EINVAL;
+	}
+
+	Sampler->NumCpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+	Sampler->NsPerTick = 1e9 / (double)sysconf(_SC_CLK_TCK);
+	Sampler->SampleSize = 1 + 3 * (size_t)Sampler->NumCpus + 3 * (size_t)NumThreads;
+	Sampler->TextSize = 65536;
+	Sampler->Text = (char*)malloc(Sampler->TextSize);
+	Sampler->Samples = (unsigned long long*)calloc(SCHED_SAMPLE_HISTORY * Sampler->SampleSize, sizeof(unsigned long long));
+	Sampler->Tids = (int*)calloc(NumThreads, sizeof(int));
+	Sampler->SchedstatFds = (int*)malloc(NumThreads * sizeof(int));
+	Sampler->StatusFds = (int*)malloc(NumThreads * sizeof(int));
+	if (Sampler->Text == NULL || Sampler->Samples == NULL || Sampler->Tids == NULL || Sampler->SchedstatFds == NULL || Sampler->StatusFds == NULL)
+	{
+		return ENOMEM;
+	}
+	for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+	{
+		Sampler->SchedstatFds[IdxThread] = -1;
+		Sampler->StatusFds[IdxThread] = -1;
+	}
+	Sampler->NumThreads = NumThreads;
+
+	Sampler->StatFd = open("/proc/stat", O_RDONLY);
+	Sampler->InterruptsFd = open("/proc/interrupts", O_RDONLY);
+	if (Sampler->StatFd < 0 || Sampler->InterruptsFd < 0)
+	{
+		return errno;
+	}
+
+	return 0;
+}
+
+/** Starts watching a thread, e.g. the owner of a trace ring. Only the sampling thread may call it. */
+static inline void SchedSamplerWatch(struct SchedSampler* Sampler, int IdxThread, int Tid)
+{
+	char Path[64];
+
+	if (IdxThread < 0 || IdxThread >= Sampler->NumThreads || Sampler->Tids == NULL || Sampler->Tids[IdxThread] == Tid)
+	{
+		return;
+	}
+
+	/* the slot may be reused by a new owner, do not leak the old thread's files */
+	if (Sampler->SchedstatFds[IdxThread] >= 0)
+	{
+		close(Sampler->SchedstatFds[IdxThread]);
+	}
+	if (Sampler->StatusFds[IdxThread] >= 0)
+	{
+		close(Sampler->StatusFds[IdxThread]);
+	}
+
+	Sampler->Tids[IdxThread] = Tid;
+	snprintf(Path, sizeof(Path), "/proc/self/task/%d/schedstat", Tid);
+	Sampler->SchedstatFds[IdxThread] = open(Path, O_RDONLY);
+	snprintf(Path, sizeof(Path), "/proc/self/task/%d/status", Tid);
+	Sampler->StatusFds[IdxThread] = open(Path, O_RDONLY);
+}
+
+/** Takes a sample of all counters into the history. Only the sampling thread may call it. */
+static inline void SchedSamplerTake(struct SchedSampler* Sampler)
+{
+	unsigned long long* Sample;
+	unsigned long long* Cpus;
+	unsigned long long* Threads;
+	int IdxThread;
+
+	if (Sampler->StatFd < 0 || Sampler->InterruptsFd < 0)
+	{
+		return;
+	}
+
+	/* counters the files do not have (e.g. offline CPUs) stay as they were in the previous sample, so their deltas are 0 */
+	Sample = &Sampler->Samples[(Sampler->NumSamples % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize];
+	if (Sampler->NumSamples > 0)
+	{
+		memcpy(Sample, &Sampler->Samples[((Sampler->NumSamples - 1) % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize], Sampler->SampleSize * sizeof(unsigned long long));
+	}
+	Cpus = Sample + 1;
+	Threads = Cpus + 3 * Sampler->NumCpus;
+
+	/* "cpuN user nice system idle iowait irq softirq steal ...", in ticks */
+	if (SchedSamplerRead(Sampler, Sampler->StatFd) > 0)
+	{
+		char* Line;
+		for (Line = strstr(Sampler->Text, "\ncpu"); Line != NULL; Line = strstr(Line + 1, "\ncpu"))
+		{
+			unsigned long long User, Nice, System, Idle, IoWait, Irq, SoftIrq, Steal;
+			int Cpu;
+
+			if (sscanf(Line + 1, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &Cpu, &User, &Nice, &System, &Idle, &IoWait, &Irq, &SoftIrq, &Steal) == 9 &&
+				Cpu >= 0 && Cpu < Sampler->NumCpus)
+			{
+				Cpus[3 * Cpu] = Steal;
+				Cpus[3 * Cpu + 1] = Irq + SoftIrq;
+			}
+		}
+	}
+
+	/* a header of "CPUn" columns (online CPUs only), then a row per source with a count per column */
+	if (SchedSamplerRead(Sampler, Sampler->InterruptsFd) > 0)
+	{
+		int Columns[1024];
+		int NumColumns = 0, IdxColumn, Cpu;
+		char* Cursor = Sampler->Text;
+		char* Row;
+
+		while (NumColumns < 1024 && (Cursor = strstr(Cursor, "CPU")) != NULL && Cursor < strchr(Sampler->Text, '\n'))
+		{
+			Cursor += 3;
+			Cpu = (int)strtol(Cursor, &Cursor, 10);
+			Columns[NumColumns++] = Cpu;
+		}
+		for (IdxColumn = 0; IdxColumn < NumColumns; ++IdxColumn)
+		{
+			if (Columns[IdxColumn] >= 0 && Columns[IdxColumn] < Sampler->NumCpus)
+			{
+				Cpus[3 * Columns[IdxColumn] + 2] = 0;
+			}
+		}
+
+		for (Row = strchr(Sampler->Text, '\n'); Row != NULL; Row = strchr(Row + 1, '\n'))
+		{
+			/* rows like ERR: and MIS: have a single total, not one per CPU */
+			char* Colon = strchr(Row, ':');
+			char* Next = strchr(Row + 1, '\n');
+			char* Label = Row + 1 + strspn(Row + 1, " ");
+			if (Colon == NULL || (Next != NULL && Colon > Next) || strncmp(Label, "ERR:", 4) == 0 || strncmp(Label, "MIS:", 4) == 0)
+			{
+				continue;
+			}
+
+			Cursor = Colon + 1;
+			for (IdxColumn = 0; IdxColumn < NumColumns; ++IdxColumn)
+			{
+				char* End;
+				unsigned long long Count = strtoull(Cursor, &End, 10);
+				if (End == Cursor || (Next != NULL && End > Next))
+				{
+					break;
+				}
+				Cursor = End;
+
+				Cpu = Columns[IdxColumn];
+				if (Cpu >= 0 && Cpu < Sampler->NumCpus)
+				{
+					Cpus[3 * Cpu + 2] += Count;
+				}
+			}
+		}
+	}
+
+	/* "runtime_ns rundelay_ns timeslices", and "voluntary_ctxt_switches:" lines */
+	for (IdxThread = 0; IdxThread < Sampler->NumThreads; ++IdxThread)
+	{
+		unsigned long long RunTimeNs, RunDelayNs;
+
+		if (Sampler->SchedstatFds[IdxThread] >= 0 && SchedSamplerRead(Sampler, Sampler->SchedstatFds[IdxThread]) > 0 &&
+			sscanf(Sampler->Text, "%llu %llu", &RunTimeNs, &RunDelayNs) == 2)
+		{
+			Threads[3 * IdxThread] = RunDelayNs;
+		}
+		if (Sampler->StatusFds[IdxThread] >= 0 && SchedSamplerRead(Sampler, Sampler->StatusFds[IdxThread]) > 0)
+		{
+			Threads[3 * IdxThread + 1] = SchedSamplerField(Sampler->Text, "\nvoluntary_ctxt_switches:");
+			Threads[3 * IdxThread + 2] = SchedSamplerField(Sampler->Text, "\nnonvoluntary_ctxt_switches:");
+		}
+	}
+
+	Sample[0] = GetTimeInNs();
+	++Sampler->NumSamples;
+}
+
+/** Time the newest sample was taken, 0 if none was */
+static inline unsigned long long SchedSamplerLatestNs(const struct SchedSampler* Sampler)
+{
+	if (Sampler->NumSamples == 0)
+	{
+		return 0;
+	}
+	return Sampler->Samples[((Sampler->NumSamples - 1) % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize];
+}
+
+/**
+ * Fills in what happened on Cpu and to thread IdxThread between StartNs and EndNs (BENCH_CLOCK_ID), from the
+ * last sample taken before StartNs to the first one after EndNs. Deltas stay zero if there is no such pair.
+ */
+static inline void SchedSamplerDeltas(const struct SchedSampler* Sampler, int Cpu, int IdxThread, unsigned long long StartNs, unsigned long long EndNs, struct SchedDeltas* Deltas)
+{
+	unsigned long long Oldest = (Sampler->NumSamples > SCHED_SAMPLE_HISTORY) ? Sampler->NumSamples - SCHED_SAMPLE_HISTORY : 0;
+	unsigned long long IdxBefore, IdxAfter;
+	const unsigned long long* Before;
+	const unsigned long long* After;
+
+	memset(Deltas, 0, sizeof(*Deltas));
+	if (Sampler->NumSamples < 2)
+	{
+		return;
+	}
+
+	/* newest first, both are close to the end of the history */
+	for (IdxAfter = Sampler->NumSamples - 1; IdxAfter > Oldest && Sampler->Samples[((IdxAfter - 1) % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize] >= EndNs; --IdxAfter)
+	{
+	}
+	if (Sampler->Samples[(IdxAfter % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize] < EndNs)
+	{
+		return;
+	}
+	for (IdxBefore = IdxAfter; IdxBefore > Oldest && Sampler->Samples[(IdxBefore % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize] > StartNs; --IdxBefore)
+	{
+	}
+	if (IdxBefore == IdxAfter)
+	{
+		return;
+	}
+
+	Before = &Sampler->Samples[(IdxBefore % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize];
+	After = &Sampler->Samples[(IdxAfter % SCHED_SAMPLE_HISTORY) * Sampler->SampleSize];
+	Deltas->WindowNs = After[0] - Before[0];
+
+	if (Cpu >= 0 && Cpu < Sampler->NumCpus)
+	{
+		const unsigned long long* CpuBefore = Before + 1 + 3 * Cpu;
+		const unsigned long long* CpuAfter = After + 1 + 3 * Cpu;
+
+		Deltas->StealNs = (unsigned long long)((double)(CpuAfter[0] - CpuBefore[0]) * Sampler->NsPerTick);
+		Deltas->IrqTimeNs = (unsigned long long)((double)(CpuAfter[1] - CpuBefore[1]) * Sampler->NsPerTick);
+		Deltas->NumInterrupts = CpuAfter[2] - CpuBefore[2];
+	}
+
+	if (IdxThread >= 0 && IdxThread < Sampler->NumThreads)
+	{
+		const unsigned long long* ThreadBefore = Before + 1 + 3 * Sampler->NumCpus + 3 * IdxThread;
+		const unsigned long long* ThreadAfter = After + 1 + 3 * Sampler->NumCpus + 3 * IdxThread;
+
+		Deltas->RunDelayNs = ThreadAfter[0] - ThreadBefore[0];
+		Deltas->NumVoluntarySwitches = (unsigned int)(ThreadAfter[1] - ThreadBefore[1]);
+		Deltas->NumInvoluntarySwitches = (unsigned int)(ThreadAfter[2] - ThreadBefore[2]);
+	}
+}
+
+/**
+ * Most likely cause of a stall of StallNs: whichever of steal, run delay and interrupt time covers the most
+ * of it, if that is at least a quarter. Otherwise blocking in the kernel if the thread switched out voluntarily,
+ * and unattributed if nothing was seen - the VM paused without accounting it as steal, or SMIs.
+ */
+static inline const char* SchedDeltasCause(const struct SchedDeltas* Deltas, unsigned long long StallNs)
+{
+	unsigned long long Largest = Deltas->StealNs;
+	const char* Cause = "Steal";
+
+	if (Deltas->WindowNs == 0)
+	{
+		return "Unsampled";
+	}
+	if (Deltas->RunDelayNs > Largest)
+	{
+		Largest = Deltas->RunDelayNs;
+		Cause = "Preempted";
+	}
+	if (Deltas->IrqTimeNs > Largest)
+	{
+		Largest = Deltas->IrqTimeNs;
+		Cause = "Interrupts";
+	}
+
+	if (Largest * 4 >= StallNs)
+	{
+		return Cause;
+	}
+	return (Deltas->NumVoluntarySwitches > 0) ? "Blocked" : "Unattributed";
+}
+
+/** Formats the deltas and the cause for the tools' gap lines, e.g. ", cause Steal (steal 120000 us, ...)" */
+static inline const char* SchedDeltasFormat(char* Buffer, size_t BufferSize, const struct SchedDeltas* Deltas, unsigned long long StallNs)
+{
+	if (Deltas->WindowNs == 0)
+	{
+		snprintf(Buffer, BufferSize, ", cause unknown (not sampled)");
+		return Buffer;
+	}
+
+	snprintf(Buffer, BufferSize, ", cause %s (steal %llu us, irq %llu us, %llu interrupts, run delay %llu us, %u voluntary and %u involuntary switches within %llu ms)",
+		SchedDeltasCause(Deltas, StallNs),
+		Deltas->StealNs / 1000, Deltas->IrqTimeNs / 1000, Deltas->NumInterrupts, Deltas->RunDelayNs / 1000,
+		Deltas->NumVoluntarySwitches, Deltas->NumInvoluntarySwitches, Deltas->WindowNs / 1000000);
+	return Buffer;
+}
+
+/** Closes the files and frees the history. */
+static inline void SchedSamplerClose(struct SchedSampler* Sampler)
+{
+	int IdxThread;
+
+	for (IdxThread = 0; IdxThread < Sampler->NumThreads; ++IdxThread)
+	{
+		if (Sampler->SchedstatFds[IdxThread] >= 0)
+		{
+			close(Sampler->SchedstatFds[IdxThread]);
+		}
+		if (Sampler->StatusFds[IdxThread] >= 0)
+		{
+			close(Sampler->StatusFds[IdxThread]);
+		}
+	}
+	if (Sampler->StatFd >= 0)
+	{
+		close(Sampler->StatFd);
+	}
+	if (Sampler->InterruptsFd >= 0)
+	{
+		close(Sampler->InterruptsFd);
+	}
+	free(Sampler->Text);
+	free(Sampler->Samples);
+	free(Sampler->Tids);
+	free(Sampler->SchedstatFds);
+	free(Sampler->StatusFds);
+	memset(Sampler, 0, sizeof(*Sampler));
+	Sampler->StatFd = -1;
+	Sampler->InterruptsFd = -1;
+}
+
+#endif /* SCHED_SAMPLE_H */
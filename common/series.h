@@ -0,0 +1,356 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Header-only append-only binary time series. A tool appends one fixed-size SeriesRecord per series per
+ * reporting period: the period's StabilityParams as they are, and its LatencyHistogram folded into coarser
+ * buckets, so records from any range can be merged exactly and percentiles estimated from the merge.
+ * The file is mapped, so appending is a memcpy and a store of the record count; a reader (series-query)
+ * only trusts NumRecords, which is updated after the record is complete. Appending to an existing file
+ * continues it, as long as it was written by the same tool with the same series.
+ */
+
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bench_core.h"
+
+#define SERIES_FILE_MAGIC		"VMBSERIE"
+#define SERIES_FILE_VERSION		1
+
+/** Records start at this offset, the header is padded to it */
+#define SERIES_HEADER_SIZE		4096
+
+#define SERIES_MAX_SERIES		16
+
+/** Histograms are stored with this many sub-buckets per power of two, about 6% wide instead of 0.8% */
+#define SERIES_SUB_BUCKET_BITS	4
+#define SERIES_SUB_BUCKETS		(1 << SERIES_SUB_BUCKET_BITS)
+#define SERIES_NUM_BUCKETS		((64 - SERIES_SUB_BUCKET_BITS + 1) * SERIES_SUB_BUCKETS)
+
+/** The file grows by this many records at a time */
+#define SERIES_GROW_RECORDS		1024
+
+/** What a series measures */
+struct SeriesInfo
+{
+	const char* Name;
+	/** Unit of the StabilityParams values, as printed */
+	const char* Unit;
+	/** Nanoseconds per Unit, histograms are always kept in ns */
+	double UnitNs;
+};
+
+/** Start of the file, padded to SERIES_HEADER_SIZE */
+struct SeriesFileHeader
+{
+	char Magic[8];
+	unsigned int Version;
+	unsigned int RecordSize;
+	unsigned int NumBuckets;
+	unsigned int NumSeries;
+	/** Complete records in the file, anything past them is not written yet */
+	unsigned long long NumRecords;
+	char Tool[32];
+	char Names[SERIES_MAX_SERIES][32];
+	char Units[SERIES_MAX_SERIES][8];
+	double UnitNs[SERIES_MAX_SERIES];
+};
+
+/** One period of one series */
+struct SeriesRecord
+{
+	/** CLOCK_REALTIME at the end of the period */
+	unsigned long long RealTimeNs;
+	unsigned long long PeriodNs;
+	/** Index into the header's series */
+	unsigned int Series;
+	unsigned int Reserved;
+	/** StabilityParams of the period, in the series' unit */
+	double NumObservations;
+	double Mean, Mean2;
+	double Min, Max;
+	/** Histogram of the period in ns, SERIES_SUB_BUCKETS buckets per power of two */
+	unsigned long long Counts[SERIES_NUM_BUCKETS];
+};
+
+struct SeriesWriter
+{
+	int Fd;
+	struct SeriesFileHeader* Header;
+	/** Records needed before the file grows again */
+	unsigned long long Capacity;
+	size_t MapSize;
+};
+
+/** Index of the stored bucket holding Value, same layout as HistogramBucket() with fewer sub-buckets. */
+static inline int SeriesBucket(unsigned long long Value)
+{
+	int Exponent;
+
+	if (Value < SERIES_SUB_BUCKETS)
+	{
+		return (int)Value;
+	}
+
+	Exponent = 63 - __builtin_clzll(Value);
+	return (Exponent - SERIES_SUB_BUCKET_BITS + 1) * SERIES_SUB_BUCKETS + (int)((Value >> (Exponent - SERIES_SUB_BUCKET_BITS)) - SERIES_SUB_BUCKETS);
+}
+
+/** Middle of the range of values that land in the stored bucket. */
+static inline double SeriesBucketValue(int IdxBucket)
+{
+	unsigned long long Width;
+	int Exponent;
+
+	if (IdxBucket < 2 * SERIES_SUB_BUCKETS)
+	{
+		return (double)IdxBucket;
+	}
+
+	Exponent = IdxBucket / SERIES_SUB_BUCKETS + SERIES_SUB_BUCKET_BITS - 1;
+	Width = 1ULL << (Exponent - SERIES_SUB_BUCKET_BITS);
+	return (double)((SERIES_SUB_BUCKETS + IdxBucket % SERIES_SUB_BUCKETS) * Width) + (double)(Width - 1) / 2.0;
+}
+
+/** Folds a histogram into stored buckets. Each fine bucket lies within one stored bucket, so nothing is split. */
+static inline void SeriesFoldHistogram(const struct LatencyHistogram* Histogram, unsigned long long* Counts)
+{
+	int IdxBucket;
+
+	memset(Counts, 0, SERIES_NUM_BUCKETS * sizeof(*Counts));
+	for (IdxBucket = 0; IdxBucket < HISTOGRAM_NUM_BUCKETS; ++IdxBucket)
+	{
+		if (Histogram->Counts[IdxBucket] != 0)
+		{
+			Counts[SeriesBucket((unsigned long long)HistogramBucketValue(IdxBucket))] += Histogram->Counts[IdxBucket];
+		}
+	}
+}
+
+/** Same as HistogramPercentile(), for stored buckets. */
+static inline double SeriesPercentile(const unsigned long long* Counts, double Percentile)
+{
+	unsigned long long Target, Total = 0, Seen = 0;
+	int IdxBucket;
+
+	for (IdxBucket = 0; IdxBucket < SERIES_NUM_BUCKETS; ++IdxBucket)
+	{
+		Total += Counts[IdxBucket];
+	}
+	if (Total == 0)
+	{
+		return 0;
+	}
+
+	Target = (unsigned long long)ceil(Percentile / 100.0 * (double)Total);
+	Target = (Target < 1) ? 1 : Target;
+
+	for (IdxBucket = 0; IdxBucket < SERIES_NUM_BUCKETS - 1; ++IdxBucket)
+	{
+		Seen += Counts[IdxBucket];
+		if (Seen >= Target)
+		{
+			break;
+		}
+	}
+
+	return SeriesBucketValue(IdxBucket);
+}
+
+/** Maps the file with room for Capacity records, growing it if needed. @return 0 or an errno value */
+static inline int SeriesMap(struct SeriesWriter* Writer, unsigned long long Capacity)
+{
+	size_t MapSize = SERIES_HEADER_SIZE + Capacity * sizeof(struct SeriesRecord);
+	void* Map;
+
+	if (ftruncate(Writer->Fd, (off_t)MapSize) != 0)
+	{
+		return errno;
+	}
+
+	Map = mmap(NULL, MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Writer->Fd, 0);
+	if (Map == MAP_FAILED)
+	{
+		return errno;
+	}
+
+	if (Writer->Header != NULL)
+	{
+		munmap(Writer->Header, Writer->MapSize);
+	}
+	Writer->Header = (struct SeriesFileHeader*)Map;
+	Writer->MapSize = MapSize;
+	Writer->Capacity = Capacity;
+	return 0;
+}
+
+/**
+ * Opens the file for appending, creating it if it does not exist.
+ *
+ * @param Tool name of the tool, stored in the file header
+ * @return 0 on success, EINVAL if the file exists but holds other series, otherwise an errno value
+ */
+static inline int SeriesOpen(struct SeriesWriter* Writer, const char* Path, const char* Tool, const struct SeriesInfo* Series, int NumSeries)
+{
+	struct SeriesFileHeader Header;
+	struct stat Stat;
+	int IdxSeries, Result;
+	ssize_t Length;
+
+	memset(Writer, 0, sizeof(*Writer));
+	if (NumSeries > SERIES_MAX_SERIES)
+	{
+		return EINVAL;
+	}
+
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.Magic, SERIES_FILE_MAGIC, sizeof(Header.Magic));
+	Header.Version = SERIES_FILE_VERSION;
+	Header.RecordSize = sizeof(struct SeriesRecord);
+	Header.NumBuckets = SERIES_NUM_BUCKETS;
+	Header.NumSeries = (unsigned int)NumSeries;
+	strncpy(Header.Tool, Tool, sizeof(Header.Tool) - 1);
+	for (IdxSeries = 0; IdxSeries < NumSeries; ++IdxSeries)
+	{
+		strncpy(Header.Names[IdxSeries], Series[IdxSeries].Name, sizeof(Header.Names[IdxSeries]) - 1);
+		strncpy(Header.Units[IdxSeries], Series[IdxSeries].Unit, sizeof(Header.Units[IdxSeries]) - 1);
+		Header.UnitNs[IdxSeries] = Series[IdxSeries].UnitNs;
+	}
+
+	Writer->Fd = open(Path, O_RDWR | O_CREAT, 0644);
+	if (Writer->Fd < 0)
+	{
+		return errno;
+	}
+
+	if (fstat(Writer->Fd, &Stat) != 0)
+	{
+		Result = errno;
+		close(Writer->Fd);
+		return Result;
+	}
+
+	if (Stat.st_size == 0)
+	{
+		Length = pwrite(Writer->Fd, &Header, sizeof(Header), 0);
+		if (Length != (ssize_t)sizeof(Header))
+		{
+			Result = (Length < 0) ? errno : EIO;
+			close(Writer->Fd);
+			return Result;
+		}
+	}
+	else
+	{
+		struct SeriesFileHeader Existing;
+
+		/* the record count is the only part that may differ */
+		Length = pread(Writer->Fd, &Existing, sizeof(Existing), 0);
+		Header.NumRecords = Existing.NumRecords;
+		if (Length != (ssize_t)sizeof(Existing) || memcmp(&Existing, &Header, sizeof(Header)) != 0)
+		{
+			close(Writer->Fd);
+			return EINVAL;
+		}
+	}
+
+	Result = SeriesMap(Writer, (Header.NumRecords / SERIES_GROW_RECORDS + 1) * SERIES_GROW_RECORDS);
+	if (Result != 0)
+	{
+		close(Writer->Fd);
+		return Result;
+	}
+
+	return 0;
+}
+
+/**
+ * Appends a period of a series. Histogram may be NULL for series without one.
+ *
+ * @return 0 on success, otherwise an errno value
+ */
+static inline int SeriesAppend(struct SeriesWriter* Writer, unsigned int Series, unsigned long long PeriodNs,
+	const struct StabilityParams* Params, const struct LatencyHistogram* Histogram)
+{
+	unsigned long long NumRecords = Writer->Header->NumRecords;
+	struct SeriesRecord* Record;
+	int Result;
+
+	if (NumRecords == Writer->Capacity)
+	{
+		Result = SeriesMap(Writer, Writer->Capacity + SERIES_GROW_RECORDS);
+		if (Result != 0)
+		{
+			return Result;
+		}
+	}
+
+	Record = (struct SeriesRecord*)((char*)Writer->Header + SERIES_HEADER_SIZE) + NumRecords;
+	Record->RealTimeNs = GetClockInNs(CLOCK_REALTIME);
+	Record->PeriodNs = PeriodNs;
+	Record->Series = Series;
+	Record->Reserved = 0;
+	Record->NumObservations = Params->NumObservations;
+	Record->Mean = Params->Mean;
+	Record->Mean2 = Params->Mean2;
+	Record->Min = Params->Min;
+	Record->Max = Params->Max;
+	if (Histogram != NULL)
+	{
+		SeriesFoldHistogram(Histogram, Record->Counts);
+	}
+	else
+	{
+		memset(Record->Counts, 0, sizeof(Record->Counts));
+	}
+
+	/* readers only look at records below NumRecords */
+	__atomic_store_n(&Writer->Header->NumRecords, NumRecords + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Cuts the file down to the records written and closes it. */
+static inline void SeriesClose(struct SeriesWriter* Writer)
+{
+	off_t Size = SERIES_HEADER_SIZE + (off_t)(Writer->Header->NumRecords * sizeof(struct SeriesRecord));
+
+	munmap(Writer->Header, Writer->MapSize);
+	if (ftruncate(Writer->Fd, Size) != 0)
+	{
+		perror("Cannot truncate series file");
+	}
+	close(Writer->Fd);
+	Writer->Header = NULL;
+}
+
+#endif /* SERIES_H */
@@ -0,0 +1,377 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Header-only latency tracer. Each detecting thread owns a preallocated single-producer single-consumer ring of
+ * fixed-size binary events, and a background drainer thread writes them to a file (and optionally prints them),
+ * so a detection loop only ever pays for a few clock reads and stores - it never blocks on stdio or the disk.
+ * The drainer also samples steal, interrupts and scheduling (sched_sample.h) each pass, and attaches what
+ * changed over each stall to its event before writing it out.
+ * The file is a TraceFileHeader followed by TraceEvent records, trace-dump prints it.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "bench_core.h"
+#include "sched_sample.h"
+
+#define TRACE_FILE_MAGIC		"VMBTRACE"
+#define TRACE_FILE_VERSION		2
+
+/** Events each ring can hold before the detecting thread starts dropping them */
+#define TRACE_RING_CAPACITY		4096
+
+/** How often the drainer empties the rings */
+#define TRACE_DRAIN_INTERVAL_NS	50000000ULL
+
+enum TraceEventType
+{
+	/** Two consecutive clock readings too far apart: Value is the gap, Expected the threshold, Arg the reading before the gap */
+	TraceEvent_ClockGap = 1,
+	/** Sleep took too long: Value is how long it took, Expected what was asked for */
+	TraceEvent_SleepOvershoot,
+	/** Sleep failed: Value is the error code */
+	TraceEvent_SleepFailed,
+	/** Clock read on this CPU is behind one published earlier by another CPU: Value is by how much, Arg the other CPU */
+	TraceEvent_ClockBackwards,
+};
+
+/** Name of the event type. */
+static inline const char* TraceEventTypeName(unsigned int Type)
+{
+	switch (Type)
+	{
+		case TraceEvent_ClockGap:		return "ClockGap";
+		case TraceEvent_SleepOvershoot:	return "SleepOvershoot";
+		case TraceEvent_SleepFailed:	return "SleepFailed";
+		case TraceEvent_ClockBackwards:	return "ClockBackwards";
+		default:						return "Unknown";
+	}
+}
+
+/** One event, as stored in the ring and the file */
+struct TraceEvent
+{
+	/** BENCH_CLOCK_ID when the event was recorded */
+	unsigned long long TimeNs;
+	/** CLOCK_REALTIME at the same moment, to line events up with logs from the host or other guests */
+	unsigned long long RealTimeNs;
+	unsigned long long Value;
+	unsigned long long Expected;
+	/** Events recorded or dropped on the ring before this one, gaps mean dropped events */
+	unsigned long long Sequence;
+	/** Event specific */
+	unsigned long long Arg;
+	unsigned short Type;
+	unsigned short Ring;
+	int Cpu;
+	unsigned int Pid;
+	unsigned int Reserved;
+	/** Filled in by the drainer for stalls (gaps and overshoots), zero for other events. Version 2 */
+	struct SchedDeltas Sched;
+};
+
+/** Start of the trace file */
+struct TraceFileHeader
+{
+	char Magic[8];
+	unsigned int Version;
+	unsigned int EventSize;
+	/** BENCH_CLOCK_ID and CLOCK_REALTIME when tracing started */
+	unsigned long long StartNs;
+	unsigned long long StartRealTimeNs;
+	char Tool[32];
+};
+
+/** Ring written by one thread and read by the drainer. Head and Tail are on their own cache lines so they do not bounce together. */
+struct TraceRing
+{
+	/** Next sequence number to write, only the producer stores it */
+	unsigned long long Head BENCH_CACHE_ALIGNED;
+	/** Events the producer could not fit, only the producer stores it */
+	unsigned long long NumDropped;
+	/** Thread recording into the ring, set once by TracerRegisterThread() so its scheduling can be sampled */
+	int Tid;
+
+	/** Next sequence number to read, only the drainer stores it */
+	unsigned long long Tail BENCH_CACHE_ALIGNED;
+	/** Drops already reported by the drainer */
+	unsigned long long NumDroppedReported;
+
+	struct TraceEvent Events[TRACE_RING_CAPACITY] BENCH_CACHE_ALIGNED;
+};
+
+struct Tracer
+{
+	FILE* File;
+	struct TraceRing* Rings;
+	int NumRings;
+	/** Called by the drainer for each event, e.g. to print it the way the tool always has - NULL not to */
+	void (*PrintEvent)(const struct TraceEvent* Event);
+	/** Called by the drainer after each pass over the rings, for tools that look at events together - NULL not to */
+	void (*AfterDrain)(void);
+
+	/** Only used by the drainer. Initialized is 0 if /proc could not be read, events are then left unsampled */
+	struct SchedSampler Sampler;
+	int SamplerInitialized;
+
+	pthread_t Drainer;
+	int Stop;
+};
+
+/** Lets the drainer sample the scheduling of the thread recording into Ring. Call once, from that thread. */
+static inline void TracerRegisterThread(struct Tracer* Tracer, int Ring)
+{
+	__atomic_store_n(&Tracer->Rings[Ring].Tid, (int)syscall(SYS_gettid), __ATOMIC_RELEASE);
+}
+
+/**
+ * Time a stall event covers on BENCH_CLOCK_ID.
+ *
+ * @return 1 for stalls, 0 for other events
+ */
+static inline int TraceEventStall(const struct TraceEvent* Event, unsigned long long* StartNs, unsigned long long* EndNs)
+{
+	switch (Event->Type)
+	{
+		case TraceEvent_ClockGap:
+			*StartNs = Event->Arg;
+			*EndNs = Event->Arg + Event->Value;
+			return 1;
+		case TraceEvent_SleepOvershoot:
+			*StartNs = Event->TimeNs - Event->Value;
+			*EndNs = Event->TimeNs;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Records an event into the ring, never blocks. Must only be called by the thread owning the ring.
+ *
+ * @return 0, or -1 if the ring was full and the event was dropped
+ */
+static inline int TraceRecord(struct Tracer* Tracer, int Ring, unsigned int Type, unsigned long long Value, unsigned long long Expected, unsigned long long Arg)
+{
+	struct TraceRing* TraceRing = &Tracer->Rings[Ring];
+	unsigned long long Head = TraceRing->Head;
+	struct TraceEvent* Event;
+	unsigned int Cpu = 0;
+
+	if (Head - __atomic_load_n(&TraceRing->Tail, __ATOMIC_ACQUIRE) >= TRACE_RING_CAPACITY)
+	{
+		__atomic_store_n(&TraceRing->NumDropped, TraceRing->NumDropped + 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	Event = &TraceRing->Events[Head % TRACE_RING_CAPACITY];
+	Event->TimeNs = GetTimeInNs();
+	Event->RealTimeNs = GetClockInNs(CLOCK_REALTIME);
+	Event->Value = Value;
+	Event->Expected = Expected;
+	Event->Sequence = Head + TraceRing->NumDropped;
+	Event->Arg = Arg;
+	Event->Type = (unsigned short)Type;
+	Event->Ring = (unsigned short)Ring;
+	Event->Cpu = (syscall(SYS_getcpu, &Cpu, NULL, NULL) == 0) ? (int)Cpu : -1;
+	Event->Pid = (unsigned int)getpid();
+	Event->Reserved = 0;
+
+	__atomic_store_n(&TraceRing->Head, Head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Writes out everything the rings hold. Only the drainer (or the thread stopping it) may call this. */
+static inline void TracerDrain(struct Tracer* Tracer)
+{
+	unsigned long long SampledNs = 0;
+	int IdxRing;
+
+	/* a stall needs a sample from after it, events newer than this one wait for the next pass */
+	if (Tracer->SamplerInitialized)
+	{
+		for (IdxRing = 0; IdxRing < Tracer->NumRings; ++IdxRing)
+		{
+			int Tid = __atomic_load_n(&Tracer->Rings[IdxRing].Tid, __ATOMIC_ACQUIRE);
+			if (Tid != 0)
+			{
+				SchedSamplerWatch(&Tracer->Sampler, IdxRing, Tid);
+			}
+		}
+		SchedSamplerTake(&Tracer->Sampler);
+		SampledNs = SchedSamplerLatestNs(&Tracer->Sampler);
+	}
+
+	for (IdxRing = 0; IdxRing < Tracer->NumRings; ++IdxRing)
+	{
+		struct TraceRing* TraceRing = &Tracer->Rings[IdxRing];
+		unsigned long long Tail = TraceRing->Tail, Head = __atomic_load_n(&TraceRing->Head, __ATOMIC_ACQUIRE);
+		unsigned long long NumDropped = __atomic_load_n(&TraceRing->NumDropped, __ATOMIC_RELAXED);
+
+		for (; Tail != Head; ++Tail)
+		{
+			struct TraceEvent* Event = &TraceRing->Events[Tail % TRACE_RING_CAPACITY];
+			unsigned long long StartNs, EndNs;
+
+			if (Tracer->SamplerInitialized && TraceEventStall(Event, &StartNs, &EndNs))
+			{
+				if (Event->TimeNs > SampledNs)
+				{
+					break;
+				}
+				SchedSamplerDeltas(&Tracer->Sampler, Event->Cpu, IdxRing, StartNs, EndNs, &Event->Sched);
+			}
+
+			fwrite(Event, sizeof(*Event), 1, Tracer->File);
+			if (Tracer->PrintEvent != NULL)
+			{
+				Tracer->PrintEvent(Event);
+			}
+		}
+		__atomic_store_n(&TraceRing->Tail, Tail, __ATOMIC_RELEASE);
+
+		if (NumDropped != TraceRing->NumDroppedReported)
+		{
+			printf("pid %d: trace ring %d dropped %llu events\n", getpid(), IdxRing, NumDropped - TraceRing->NumDroppedReported);
+			TraceRing->NumDroppedReported = NumDropped;
+		}
+	}
+
+	if (Tracer->AfterDrain != NULL)
+	{
+		Tracer->AfterDrain();
+	}
+
+	fflush(Tracer->File);
+	fflush(stdout);
+}
+
+static inline void* TracerDrainerThread(void* Arg)
+{
+	struct Tracer* Tracer = (struct Tracer*)Arg;
+
+	while (!__atomic_load_n(&Tracer->Stop, __ATOMIC_ACQUIRE))
+	{
+		TracerDrain(Tracer);
+		SleepNs(TRACE_DRAIN_INTERVAL_NS);
+	}
+
+	return NULL;
+}
+
+/**
+ * Opens the trace file, allocates a ring per detecting thread and starts the drainer.
+ *
+ * @param Tool name of the tool, stored in the file header
+ * @param PrintEvent called by the drainer for each event, or NULL
+ * @param AfterDrain called by the drainer after each pass, or NULL
+ * @return 0 on success, otherwise an errno value
+ */
+static inline int TracerStart(struct Tracer* Tracer, const char* Path, const char* Tool, int NumRings,
+	void (*PrintEvent)(const struct TraceEvent* Event), void (*AfterDrain)(void))
+{
+	struct TraceFileHeader Header;
+	void* Rings = NULL;
+	int Result;
+
+	memset(Tracer, 0, sizeof(*Tracer));
+
+	Tracer->File = fopen(Path, "wb");
+	if (Tracer->File == NULL)
+	{
+		return errno;
+	}
+
+	Result = posix_memalign(&Rings, BENCH_CACHE_LINE_SIZE, NumRings * sizeof(struct TraceRing));
+	if (Result != 0)
+	{
+		fclose(Tracer->File);
+		return Result;
+	}
+	/* touch the rings now so recording an event never page faults */
+	memset(Rings, 0, NumRings * sizeof(struct TraceRing));
+	Tracer->Rings = (struct TraceRing*)Rings;
+	Tracer->NumRings = NumRings;
+	Tracer->PrintEvent = PrintEvent;
+	Tracer->AfterDrain = AfterDrain;
+
+	/* tracing goes on without attribution if /proc cannot be read */
+	Result = SchedSamplerInit(&Tracer->Sampler, NumRings);
+	if (Result == 0)
+	{
+		Tracer->SamplerInitialized = 1;
+		SchedSamplerTake(&Tracer->Sampler);
+	}
+	else
+	{
+		fprintf(stderr, "Cannot sample scheduling for stalls, error %d (%s)\n", Result, strerror(Result));
+		SchedSamplerClose(&Tracer->Sampler);
+	}
+
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.Magic, TRACE_FILE_MAGIC, sizeof(Header.Magic));
+	Header.Version = TRACE_FILE_VERSION;
+	Header.EventSize = sizeof(struct TraceEvent);
+	Header.StartNs = GetTimeInNs();
+	Header.StartRealTimeNs = GetClockInNs(CLOCK_REALTIME);
+	strncpy(Header.Tool, Tool, sizeof(Header.Tool) - 1);
+	fwrite(&Header, sizeof(Header), 1, Tracer->File);
+	fflush(Tracer->File);
+
+	Result = pthread_create(&Tracer->Drainer, NULL, TracerDrainerThread, Tracer);
+	if (Result != 0)
+	{
+		SchedSamplerClose(&Tracer->Sampler);
+		free(Tracer->Rings);
+		fclose(Tracer->File);
+		return Result;
+	}
+
+	return 0;
+}
+
+/** Stops the drainer, writes out whatever is left and closes the file. */
+static inline void TracerStop(struct Tracer* Tracer)
+{
+	__atomic_store_n(&Tracer->Stop, 1, __ATOMIC_RELEASE);
+	pthread_join(Tracer->Drainer, NULL);
+
+	TracerDrain(Tracer);
+	fclose(Tracer->File);
+	free(Tracer->Rings);
+	Tracer->Rings = NULL;
+	SchedSamplerClose(&Tracer->Sampler);
+	Tracer->SamplerInitialized = 0;
+}
+
+#endif /* TRACE_H */
@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -34,8 +35,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
+#include "bench_core.h"
+#include "ds_protocol.h"
+#include "workload.h"
+#include "runtime_config.h"
 
 /** Server frame rate, Hz. We are trying to maintain it. */
 #define SERVER_FPS          30ULL
@@ -43,227 +51,971 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /** Budget for a single frame in nanoseconds, given target FPS */
 #define SERVER_FRAME_DURATION_NS        (1000000000ULL / SERVER_FPS)
 
-/** Size of the working set - arbitrary, timed to make sure we can keep up given Hz */
-#define WORKSET_SIZE_SQRT   256UL
+/** Kernels run each frame unless given with -w */
+#define DEFAULT_WORKLOAD_MIX    "strided,chase,simd,branchy"
 
-/** Total size of a workset element - allows to spread out it across the memory */
-#define WORKSET_ELEMENT_SIZE	256UL
+/** Share of the frame budget spent working unless given with -f */
+#define DEFAULT_WORK_FRACTION   0.5
 
+/** A frame that ends later than this after its deadline counts as late */
+#define LATE_FRAME_THRESHOLD_NS     1000000ULL
 
-/* Clock ID to use */
-clockid_t ClockSource = CLOCK_MONOTONIC_RAW;
+/** How often the scheduling stats are printed */
+#define SCHEDULE_REPORT_INTERVAL_NS (30ULL * 1000000000ULL)
 
-/* Memory that is used to imitate useful work */
-char* WorkSet = NULL;
+/** How instances are run */
+enum InstanceMode
+{
+    /** A thread per instance, sleeping between frames */
+    InstanceMode_Threads,
+    /** Instances multiplexed on a timerfd/epoll loop per CPU */
+    InstanceMode_Loop,
+};
 
-/** Gets current time in ns */
-unsigned long long GetTimeInNs()
+/** How an instance kept to its schedule. Written by the instance's thread, read by the reporter */
+struct ScheduleStats
 {
-    struct timespec TimeSpec;
-    
-    if (clock_gettime(ClockSource, &TimeSpec) == -1)
+    unsigned long long NumFrames;
+    /** Frames that ended more than LATE_FRAME_THRESHOLD_NS after their deadline */
+    unsigned long long NumLate;
+    /** Late frames followed by a shorter one to get back on schedule */
+    unsigned long long NumCatchUp;
+    /** Frames dropped because the instance fell a whole frame or more behind */
+    unsigned long long NumSkipped;
+    unsigned long long MaxLateNs;
+    /** Time spent in the kernels, which is where page size and NUMA placement show */
+    unsigned long long SumWorkNs;
+    unsigned long long MaxWorkNs;
+};
+
+/** Round trips to the server, measured on echoed messages. Written by the instance's thread, read by the reporter */
+struct EchoStats
+{
+    unsigned long long NumRequested;
+    unsigned long long NumEchoes;
+    unsigned long long SumRttNs;
+    unsigned long long MaxRttNs;
+};
+
+/** One simulated server, with its own id, frame timing, message stream and working sets */
+struct Instance
+{
+    struct Message Msg;
+    unsigned long long BeginFrameNs;
+    /**
+     * When the current frame ends and its message is due, on BENCH_SLEEP_CLOCK_ID. Deadlines are a fixed
+     * grid a frame apart, so oversleeping one frame shortens the next one instead of slowing the tick rate.
+     */
+    unsigned long long DeadlineNs;
+    /** Whether a frame has begun - the event loop starts instances staggered */
+    int Started;
+    struct ScheduleStats Stats;
+    struct EchoStats Echoes;
+    int Socket;
+    pthread_t Thread;
+    struct Workload Works[WORKLOAD_MAX_KERNELS];
+};
+
+/** Instances sharing one thread and socket */
+struct EventLoop
+{
+    /** CPU to pin to, -1 to leave it to the scheduler */
+    int Cpu;
+    int Socket;
+    /** Min-heap on DeadlineNs, the instance due next is first */
+    struct Instance** Heap;
+    int NumInstances;
+    pthread_t Thread;
+};
+
+/* Kernels that imitate useful work, calibrated once and copied into every instance */
+struct Workload Works[WORKLOAD_MAX_KERNELS];
+int NumWorks = 0;
+
+struct sockaddr_in ServerAddr;
+
+/** Timer slack, scheduling policy and memory settings, applied by main() and each instance or loop thread */
+struct RuntimeConfig Runtime;
+
+/** Sleeping ends this long before a deadline, the rest is spun through - 0 to only sleep */
+unsigned long long SpinNs = 0;
+
+/** Every EchoInterval-th message asks the server for an echo, 0 to not ask */
+unsigned long long EchoInterval = 0;
+
+/** Instance i sends as BaseUniqueId + i, which is how echoes find their way back to it */
+struct Instance* Instances = NULL;
+int NumInstances = 1;
+unsigned long long BaseUniqueId = 0;
+
+/** Spends "working": runs each kernel for the number of steps it was calibrated (or told) to take per frame. */
+void SpendTimeWorking(struct Instance* Instance)
+{
+    int IdxWork;
+
+    for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
+    {
+        WorkloadRun(&Instance->Works[IdxWork], Instance->Works[IdxWork].StepsPerFrame);
+    }
+}
+
+/** Sleep no less than TimeToSleepNs nanoseconds, exits on failure */
+void Sleep(unsigned long long TimeToSleepNs)
+{
+    int SleepResult = SleepNs(TimeToSleepNs);
+    if (SleepResult != 0)
     {
-        fprintf(stderr, "Cannot use clock source %d\n", ClockSource);
+        fprintf(stderr, "clock_nanosleep() failed: SleepResult = %d\n", SleepResult);
         exit(1);
-        return 0;
-    };
+    }
+}
 
-    return (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+/** Spins until BENCH_SLEEP_CLOCK_ID reaches DeadlineNs. */
+void SpinUntil(unsigned long long DeadlineNs)
+{
+    while (GetClockInNs(BENCH_SLEEP_CLOCK_ID) < DeadlineNs)
+    {
+    }
 }
 
-#define TUNING 0
+/** Waits until DeadlineNs on BENCH_SLEEP_CLOCK_ID, sleeping and then spinning for the last SpinNs. Exits on failure */
+void WaitUntil(unsigned long long DeadlineNs)
+{
+    int SleepResult = SleepUntilNs(DeadlineNs - SpinNs);
+    if (SleepResult != 0)
+    {
+        fprintf(stderr, "clock_nanosleep() failed: SleepResult = %d\n", SleepResult);
+        exit(1);
+    }
 
-/** Spends "working", fixed cost. Nanoseconds budget is only used when tuning the work for a specific machine. */
-void SpendTimeWorking(unsigned long long Nanoseconds)
+    SpinUntil(DeadlineNs);
+}
+
+/** Creates a UDP socket to send with, exits on failure. Echoes are received on it too, stamped by the kernel on arrival */
+int CreateSocket(void)
 {
-#if TUNING
-    unsigned long long StartNs = GetTimeInNs(), CurrentNs, DiffNs;
-    int TimesRun = 0;
-#endif // TUNING
-    int WorkSetElementIdx = 0;
+    int Opt = 1;
+    int Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Socket < 0) 
+    {
+        perror("Cannot create UDP socket");
+        exit(1);
+    }
+
+    if (EchoInterval > 0 && setsockopt(Socket, SOL_SOCKET, SO_TIMESTAMPNS, &Opt, sizeof(Opt)) < 0)
+    {
+        perror("Cannot set SO_TIMESTAMPNS");
+        exit(1);
+    }
+
+    return Socket;
+}
+
+/** Starts a frame and does its work, the rest of the frame until the deadline is waited through. */
+void BeginFrame(struct Instance* Instance)
+{
+    Instance->BeginFrameNs = GetTimeInNs();
+    Instance->Started = 1;
+    SpendTimeWorking(Instance);
+    Instance->Msg.WorkTimeNs = GetTimeInNs() - Instance->BeginFrameNs;
+}
+
+/** Ends a frame: reports how long it actually took. Exits on failure. */
+void EndFrame(struct Instance* Instance, int Socket)
+{
+    int WantEcho = EchoInterval > 0 && Instance->Msg.FrameNumber % EchoInterval == 0;
+
+    Instance->Msg.Header.Flags = WantEcho ? MessageFlag_EchoRequest : 0;
+    Instance->Msg.SendTimeNs = GetTimeInNs();
+    Instance->Msg.SendRealTimeNs = GetClockInNs(CLOCK_REALTIME);
+    Instance->Msg.FrameTimeNs = Instance->Msg.SendTimeNs - Instance->BeginFrameNs;
+
+    if (sendto(Socket, &Instance->Msg, sizeof(Instance->Msg), 0, (struct sockaddr *)&ServerAddr, sizeof(ServerAddr)) == -1)
+    {
+        perror("sendto failed");
+        exit(1);
+    }
 
-    for(;;)
+    if (WantEcho)
     {
-#if TUNING
-        CurrentNs = GetTimeInNs();
+        __atomic_store_n(&Instance->Echoes.NumRequested, Instance->Echoes.NumRequested + 1, __ATOMIC_RELAXED);
+    }
+    ++Instance->Msg.FrameNumber;
+}
 
-        DiffNs = CurrentNs - StartNs;
-        if (DiffNs >= Nanoseconds)
+/**
+ * Reads the echoes waiting on Socket without blocking, and accounts their round trip to the instance that sent them.
+ * The kernel's arrival stamp is used rather than the time we get to read them, which can be a frame later.
+ */
+void ReceiveEchoes(int Socket)
+{
+    struct Message Buffer, Echo;
+    char Control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec Vec;
+    struct msghdr Header;
+    struct cmsghdr* ControlMsg;
+    struct timespec ArrivalTime;
+    unsigned long long ArrivalNs, RealNowNs, RttNs;
+    ssize_t Length;
+
+    for (;;)
+    {
+        Vec.iov_base = &Buffer;
+        Vec.iov_len = sizeof(Buffer);
+        memset(&Header, 0, sizeof(Header));
+        Header.msg_iov = &Vec;
+        Header.msg_iovlen = 1;
+        Header.msg_control = Control;
+        Header.msg_controllen = sizeof(Control);
+
+        Length = recvmsg(Socket, &Header, MSG_DONTWAIT);
+        if (Length < 0)
         {
-            printf("TimesRun = %d\n", TimesRun);
             break;
         }
-#endif // TUNING
 
-        /* Imitate useful work, memory bound. Low count initially since it grows non-linearly with the machines */
-#if !TUNING
-        for (int Count = 0; Count < 2; ++Count)
-#else
-	++TimesRun;
-#endif
+        if (DecodeMessage(&Buffer, (size_t)Length, &Echo) != 0 || (Echo.Header.Flags & MessageFlag_Echo) == 0 ||
+            Echo.UniqueId - BaseUniqueId >= (unsigned long long)NumInstances)
         {
-            for (int IdxColumn = 0; IdxColumn < WORKSET_SIZE_SQRT; ++IdxColumn)
+            continue;
+        }
+
+        /* arrival on CLOCK_REALTIME, moved to our clock so it can be compared to SendTimeNs */
+        ArrivalNs = GetTimeInNs();
+        RealNowNs = GetClockInNs(CLOCK_REALTIME);
+        for (ControlMsg = CMSG_FIRSTHDR(&Header); ControlMsg != NULL; ControlMsg = CMSG_NXTHDR(&Header, ControlMsg))
+        {
+            if (ControlMsg->cmsg_level == SOL_SOCKET && ControlMsg->cmsg_type == SCM_TIMESTAMPNS)
             {
-                for (int IdxRow = 0; IdxRow < WORKSET_SIZE_SQRT; ++IdxRow)
+                memcpy(&ArrivalTime, CMSG_DATA(ControlMsg), sizeof(ArrivalTime));
+                if (RealNowNs > TimespecToNs(&ArrivalTime))
                 {
-                    WorkSet[(IdxRow * WORKSET_SIZE_SQRT + IdxColumn) * WORKSET_ELEMENT_SIZE + WorkSetElementIdx] 
-                        = WorkSet[(IdxColumn * WORKSET_SIZE_SQRT + IdxRow) * WORKSET_ELEMENT_SIZE + WorkSetElementIdx];
-                    WorkSetElementIdx = (WorkSetElementIdx + 1) % WORKSET_ELEMENT_SIZE;
+                    ArrivalNs -= RealNowNs - TimespecToNs(&ArrivalTime);
                 }
             }
         }
-#if !TUNING
-        break;
-#endif // !TUNING
+
+        if (ArrivalNs > Echo.SendTimeNs + Echo.ServerHoldNs)
+        {
+            struct EchoStats* Stats = &Instances[Echo.UniqueId - BaseUniqueId].Echoes;
+
+            RttNs = ArrivalNs - Echo.SendTimeNs - Echo.ServerHoldNs;
+            __atomic_store_n(&Stats->NumEchoes, Stats->NumEchoes + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&Stats->SumRttNs, Stats->SumRttNs + RttNs, __ATOMIC_RELAXED);
+            if (RttNs > Stats->MaxRttNs)
+            {
+                __atomic_store_n(&Stats->MaxRttNs, RttNs, __ATOMIC_RELAXED);
+            }
+        }
     }
 }
 
-/** Sleep no less than TimeToSleepNs nanoseconds, properly accounting for signals */
-void Sleep(unsigned long long TimeToSleepNs)
+/**
+ * Moves the deadline to the end of the next frame. A frame that ended late is followed by a shorter one
+ * (catch-up) to stay on the grid; when a whole frame or more was lost, the missed frames are skipped,
+ * as a production tick loop would rather than running several frames back to back.
+ */
+void ScheduleNextFrame(struct Instance* Instance)
 {
-    struct timespec TimeSpec, TimeSpecRemain;
-    int SleepResult;
+    struct ScheduleStats* Stats = &Instance->Stats;
+    unsigned long long Now = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+    unsigned long long LateNs = (Now > Instance->DeadlineNs) ? Now - Instance->DeadlineNs : 0;
 
-    TimeSpec.tv_sec = 0;
-    TimeSpec.tv_nsec = TimeToSleepNs;
+    __atomic_store_n(&Stats->NumFrames, Stats->NumFrames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&Stats->SumWorkNs, Stats->SumWorkNs + Instance->Msg.WorkTimeNs, __ATOMIC_RELAXED);
+    if (Instance->Msg.WorkTimeNs > Stats->MaxWorkNs)
+    {
+        __atomic_store_n(&Stats->MaxWorkNs, Instance->Msg.WorkTimeNs, __ATOMIC_RELAXED);
+    }
+    if (LateNs > LATE_FRAME_THRESHOLD_NS)
+    {
+        __atomic_store_n(&Stats->NumLate, Stats->NumLate + 1, __ATOMIC_RELAXED);
+        if (LateNs > Stats->MaxLateNs)
+        {
+            __atomic_store_n(&Stats->MaxLateNs, LateNs, __ATOMIC_RELAXED);
+        }
+
+        if (LateNs >= SERVER_FRAME_DURATION_NS)
+        {
+            unsigned long long NumMissed = LateNs / SERVER_FRAME_DURATION_NS;
+            __atomic_store_n(&Stats->NumSkipped, Stats->NumSkipped + NumMissed, __ATOMIC_RELAXED);
+            Instance->DeadlineNs += NumMissed * SERVER_FRAME_DURATION_NS;
+        }
+        else
+        {
+            __atomic_store_n(&Stats->NumCatchUp, Stats->NumCatchUp + 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    Instance->DeadlineNs += SERVER_FRAME_DURATION_NS;
+}
+
+/** Sums up the scheduling stats of all instances. */
+void SumScheduleStats(const struct Instance* Instances, int NumInstances, struct ScheduleStats* Total)
+{
+    int IdxInstance;
+
+    memset(Total, 0, sizeof(*Total));
+    for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+    {
+        const struct ScheduleStats* Stats = &Instances[IdxInstance].Stats;
+        unsigned long long MaxLateNs = __atomic_load_n(&Stats->MaxLateNs, __ATOMIC_RELAXED);
+        unsigned long long MaxWorkNs = __atomic_load_n(&Stats->MaxWorkNs, __ATOMIC_RELAXED);
+
+        Total->NumFrames += __atomic_load_n(&Stats->NumFrames, __ATOMIC_RELAXED);
+        Total->NumLate += __atomic_load_n(&Stats->NumLate, __ATOMIC_RELAXED);
+        Total->NumCatchUp += __atomic_load_n(&Stats->NumCatchUp, __ATOMIC_RELAXED);
+        Total->NumSkipped += __atomic_load_n(&Stats->NumSkipped, __ATOMIC_RELAXED);
+        Total->MaxLateNs = (MaxLateNs > Total->MaxLateNs) ? MaxLateNs : Total->MaxLateNs;
+        Total->SumWorkNs += __atomic_load_n(&Stats->SumWorkNs, __ATOMIC_RELAXED);
+        Total->MaxWorkNs = (MaxWorkNs > Total->MaxWorkNs) ? MaxWorkNs : Total->MaxWorkNs;
+    }
+}
+
+/** Sums up the round trip stats of all instances. */
+void SumEchoStats(const struct Instance* Instances, int NumInstances, struct EchoStats* Total)
+{
+    int IdxInstance;
+
+    memset(Total, 0, sizeof(*Total));
+    for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+    {
+        const struct EchoStats* Stats = &Instances[IdxInstance].Echoes;
+        unsigned long long MaxRttNs = __atomic_load_n(&Stats->MaxRttNs, __ATOMIC_RELAXED);
+
+        Total->NumRequested += __atomic_load_n(&Stats->NumRequested, __ATOMIC_RELAXED);
+        Total->NumEchoes += __atomic_load_n(&Stats->NumEchoes, __ATOMIC_RELAXED);
+        Total->SumRttNs += __atomic_load_n(&Stats->SumRttNs, __ATOMIC_RELAXED);
+        Total->MaxRttNs = (MaxRttNs > Total->MaxRttNs) ? MaxRttNs : Total->MaxRttNs;
+    }
+}
+
+/** Prints how well the instances kept to their schedule (and the round trips, if measured), all time and since the last report. Never returns. */
+void ReportSchedule(const struct Instance* Instances, int NumInstances)
+{
+    struct ScheduleStats Total, Previous;
+    struct EchoStats EchoTotal, EchoPrevious;
+    struct rusage Usage, PreviousUsage;
+
+    memset(&Previous, 0, sizeof(Previous));
+    memset(&EchoPrevious, 0, sizeof(EchoPrevious));
+    getrusage(RUSAGE_SELF, &PreviousUsage);
+    for (;;)
+    {
+        Sleep(SCHEDULE_REPORT_INTERVAL_NS);
+
+        /* page faults after setup are what -M and -F are meant to get rid of */
+        SumScheduleStats(Instances, NumInstances, &Total);
+        getrusage(RUSAGE_SELF, &Usage);
+        printf("Schedule, Frames, %llu, Late, %llu, CatchUp, %llu, Skipped, %llu, MaxLate(ms), %.3f, MeanWork(ms), %.3f, MaxWork(ms), %.3f, "
+            "Current, Frames, %llu, Late, %llu, CatchUp, %llu, Skipped, %llu, MeanWork(ms), %.3f, MinorFaults, %ld, MajorFaults, %ld, %s",
+            Total.NumFrames, Total.NumLate, Total.NumCatchUp, Total.NumSkipped, (double)Total.MaxLateNs / 1e6,
+            Total.NumFrames ? (double)Total.SumWorkNs / (double)Total.NumFrames / 1e6 : 0.0, (double)Total.MaxWorkNs / 1e6,
+            Total.NumFrames - Previous.NumFrames, Total.NumLate - Previous.NumLate,
+            Total.NumCatchUp - Previous.NumCatchUp, Total.NumSkipped - Previous.NumSkipped,
+            (Total.NumFrames > Previous.NumFrames) ? (double)(Total.SumWorkNs - Previous.SumWorkNs) / (double)(Total.NumFrames - Previous.NumFrames) / 1e6 : 0.0,
+            Usage.ru_minflt - PreviousUsage.ru_minflt, Usage.ru_majflt - PreviousUsage.ru_majflt,
+            UtcTimeString());
+        PreviousUsage = Usage;
+
+        if (EchoInterval > 0)
+        {
+            unsigned long long NumCurrent;
+
+            /* echoes still in flight show up as missing until the next report */
+            SumEchoStats(Instances, NumInstances, &EchoTotal);
+            NumCurrent = EchoTotal.NumEchoes - EchoPrevious.NumEchoes;
+            printf("Rtt, Requested, %llu, Echoes, %llu, Mean(us), %.3f, Max(us), %.3f, Current, Requested, %llu, Echoes, %llu, Mean(us), %.3f, %s",
+                EchoTotal.NumRequested, EchoTotal.NumEchoes,
+                EchoTotal.NumEchoes ? (double)EchoTotal.SumRttNs / (double)EchoTotal.NumEchoes / 1e3 : 0.0, (double)EchoTotal.MaxRttNs / 1e3,
+                EchoTotal.NumRequested - EchoPrevious.NumRequested, NumCurrent,
+                NumCurrent ? (double)(EchoTotal.SumRttNs - EchoPrevious.SumRttNs) / (double)NumCurrent / 1e3 : 0.0,
+                UtcTimeString());
+            EchoPrevious = EchoTotal;
+        }
+        fflush(stdout);
+        Previous = Total;
+    }
+}
+
+/** Runs one instance on its own thread. */
+void* InstanceThread(void* Arg)
+{
+    struct Instance* Instance = (struct Instance*)Arg;
+    const char* Failed = "";
+    int Result;
+
+    Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot apply %s on instance thread: %s\n", Failed, strerror(Result));
+        exit(1);
+    }
+
+    Instance->DeadlineNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID) + SERVER_FRAME_DURATION_NS;
     for (;;)
     {
-        /* Cannot sleep on CLOCK_MONOTONIC_RAW */
-        SleepResult = clock_nanosleep(CLOCK_MONOTONIC, 0, &TimeSpec, &TimeSpecRemain);
-        if (SleepResult == 0)
+        BeginFrame(Instance);
+
+        /* Wait for the rest of the frame */
+        WaitUntil(Instance->DeadlineNs);
+
+        EndFrame(Instance, Instance->Socket);
+        ScheduleNextFrame(Instance);
+        if (EchoInterval > 0)
+        {
+            ReceiveEchoes(Instance->Socket);
+        }
+    }
+
+    return NULL;
+}
+
+/** Restores the heap order after the root's DeadlineNs grew. */
+void HeapSiftDown(struct Instance** Heap, int NumInstances)
+{
+    int Idx = 0, Child;
+
+    for (;;)
+    {
+        Child = Idx * 2 + 1;
+        if (Child >= NumInstances)
+        {
+            break;
+        }
+        if (Child + 1 < NumInstances && Heap[Child + 1]->DeadlineNs < Heap[Child]->DeadlineNs)
+        {
+            ++Child;
+        }
+        if (Heap[Idx]->DeadlineNs <= Heap[Child]->DeadlineNs)
         {
             break;
         }
-        else if (SleepResult != EINTR)
+
+        struct Instance* Temp = Heap[Idx];
+        Heap[Idx] = Heap[Child];
+        Heap[Child] = Temp;
+        Idx = Child;
+    }
+}
+
+/**
+ * Runs many instances on one thread: the instance due next ends its frame and begins the next one,
+ * then the thread sleeps on a timerfd (and spins for the last SpinNs) until the next instance is due. Instances on one loop compete for
+ * its CPU the way servers on a host do, so one's long frame delays the others.
+ */
+void* EventLoopThread(void* Arg)
+{
+    struct EventLoop* Loop = (struct EventLoop*)Arg;
+    struct epoll_event Event;
+    struct itimerspec Timeout;
+    unsigned long long Now, Expirations;
+    int Epoll, Timer, IdxInstance, Result;
+    const char* Failed = "";
+
+    if (Loop->Cpu >= 0)
+    {
+        Result = PinThreadToCpu(Loop->Cpu);
+        if (Result != 0)
         {
-            fprintf(stderr, "clock_nanosleep() failed: SleepResult = %d\n", SleepResult);
+            fprintf(stderr, "Cannot pin event loop to cpu %d: %s\n", Loop->Cpu, strerror(Result));
             exit(1);
         }
+    }
 
-        // got interrupted, repeat
-        memcpy(&TimeSpec, &TimeSpecRemain, sizeof(TimeSpec));
+    Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot apply %s on event loop: %s\n", Failed, strerror(Result));
+        exit(1);
+    }
+
+    Epoll = epoll_create1(0);
+    Timer = timerfd_create(BENCH_SLEEP_CLOCK_ID, 0);
+    if (Epoll < 0 || Timer < 0)
+    {
+        perror("Cannot create event loop");
+        exit(1);
+    }
+
+    memset(&Event, 0, sizeof(Event));
+    Event.events = EPOLLIN;
+    if (epoll_ctl(Epoll, EPOLL_CTL_ADD, Timer, &Event) != 0)
+    {
+        perror("Cannot add timer to event loop");
+        exit(1);
     }
+
+    /* spread the first frames over a frame so the instances do not all work and send at once */
+    Now = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+    for (IdxInstance = 0; IdxInstance < Loop->NumInstances; ++IdxInstance)
+    {
+        Loop->Heap[IdxInstance]->DeadlineNs = Now + SERVER_FRAME_DURATION_NS * IdxInstance / Loop->NumInstances;
+    }
+
+    memset(&Timeout, 0, sizeof(Timeout));
+    for (;;)
+    {
+        struct Instance* Next = Loop->Heap[0];
+
+        Now = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+        if (Next->DeadlineNs > Now + SpinNs)
+        {
+            NsToTimespec(Next->DeadlineNs - SpinNs, &Timeout.it_value);
+            if (timerfd_settime(Timer, TFD_TIMER_ABSTIME, &Timeout, NULL) != 0)
+            {
+                perror("timerfd_settime failed");
+                exit(1);
+            }
+
+            if (epoll_wait(Epoll, &Event, 1, -1) < 0 && errno != EINTR)
+            {
+                perror("epoll_wait failed");
+                exit(1);
+            }
+            if (read(Timer, &Expirations, sizeof(Expirations)) < 0 && errno != EAGAIN)
+            {
+                perror("Cannot read timerfd");
+                exit(1);
+            }
+            continue;
+        }
+
+        SpinUntil(Next->DeadlineNs);
+
+        if (Next->Started)
+        {
+            EndFrame(Next, Loop->Socket);
+            ScheduleNextFrame(Next);
+            if (EchoInterval > 0)
+            {
+                ReceiveEchoes(Loop->Socket);
+            }
+        }
+        else
+        {
+            Next->DeadlineNs += SERVER_FRAME_DURATION_NS;
+        }
+        BeginFrame(Next);
+        HeapSiftDown(Loop->Heap, Loop->NumInstances);
+    }
+
+    return NULL;
 }
 
-/** Message format; needs to stay in sync with the server */
-#pragma pack(push, 1)
-struct Message
+/** Explains why a working set could not be set up, with what to do about it where that is known. */
+void PrintWorkSetError(const struct Workload* Work)
 {
-	/** Unique Id of this client */
-	unsigned long long UniqueId;
-	/** Actual frame time in nanoseconds */
-	unsigned long long FrameTimeNs;
-	/** Number of the frame (and message, because it is sent once per frame). */
-	unsigned long long FrameNumber;
-};
-#pragma pack(pop)
+    int Error = errno;
+
+    fprintf(stderr, "Cannot allocate %lu KB working set with %s pages and %s NUMA placement: %s\n", (unsigned long)(Work->WorkSetSize / 1024UL),
+        WorkloadPagesName(Work->Pages), WorkloadNumaName(Work->Numa), strerror(Error));
+    if (Work->Pages == WorkloadPages_HugeTlb && Error == ENOMEM)
+    {
+        fprintf(stderr, "Reserve enough 2 MB pages for all instances first, e.g. sysctl vm.nr_hugepages=N\n");
+    }
+}
+
+/**
+ * Prints the page size and NUMA nodes a kernel's working set actually got, which can differ from what was
+ * asked for (THP is only a hint, and nodes fill up). The first instance's stands for all of them.
+ */
+void PrintPlacement(const struct Workload* Work)
+{
+    size_t NodePages[WORKLOAD_MAX_NUMA_NODES], NumKnown;
+    unsigned long PageSizeKb, HugePagesKb;
+    int IdxNode;
+
+    NumKnown = WorkloadPlacement(Work, &PageSizeKb, &HugePagesKb, NodePages, WORKLOAD_MAX_NUMA_NODES);
+    printf("Placement, %s, Pages, %s, Numa, %s, PageSize(KB), %lu, HugePages(KB), %lu, Nodes,", WorkloadKernelName(Work->Kernel),
+        WorkloadPagesName(Work->Pages), WorkloadNumaName(Work->Numa), PageSizeKb, HugePagesKb);
+    for (IdxNode = 0; IdxNode < WORKLOAD_MAX_NUMA_NODES; ++IdxNode)
+    {
+        if (NodePages[IdxNode] > 0)
+        {
+            printf(" %d:%.0f%%", IdxNode, 100.0 * (double)NodePages[IdxNode] / (double)NumKnown);
+        }
+    }
+    printf("%s\n", (NumKnown > 0) ? "" : " unknown");
+}
 
-int main(int argc, const char* argv[])
+void PrintUsage(const char* Name)
 {
-    struct sockaddr_in ServerAddr;
-    int Socket, Port = 56636;
+    printf("Usage: %s [options] [server] [port]\n", Name);
+    printf("  " RUNTIME_CONFIG_SYNOPSIS "\n");
+    printf("  -w kernel[:fraction[:workset_kb[:steps]]],...   kernels to run each frame (default %s)\n", DEFAULT_WORKLOAD_MIX);
+    printf("      kernels: ");
+    for (int IdxKernel = 0; IdxKernel < WorkloadKernel_Count; ++IdxKernel)
+    {
+        printf("%s%s", IdxKernel ? ", " : "", WorkloadKernelName((enum WorkloadKernel)IdxKernel));
+    }
+    printf("\n");
+    printf("      fraction is the kernel's share of the frame budget, steps a fixed amount of work instead of calibrating to it\n");
+    printf("  -f fraction   share of the frame budget spent working, split between kernels without their own (default %.2f)\n", DEFAULT_WORK_FRACTION);
+    printf("  -s kb         working set of each kernel without its own (default %lu)\n", WORKLOAD_DEFAULT_WORKSET_SIZE / 1024UL);
+    printf("  -S bytes      stride of the strided kernel (default %lu)\n", WORKLOAD_DEFAULT_STRIDE);
+    printf("  -A pages      working set allocation: malloc, small (4 KB pages), thp (madvise), hugetlb (2 MB, needs vm.nr_hugepages) (default malloc)\n");
+    printf("  -N policy     working set NUMA placement: default, local (node of the setup cpu, see -C), interleave (all nodes) (default default)\n");
+    printf("  -n count      number of simulated servers (instances) to run (default 1)\n");
+    printf("  -m mode       threads: a thread and socket per instance, loop: instances share an event loop and socket per cpu (default threads)\n");
+    printf("  -t count      number of event loops in loop mode, pinned to the first cpus (default: one per cpu)\n");
+    printf("  -u id         unique id of the first instance, the rest count up from it (default random)\n");
+    printf("  -p us         spin instead of sleeping for the last us microseconds before each deadline (default 0)\n");
+    printf("  -H tag        host tag the server groups clients by, up to %d characters (default: host name)\n", MESSAGE_HOST_TAG_SIZE - 1);
+    printf("  -e count      ask the server to echo every count-th message and report round trip times (default 0, off)\n");
+    RuntimeConfigPrintUsage();
+}
+
+int main(int argc, char* argv[])
+{
+    int Port = 56636;
     const char* ServerURL = "127.0.0.1";
-    unsigned long long BeginFrameNs, UsefulWorkTimeNs, ActualFrameTimeNs;
-    unsigned long long UniqueId;
-    struct Message Msg;
+    unsigned long long UniqueId = 0;
     FILE* DevUrandom = NULL;
+    const char* WorkloadMix = DEFAULT_WORKLOAD_MIX;
+    char HostTag[MESSAGE_HOST_TAG_SIZE] = "";
+    double WorkFraction = DEFAULT_WORK_FRACTION, FractionLeft;
+    size_t WorkSetSize = WORKLOAD_DEFAULT_WORKSET_SIZE, Stride = WORKLOAD_DEFAULT_STRIDE, MemoryPerInstance = 0;
+    enum WorkloadPages Pages = WorkloadPages_Malloc;
+    enum WorkloadNuma Numa = WorkloadNuma_Default;
+    int Option, IdxWork, NumWithoutFraction = 0, HaveUniqueId = 0;
+    int NumLoops = 0, IdxInstance, IdxLoop, NumCpus, Result;
+    enum InstanceMode Mode = InstanceMode_Threads;
+    struct EventLoop* Loops = NULL;
+    int Cpus[CPU_SETSIZE];
+    const char* Failed = "";
+
+    RuntimeConfigInit(&Runtime);
+    while ((Option = getopt(argc, argv, "w:f:s:S:A:N:n:m:t:u:p:e:H:h" RUNTIME_CONFIG_OPTIONS)) != -1)
+    {
+        switch (Option)
+        {
+            case 'w':
+                WorkloadMix = optarg;
+                break;
+            case 'f':
+                WorkFraction = atof(optarg);
+                break;
+            case 's':
+                WorkSetSize = (size_t)atol(optarg) * 1024UL;
+                break;
+            case 'S':
+                Stride = (size_t)atol(optarg);
+                break;
+            case 'A':
+                if (ParseWorkloadPages(optarg, &Pages) != 0)
+                {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'N':
+                if (ParseWorkloadNuma(optarg, &Numa) != 0)
+                {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                NumInstances = atoi(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "threads") == 0)
+                {
+                    Mode = InstanceMode_Threads;
+                }
+                else if (strcmp(optarg, "loop") == 0)
+                {
+                    Mode = InstanceMode_Loop;
+                }
+                else
+                {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                NumLoops = atoi(optarg);
+                break;
+            case 'u':
+                UniqueId = strtoull(optarg, NULL, 0);
+                HaveUniqueId = 1;
+                break;
+            case 'p':
+                SpinNs = (unsigned long long)atol(optarg) * 1000ULL;
+                break;
+            case 'e':
+                EchoInterval = strtoull(optarg, NULL, 0);
+                break;
+            case 'H':
+                strncpy(HostTag, optarg, sizeof(HostTag) - 1);
+                break;
+            default:
+                if (RuntimeConfigParseOption(&Runtime, Option, optarg) == 0)
+                {
+                    break;
+                }
+                PrintUsage(argv[0]);
+                return (Option == 'h') ? 0 : 1;
+        }
+    }
 
-    if (argc >= 2) 
+    if (optind < argc) 
     {
-        ServerURL = argv[1];
+        ServerURL = argv[optind];
     }
 
-    if (argc >= 3) 
+    if (optind + 1 < argc) 
     {
-        Port = atoi(argv[2]);
+        Port = atoi(argv[optind + 1]);
     }
 
-    printf("Distributed synth benchmark client.\n");
-    printf("Reporting to %s:%d (use %s [server] [port] to override)\n", ServerURL, Port, argv[0]);
+    if (WorkFraction < 0 || WorkFraction > 1)
+    {
+        fprintf(stderr, "Work fraction must be between 0 and 1\n");
+        PrintUsage(argv[0]);
+        return 1;
+    }
 
-    Socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (Socket < 0) 
+    if (NumInstances < 1)
     {
-        perror("Cannot create UDP socket");
+        fprintf(stderr, "Need at least one instance\n");
+        return 1;
+    }
+
+    /* kernels without a fraction of their own get a negative one, and share what is left of WorkFraction */
+    NumWorks = ParseWorkloadMix(WorkloadMix, Works, WORKLOAD_MAX_KERNELS, -1.0, WorkSetSize);
+    if (NumWorks <= 0)
+    {
+        fprintf(stderr, "Invalid workload '%s'\n", WorkloadMix);
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    FractionLeft = WorkFraction;
+    for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
+    {
+        if (Works[IdxWork].BudgetFraction < 0)
+        {
+            ++NumWithoutFraction;
+        }
+        else
+        {
+            FractionLeft -= Works[IdxWork].BudgetFraction;
+        }
+    }
+    for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
+    {
+        if (Works[IdxWork].BudgetFraction < 0)
+        {
+            Works[IdxWork].BudgetFraction = (FractionLeft > 0) ? FractionLeft / NumWithoutFraction : 0;
+        }
+        Works[IdxWork].Stride = Stride;
+        Works[IdxWork].Pages = Pages;
+        Works[IdxWork].Numa = Numa;
+    }
+
+    /* before any working set is allocated, so locking covers them all */
+    Result = RuntimeConfigApply(&Runtime, &Failed);
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot apply %s: %s\n", Failed, strerror(Result));
         return 1;
     }
 
+    printf("Distributed synth benchmark client.\n");
+    printf("Reporting to %s:%d (use %s [options] [server] [port] to override, -h for options)\n", ServerURL, Port, argv[0]);
+
     memset(&ServerAddr, 0, sizeof(ServerAddr));
     ServerAddr.sin_family = AF_INET;
     ServerAddr.sin_port = htons(Port);
     if (inet_pton(AF_INET, ServerURL, &ServerAddr.sin_addr) == 0) 
     {
         perror("Cannot convert server address to binary, make sure it is given as an IPv4 and not a hostname.");
-        close(Socket);
         return 1;
     }
 
-    /* Read our own unique id */
-    DevUrandom = fopen("/dev/urandom", "rb");
-    if (DevUrandom == NULL)
+    /* VMs on one physical host are told its name with -H, otherwise all we know is our own */
+    if (HostTag[0] == 0)
     {
-        perror("Cannot open /dev/urandom to read unique id");
-        close(Socket);
-        return 1;
+        char HostName[256];
+        if (gethostname(HostName, sizeof(HostName)) == 0)
+        {
+            /* longer names are cut, the tag stays zero terminated */
+            HostName[sizeof(HostTag) - 1] = 0;
+            strcpy(HostTag, HostName);
+        }
     }
 
-    if (fread(&UniqueId, sizeof(UniqueId), 1, DevUrandom) != 1)
+    /* Read our own unique id */
+    if (!HaveUniqueId)
     {
-        perror("Cannot read from /dev/urandom");
-        close(Socket);
+        DevUrandom = fopen("/dev/urandom", "rb");
+        if (DevUrandom == NULL)
+        {
+            perror("Cannot open /dev/urandom to read unique id");
+            return 1;
+        }
+
+        if (fread(&UniqueId, sizeof(UniqueId), 1, DevUrandom) != 1)
+        {
+            perror("Cannot read from /dev/urandom");
+            fclose(DevUrandom);
+            return 1;
+        }
         fclose(DevUrandom);
-        return 1;
     }
-    fclose(DevUrandom);
     
-    printf("This client unique id is 0x%llx\n", UniqueId);
+    if (NumInstances == 1)
+    {
+        printf("This client unique id is 0x%llx, host tag '%s'\n", UniqueId, HostTag);
+    }
+    else
+    {
+        printf("Instances, %d, UniqueIds, 0x%llx-0x%llx, HostTag, %s\n", NumInstances, UniqueId, UniqueId + NumInstances - 1, HostTag);
+    }
 
-    WorkSet = malloc(WORKSET_SIZE_SQRT * WORKSET_SIZE_SQRT * WORKSET_ELEMENT_SIZE);
-    if (WorkSet == NULL)
+    /* calibrate once, all instances run the same number of steps */
+    for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
     {
-        perror("Cannot allocate memory for working set");
+        struct Workload* Work = &Works[IdxWork];
+
+        if (WorkloadInit(Work) != 0)
+        {
+            PrintWorkSetError(Work);
+            return 1;
+        }
+
+        WorkloadCalibrate(Work, SERVER_FRAME_DURATION_NS);
+        MemoryPerInstance += Work->WorkSetSize;
+        printf("Kernel, %s, WorkSet(KB), %lu, Fraction, %.3f, NsPerStep, %.3f, StepsPerFrame, %llu, ExpectedFrameWork(ms), %.3f\n",
+            WorkloadKernelName(Work->Kernel), (unsigned long)(Work->WorkSetSize / 1024UL), Work->BudgetFraction,
+            Work->NsPerStep, Work->StepsPerFrame, Work->NsPerStep * (double)Work->StepsPerFrame / 1e6);
+    }
+
+    BaseUniqueId = UniqueId;
+    Instances = (struct Instance*)calloc(NumInstances, sizeof(struct Instance));
+    if (Instances == NULL)
+    {
+        perror("Cannot allocate instances");
         return 1;
     }
 
-    memset(&Msg, 0, sizeof(Msg));
-    Msg.UniqueId = UniqueId;
-    Msg.FrameNumber = 0;    
-    BeginFrameNs = GetTimeInNs();
-    /* Enter infinite loop */
-    for (;;)
+    /* the first instance takes over the calibrated working sets, the others get their own */
+    for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+    {
+        struct Instance* Instance = &Instances[IdxInstance];
+
+        Instance->Msg.Header.Magic = MESSAGE_MAGIC;
+        Instance->Msg.Header.Version = MESSAGE_VERSION;
+        Instance->Msg.UniqueId = UniqueId + IdxInstance;
+        Instance->Msg.FrameNumber = 0;
+        memcpy(Instance->Msg.HostTag, HostTag, sizeof(HostTag));
+        memcpy(Instance->Works, Works, sizeof(Works));
+        for (IdxWork = 0; IdxInstance > 0 && IdxWork < NumWorks; ++IdxWork)
+        {
+            if (WorkloadInit(&Instance->Works[IdxWork]) != 0)
+            {
+                PrintWorkSetError(&Instance->Works[IdxWork]);
+                return 1;
+            }
+        }
+    }
+
+    /* calibration and per-instance setup wrote the working sets already, this catches what was reclaimed since */
+    for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+    {
+        for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
+        {
+            RuntimeConfigPrefault(&Runtime, Instances[IdxInstance].Works[IdxWork].WorkSet, Instances[IdxInstance].Works[IdxWork].WorkSetSize);
+        }
+    }
+    for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
     {
-        SpendTimeWorking(SERVER_FRAME_DURATION_NS / 2ULL);
+        PrintPlacement(&Instances[0].Works[IdxWork]);
+    }
+    RuntimeConfigPrint(&Runtime);
+
+    if (Mode == InstanceMode_Threads)
+    {
+        printf("Mode, threads, MemoryPerInstance(KB), %lu, Spin(us), %llu\n", (unsigned long)(MemoryPerInstance / 1024UL), SpinNs / 1000ULL);
+        fflush(stdout);
 
-        /* Sleep for the rest of the frame */
-        UsefulWorkTimeNs = GetTimeInNs() - BeginFrameNs;
-        if (UsefulWorkTimeNs < SERVER_FRAME_DURATION_NS)
+        for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+        {
+            Instances[IdxInstance].Socket = CreateSocket();
+            Result = pthread_create(&Instances[IdxInstance].Thread, NULL, InstanceThread, &Instances[IdxInstance]);
+            if (Result != 0)
+            {
+                fprintf(stderr, "Cannot start instance %d: %s\n", IdxInstance, strerror(Result));
+                return 1;
+            }
+        }
+
+        ReportSchedule(Instances, NumInstances);
+    }
+    else
+    {
+        NumCpus = GetAllowedCpus(Cpus, CPU_SETSIZE);
+        if (NumLoops <= 0)
+        {
+            NumLoops = (NumCpus > 0) ? NumCpus : 1;
+        }
+        if (NumLoops > NumInstances)
         {
-            Sleep(SERVER_FRAME_DURATION_NS - UsefulWorkTimeNs);
+            NumLoops = NumInstances;
         }
 
-        ActualFrameTimeNs = GetTimeInNs() - BeginFrameNs;
-	Msg.FrameTimeNs = ActualFrameTimeNs;
+        printf("Mode, loop, Loops, %d, MemoryPerInstance(KB), %lu, Spin(us), %llu\n", NumLoops, (unsigned long)(MemoryPerInstance / 1024UL), SpinNs / 1000ULL);
+        fflush(stdout);
 
-        /* debug only - used to time the working set
-        printf("Frame time is %llu ns, non-sleep time is %llu ns\n", ActualFrameTimeNs, UsefulWorkTimeNs);
-        */
-        
-        if (sendto(Socket, &Msg, sizeof(Msg), 0, (struct sockaddr *)&ServerAddr, sizeof(ServerAddr)) == -1)
+        /* instances are dealt out round robin, so loops differ by one instance at most */
+        Loops = (struct EventLoop*)calloc(NumLoops, sizeof(struct EventLoop));
+        if (Loops == NULL)
         {
-            perror("sendto failed");
-            free(WorkSet);
-            close(Socket);
+            perror("Cannot allocate event loops");
             return 1;
         }
+        for (IdxLoop = 0; IdxLoop < NumLoops; ++IdxLoop)
+        {
+            Loops[IdxLoop].Cpu = (IdxLoop < NumCpus) ? Cpus[IdxLoop] : -1;
+            Loops[IdxLoop].Socket = CreateSocket();
+            Loops[IdxLoop].Heap = (struct Instance**)calloc(NumInstances / NumLoops + 1, sizeof(struct Instance*));
+            if (Loops[IdxLoop].Heap == NULL)
+            {
+                perror("Cannot allocate event loop heap");
+                return 1;
+            }
+        }
+        for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+        {
+            struct EventLoop* Loop = &Loops[IdxInstance % NumLoops];
+            Loop->Heap[Loop->NumInstances++] = &Instances[IdxInstance];
+        }
 
-        ++Msg.FrameNumber;
-        BeginFrameNs = GetTimeInNs();
+        for (IdxLoop = 0; IdxLoop < NumLoops; ++IdxLoop)
+        {
+            Result = pthread_create(&Loops[IdxLoop].Thread, NULL, EventLoopThread, &Loops[IdxLoop]);
+            if (Result != 0)
+            {
+                fprintf(stderr, "Cannot start event loop %d: %s\n", IdxLoop, strerror(Result));
+                return 1;
+            }
+        }
+
+        ReportSchedule(Instances, NumInstances);
     }
 
     /** Never reached, but just in case. */
-    free(WorkSet);
-    close(Socket);
+    for (IdxInstance = 0; IdxInstance < NumInstances; ++IdxInstance)
+    {
+        for (IdxWork = 0; IdxWork < NumWorks; ++IdxWork)
+        {
+            WorkloadFree(&Instances[IdxInstance].Works[IdxWork]);
+        }
+    }
+    free(Instances);
+    free(Loops);
 
     return 0;
 };
-
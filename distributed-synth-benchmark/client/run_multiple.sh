@@ -25,6 +25,9 @@
 # OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+# Runs a process per instance. A single process can host them too, cheaper for large counts:
+#   ./ds_benchmark_client -n <num_instances> -m loop -s <workset_kb> <server_ip>
+
 # captures ctrl-c during testing
 trap early_exit_graceful INT
 trap early_exit_graceful TERM
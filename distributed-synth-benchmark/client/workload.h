@@ -0,0 +1,870 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "bench_core.h"
+
+/*
+ * Synthetic frame work for the client. A frame runs one or more kernels, each over its own working set and
+ * with its own share of the frame budget. Kernels are calibrated at startup so that a share means the same
+ * on any machine, instead of a fixed amount of work tuned by hand for one of them.
+ */
+
+/** Working set of each kernel unless given, same as the original transpose */
+#define WORKLOAD_DEFAULT_WORKSET_SIZE	(16UL * 1024UL * 1024UL)
+
+/** Stride of the strided kernel unless given - one workset element of the original transpose */
+#define WORKLOAD_DEFAULT_STRIDE			256UL
+
+/** Maximum number of kernels in a mix */
+#define WORKLOAD_MAX_KERNELS			8
+
+/** Calibration runs a kernel for at least this long per trial */
+#define WORKLOAD_CALIBRATION_TRIAL_NS	2000000ULL
+
+/** Calibration takes the fastest of this many trials */
+#define WORKLOAD_CALIBRATION_TRIALS		5
+
+enum WorkloadKernel
+{
+	/** Memory bound: read-modify-write one byte every Stride bytes, wrapping around the working set */
+	WorkloadKernel_Strided,
+	/** Latency bound: walk a random cycle through the cache lines of the working set, each load depends on the previous one */
+	WorkloadKernel_PointerChase,
+	/** Compute bound: vector multiply-adds on independent chains kept in registers */
+	WorkloadKernel_Simd,
+	/** Branch bound: update entities of a state machine whose transitions are random, like game simulation code */
+	WorkloadKernel_Branchy,
+	/** The original work: transpose a square matrix of elements spread WORKLOAD_DEFAULT_STRIDE bytes apart */
+	WorkloadKernel_Transpose,
+
+	WorkloadKernel_Count
+};
+
+/** Name of the kernel as used on the command line. */
+static inline const char* WorkloadKernelName(enum WorkloadKernel Kernel)
+{
+	switch (Kernel)
+	{
+		case WorkloadKernel_Strided:        return "strided";
+		case WorkloadKernel_PointerChase:   return "chase";
+		case WorkloadKernel_Simd:           return "simd";
+		case WorkloadKernel_Branchy:        return "branchy";
+		default:                            return "transpose";
+	}
+}
+
+/** Parses a kernel name, returns 0 on success. */
+static inline int ParseWorkloadKernel(const char* Name, size_t NameLength, enum WorkloadKernel* Kernel)
+{
+	int IdxKernel;
+
+	for (IdxKernel = 0; IdxKernel < WorkloadKernel_Count; ++IdxKernel)
+	{
+		const char* KernelName = WorkloadKernelName((enum WorkloadKernel)IdxKernel);
+		if (strlen(KernelName) == NameLength && strncmp(Name, KernelName, NameLength) == 0)
+		{
+			*Kernel = (enum WorkloadKernel)IdxKernel;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Size of the huge pages asked for by WorkloadPages_HugeTlb and aligned to for WorkloadPages_Thp */
+#define WORKLOAD_HUGE_PAGE_SIZE         (2UL * 1024UL * 1024UL)
+
+/** Highest NUMA node number the placement is reported for */
+#define WORKLOAD_MAX_NUMA_NODES         64
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT                  26
+#endif
+
+/** How the working sets are allocated, which decides the page size the kernels run on */
+enum WorkloadPages
+{
+	/** Plain malloc, whatever the C library and the system's THP setting give */
+	WorkloadPages_Malloc,
+	/** 4 KB pages, mmap with MADV_NOHUGEPAGE so THP set to always does not change them */
+	WorkloadPages_Small,
+	/** Transparent huge pages, mmap aligned to 2 MB with MADV_HUGEPAGE */
+	WorkloadPages_Thp,
+	/** 2 MB pages from the hugetlbfs pool (MAP_HUGETLB), which needs vm.nr_hugepages reserved */
+	WorkloadPages_HugeTlb,
+
+	WorkloadPages_Count
+};
+
+/** Which NUMA nodes the working sets are placed on */
+enum WorkloadNuma
+{
+	/** No policy of our own, the process's (first touch unless set with numactl) */
+	WorkloadNuma_Default,
+	/** The node of the cpu that sets the working set up (MPOL_LOCAL) - keep the client on one node with -C */
+	WorkloadNuma_Local,
+	/** Pages spread round robin over all the nodes with memory (MPOL_INTERLEAVE) */
+	WorkloadNuma_Interleave,
+
+	WorkloadNuma_Count
+};
+
+/** Name of the allocation mode as used on the command line. */
+static inline const char* WorkloadPagesName(enum WorkloadPages Pages)
+{
+	switch (Pages)
+	{
+		case WorkloadPages_Small:           return "small";
+		case WorkloadPages_Thp:             return "thp";
+		case WorkloadPages_HugeTlb:         return "hugetlb";
+		default:                            return "malloc";
+	}
+}
+
+/** Name of the NUMA placement as used on the command line. */
+static inline const char* WorkloadNumaName(enum WorkloadNuma Numa)
+{
+	switch (Numa)
+	{
+		case WorkloadNuma_Local:            return "local";
+		case WorkloadNuma_Interleave:       return "interleave";
+		default:                            return "default";
+	}
+}
+
+/** Parses an allocation mode name, returns 0 on success. */
+static inline int ParseWorkloadPages(const char* Name, enum WorkloadPages* Pages)
+{
+	int IdxPages;
+
+	for (IdxPages = 0; IdxPages < WorkloadPages_Count; ++IdxPages)
+	{
+		if (strcmp(Name, WorkloadPagesName((enum WorkloadPages)IdxPages)) == 0)
+		{
+			*Pages = (enum WorkloadPages)IdxPages;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Parses a NUMA placement name, returns 0 on success. */
+static inline int ParseWorkloadNuma(const char* Name, enum WorkloadNuma* Numa)
+{
+	int IdxNuma;
+
+	for (IdxNuma = 0; IdxNuma < WorkloadNuma_Count; ++IdxNuma)
+	{
+		if (strcmp(Name, WorkloadNumaName((enum WorkloadNuma)IdxNuma)) == 0)
+		{
+			*Numa = (enum WorkloadNuma)IdxNuma;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Vector of 8 floats, compiled to whatever SIMD the target has */
+typedef float WorkloadVector __attribute__((vector_size(32)));
+
+/** Number of independent vector chains of the SIMD kernel, enough to hide the latency of a multiply-add */
+#define WORKLOAD_SIMD_CHAINS	8
+
+/** Entity updated by the branchy kernel */
+struct WorkloadEntity
+{
+	unsigned int State;
+	int Health;
+	float X, Y;
+	float VelocityX, VelocityY;
+	unsigned int Target;
+	unsigned int Timer;
+};
+
+/** One kernel of the frame work */
+struct Workload
+{
+	enum WorkloadKernel Kernel;
+	/** Share of the frame budget to calibrate to */
+	double BudgetFraction;
+	size_t WorkSetSize;
+	size_t Stride;
+	/** Steps run each frame, calibrated unless given */
+	unsigned long long StepsPerFrame;
+	/** Cost of a step as measured by calibration, 0 if not calibrated */
+	double NsPerStep;
+
+	/** Page size and NUMA placement of the working set */
+	enum WorkloadPages Pages;
+	enum WorkloadNuma Numa;
+
+	char* WorkSet;
+	/** Mapping WorkSet lies in, NULL if it came from malloc */
+	void* Mapping;
+	size_t MappingSize;
+	/** Where the kernel stopped, the next frame continues from there */
+	size_t Cursor;
+	size_t Row, Column;
+	unsigned long long Random;
+	/** Results nobody looks at, so the compiler cannot drop the work */
+	volatile unsigned long long Sink;
+};
+
+/** xorshift64, good enough for access patterns and state transitions. */
+static inline unsigned long long WorkloadRandom(unsigned long long* State)
+{
+	unsigned long long X = *State;
+	X ^= X << 13;
+	X ^= X >> 7;
+	X ^= X << 17;
+	*State = X;
+	return X;
+}
+
+static inline void WorkloadFree(struct Workload* Work)
+{
+	if (Work->Mapping != NULL)
+	{
+		munmap(Work->Mapping, Work->MappingSize);
+	}
+	else
+	{
+		free(Work->WorkSet);
+	}
+	Work->WorkSet = NULL;
+	Work->Mapping = NULL;
+}
+
+/** Reads the nodes with memory from sysfs into a mask, as mbind() takes them. Returns the number of nodes. */
+static inline int WorkloadReadMemoryNodes(unsigned long* Mask, size_t MaskWords)
+{
+	char Line[256];
+	char* Cursor;
+	unsigned long First, Last, Node;
+	int NumNodes = 0;
+	FILE* File;
+
+	memset(Mask, 0, MaskWords * sizeof(unsigned long));
+	File = fopen("/sys/devices/system/node/has_memory", "r");
+	if (File == NULL)
+	{
+		return 0;
+	}
+	if (fgets(Line, sizeof(Line), File) == NULL)
+	{
+		Line[0] = 0;
+	}
+	fclose(File);
+
+	/* a list of ranges like 0-3,6 */
+	for (Cursor = Line; *Cursor >= '0' && *Cursor <= '9'; )
+	{
+		First = Last = strtoul(Cursor, &Cursor, 10);
+		if (*Cursor == '-')
+		{
+			Last = strtoul(Cursor + 1, &Cursor, 10);
+		}
+		for (Node = First; Node <= Last && Node < MaskWords * 64; ++Node)
+		{
+			Mask[Node / 64] |= 1UL << (Node % 64);
+			++NumNodes;
+		}
+		if (*Cursor == ',')
+		{
+			++Cursor;
+		}
+	}
+
+	return NumNodes;
+}
+
+/**
+ * Allocates the working set with the page size and NUMA policy asked for, before anything touches it.
+ * Huge page sizes are rounded up to whole huge pages, the kernels still only use WorkSetSize.
+ *
+ * @return 0 on success, -1 with errno set if the memory could not be allocated or the policy not set
+ */
+static inline int WorkloadAllocate(struct Workload* Work)
+{
+	unsigned long NodeMask[WORKLOAD_MAX_NUMA_NODES / 64];
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	uintptr_t Start, End;
+	char* Mapping;
+	long Result = 0;
+	int Error;
+
+	Work->Mapping = NULL;
+	Work->MappingSize = 0;
+	switch (Work->Pages)
+	{
+		case WorkloadPages_Malloc:
+			Work->WorkSet = (char*)malloc(Work->WorkSetSize);
+			if (Work->WorkSet == NULL)
+			{
+				errno = ENOMEM;
+				return -1;
+			}
+			break;
+
+		case WorkloadPages_HugeTlb:
+			Work->MappingSize = (Work->WorkSetSize + WORKLOAD_HUGE_PAGE_SIZE - 1) & ~(WORKLOAD_HUGE_PAGE_SIZE - 1);
+			Mapping = (char*)mmap(NULL, Work->MappingSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+			if (Mapping == MAP_FAILED)
+			{
+				return -1;
+			}
+			Work->Mapping = Mapping;
+			Work->WorkSet = Mapping;
+			break;
+
+		default:
+			/* one huge page extra, so the working set can start on a huge page boundary */
+			Work->MappingSize = ((Work->WorkSetSize + PageSize - 1) & ~(PageSize - 1)) + WORKLOAD_HUGE_PAGE_SIZE;
+			Mapping = (char*)mmap(NULL, Work->MappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (Mapping == MAP_FAILED)
+			{
+				return -1;
+			}
+			Work->Mapping = Mapping;
+			Work->WorkSet = (char*)(((uintptr_t)Mapping + WORKLOAD_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(WORKLOAD_HUGE_PAGE_SIZE - 1));
+			Result = madvise(Mapping, Work->MappingSize, (Work->Pages == WorkloadPages_Thp) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+			break;
+	}
+
+	/* malloc memory need not be page aligned, the policy covers the whole pages in it */
+	Start = ((uintptr_t)Work->WorkSet + PageSize - 1) & ~(uintptr_t)(PageSize - 1);
+	End = ((uintptr_t)Work->WorkSet + Work->WorkSetSize) & ~(uintptr_t)(PageSize - 1);
+	if (Result == 0 && Work->Numa != WorkloadNuma_Default && End > Start)
+	{
+		if (Work->Numa == WorkloadNuma_Interleave)
+		{
+			WorkloadReadMemoryNodes(NodeMask, sizeof(NodeMask) / sizeof(NodeMask[0]));
+			Result = syscall(SYS_mbind, Start, End - Start, MPOL_INTERLEAVE, NodeMask, (unsigned long)WORKLOAD_MAX_NUMA_NODES + 1, MPOL_MF_MOVE);
+		}
+		else
+		{
+			Result = syscall(SYS_mbind, Start, End - Start, MPOL_LOCAL, NULL, 0UL, MPOL_MF_MOVE);
+		}
+	}
+
+	if (Result != 0)
+	{
+		Error = errno;
+		WorkloadFree(Work);
+		errno = Error;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Where the working set ended up: the page size backing it, how much of it is in huge pages, and how many
+ * of its pages are on each NUMA node (as far as the kernel tells, nodes stay 0 if it does not).
+ *
+ * @return number of pages whose node is known
+ */
+static inline size_t WorkloadPlacement(const struct Workload* Work, unsigned long* PageSizeKb, unsigned long* HugePagesKb, size_t* NodePages, int MaxNodes)
+{
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE), NumPages, IdxPage, NumKnown = 0;
+	uintptr_t Address = (uintptr_t)Work->WorkSet;
+	unsigned long Start, End, Value;
+	int InRange = 0;
+	void** Pages;
+	int* Status;
+	char Line[256];
+	FILE* File;
+
+	/* the mapping holding the working set, from smaps - malloc memory may share it with other allocations */
+	*PageSizeKb = PageSize / 1024UL;
+	*HugePagesKb = 0;
+	File = fopen("/proc/self/smaps", "r");
+	while (File != NULL && fgets(Line, sizeof(Line), File) != NULL)
+	{
+		if (sscanf(Line, "%lx-%lx ", &Start, &End) == 2)
+		{
+			InRange = (Address >= Start && Address < End);
+		}
+		else if (InRange && sscanf(Line, "KernelPageSize: %lu kB", &Value) == 1)
+		{
+			*PageSizeKb = Value;
+		}
+		else if (InRange && (sscanf(Line, "AnonHugePages: %lu kB", &Value) == 1 || sscanf(Line, "Private_Hugetlb: %lu kB", &Value) == 1 ||
+			sscanf(Line, "Shared_Hugetlb: %lu kB", &Value) == 1))
+		{
+			*HugePagesKb += Value;
+		}
+	}
+	if (File != NULL)
+	{
+		fclose(File);
+	}
+
+	/* move_pages() without target nodes only reports where each page is */
+	memset(NodePages, 0, MaxNodes * sizeof(size_t));
+	NumPages = Work->WorkSetSize / PageSize;
+	Pages = (void**)malloc(NumPages * sizeof(void*));
+	Status = (int*)malloc(NumPages * sizeof(int));
+	if (Pages != NULL && Status != NULL)
+	{
+		for (IdxPage = 0; IdxPage < NumPages; ++IdxPage)
+		{
+			Pages[IdxPage] = (void*)((Address & ~(uintptr_t)(PageSize - 1)) + IdxPage * PageSize);
+		}
+		if (syscall(SYS_move_pages, 0, NumPages, Pages, NULL, Status, 0) == 0)
+		{
+			for (IdxPage = 0; IdxPage < NumPages; ++IdxPage)
+			{
+				if (Status[IdxPage] >= 0 && Status[IdxPage] < MaxNodes)
+				{
+					++NodePages[Status[IdxPage]];
+					++NumKnown;
+				}
+			}
+		}
+	}
+	free(Pages);
+	free(Status);
+
+	return NumKnown;
+}
+
+/**
+ * Allocates and lays out the working set. The pointer chase cycle, the entities and the vectors are
+ * set up here, so the frames only run the kernels.
+ *
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+static inline int WorkloadInit(struct Workload* Work)
+{
+	size_t IdxLine, NumLines, IdxEntity, NumEntities;
+
+	Work->Cursor = 0;
+	Work->Row = Work->Column = 0;
+	Work->Random = 0x9E3779B97F4A7C15ULL;
+	Work->Sink = 0;
+	if (Work->Stride == 0)
+	{
+		Work->Stride = WORKLOAD_DEFAULT_STRIDE;
+	}
+	/* smallest set every kernel stays inside of: the strided wrap needs more than one stride, the SIMD chains and a transpose element their own bytes */
+	if (Work->WorkSetSize < BENCH_CACHE_LINE_SIZE * 2)
+	{
+		Work->WorkSetSize = BENCH_CACHE_LINE_SIZE * 2;
+	}
+	if (Work->WorkSetSize < sizeof(WorkloadVector) * WORKLOAD_SIMD_CHAINS)
+	{
+		Work->WorkSetSize = sizeof(WorkloadVector) * WORKLOAD_SIMD_CHAINS;
+	}
+	if (Work->WorkSetSize < WORKLOAD_DEFAULT_STRIDE)
+	{
+		Work->WorkSetSize = WORKLOAD_DEFAULT_STRIDE;
+	}
+	if (Work->Kernel == WorkloadKernel_Strided && Work->WorkSetSize <= Work->Stride)
+	{
+		Work->WorkSetSize = Work->Stride + 1;
+	}
+
+	if (WorkloadAllocate(Work) != 0)
+	{
+		return -1;
+	}
+	memset(Work->WorkSet, 0, Work->WorkSetSize);
+
+	switch (Work->Kernel)
+	{
+		case WorkloadKernel_PointerChase:
+			/* Sattolo's shuffle gives a single cycle through all the lines, so the walk never gets stuck in a small loop */
+			NumLines = Work->WorkSetSize / BENCH_CACHE_LINE_SIZE;
+			for (IdxLine = 0; IdxLine < NumLines; ++IdxLine)
+			{
+				*(size_t*)(Work->WorkSet + IdxLine * BENCH_CACHE_LINE_SIZE) = IdxLine;
+			}
+			for (IdxLine = NumLines - 1; IdxLine > 0; --IdxLine)
+			{
+				size_t Other = WorkloadRandom(&Work->Random) % IdxLine;
+				size_t* A = (size_t*)(Work->WorkSet + IdxLine * BENCH_CACHE_LINE_SIZE);
+				size_t* B = (size_t*)(Work->WorkSet + Other * BENCH_CACHE_LINE_SIZE);
+				size_t Temp = *A;
+				*A = *B;
+				*B = Temp;
+			}
+			break;
+
+		case WorkloadKernel_Simd:
+			{
+				float* Values = (float*)Work->WorkSet;
+				size_t IdxValue;
+				for (IdxValue = 0; IdxValue < WORKLOAD_SIMD_CHAINS * 8 && (IdxValue + 1) * sizeof(float) <= Work->WorkSetSize; ++IdxValue)
+				{
+					Values[IdxValue] = 1.0f + (float)IdxValue / 64.0f;
+				}
+			}
+			break;
+
+		case WorkloadKernel_Branchy:
+			NumEntities = Work->WorkSetSize / sizeof(struct WorkloadEntity);
+			for (IdxEntity = 0; IdxEntity < NumEntities; ++IdxEntity)
+			{
+				struct WorkloadEntity* Entity = (struct WorkloadEntity*)Work->WorkSet + IdxEntity;
+				Entity->State = (unsigned int)(WorkloadRandom(&Work->Random) % 4);
+				Entity->Health = 100;
+				Entity->Target = (unsigned int)(WorkloadRandom(&Work->Random) % NumEntities);
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+
+static inline void WorkloadRunStrided(struct Workload* Work, unsigned long long Steps)
+{
+	size_t Cursor = Work->Cursor, Size = Work->WorkSetSize, Stride = Work->Stride;
+	char* WorkSet = Work->WorkSet;
+	unsigned long long IdxStep;
+
+	for (IdxStep = 0; IdxStep < Steps; ++IdxStep)
+	{
+		++WorkSet[Cursor];
+		Cursor += Stride;
+		if (Cursor >= Size)
+		{
+			/* shift by one so the next pass touches different bytes, like the original transpose did */
+			Cursor = (Cursor + 1) % Stride;
+		}
+	}
+
+	Work->Cursor = Cursor;
+}
+
+static inline void WorkloadRunPointerChase(struct Workload* Work, unsigned long long Steps)
+{
+	size_t Line = Work->Cursor;
+	const char* WorkSet = Work->WorkSet;
+	unsigned long long IdxStep;
+
+	for (IdxStep = 0; IdxStep < Steps; ++IdxStep)
+	{
+		Line = *(const size_t*)(WorkSet + Line * BENCH_CACHE_LINE_SIZE);
+	}
+
+	Work->Cursor = Line;
+}
+
+static inline void WorkloadRunSimd(struct Workload* Work, unsigned long long Steps)
+{
+	WorkloadVector Chains[WORKLOAD_SIMD_CHAINS];
+	const WorkloadVector Scale = { 0.9999f, 0.9999f, 0.9999f, 0.9999f, 0.9999f, 0.9999f, 0.9999f, 0.9999f };
+	const WorkloadVector Offset = { 0.0001f, 0.0001f, 0.0001f, 0.0001f, 0.0001f, 0.0001f, 0.0001f, 0.0001f };
+	unsigned long long IdxStep;
+	int IdxChain;
+
+	memcpy(Chains, Work->WorkSet, sizeof(Chains));
+	for (IdxStep = 0; IdxStep < Steps; ++IdxStep)
+	{
+		for (IdxChain = 0; IdxChain < WORKLOAD_SIMD_CHAINS; ++IdxChain)
+		{
+			Chains[IdxChain] = Chains[IdxChain] * Scale + Offset;
+		}
+	}
+	memcpy(Work->WorkSet, Chains, sizeof(Chains));
+}
+
+static inline void WorkloadRunBranchy(struct Workload* Work, unsigned long long Steps)
+{
+	struct WorkloadEntity* Entities = (struct WorkloadEntity*)Work->WorkSet;
+	size_t NumEntities = Work->WorkSetSize / sizeof(struct WorkloadEntity), Cursor = Work->Cursor;
+	unsigned long long IdxStep, Random = Work->Random, Hits = 0;
+
+	for (IdxStep = 0; IdxStep < Steps; ++IdxStep)
+	{
+		struct WorkloadEntity* Entity = &Entities[Cursor];
+		unsigned long long Roll = WorkloadRandom(&Random);
+
+		switch (Entity->State)
+		{
+			case 0:     /* idle, sometimes starts wandering or picks a fight */
+				if ((Roll & 7) == 0)
+				{
+					Entity->State = 1;
+					Entity->VelocityX = (float)((int)(Roll >> 8 & 255) - 128) / 128.0f;
+					Entity->VelocityY = (float)((int)(Roll >> 16 & 255) - 128) / 128.0f;
+				}
+				else if ((Roll & 7) == 1)
+				{
+					Entity->State = 2;
+					Entity->Target = (unsigned int)((Roll >> 24) % NumEntities);
+				}
+				break;
+
+			case 1:     /* wandering */
+				Entity->X += Entity->VelocityX;
+				Entity->Y += Entity->VelocityY;
+				if (Entity->X > 1000.0f || Entity->X < -1000.0f || Entity->Y > 1000.0f || Entity->Y < -1000.0f || (Roll & 15) == 0)
+				{
+					Entity->State = 0;
+				}
+				break;
+
+			case 2:     /* attacking, touches another entity */
+				{
+					struct WorkloadEntity* Target = &Entities[Entity->Target];
+					if (Target->State == 3 || (Roll & 3) == 0)
+					{
+						Entity->State = 0;
+					}
+					else if (Target->X < Entity->X)
+					{
+						Target->Health -= (int)(Roll & 15);
+						++Hits;
+						if (Target->Health <= 0)
+						{
+							Target->State = 3;
+							Target->Timer = (unsigned int)(Roll >> 32 & 63);
+						}
+					}
+					else
+					{
+						Entity->X -= 1.0f;
+					}
+				}
+				break;
+
+			default:    /* dead, respawns after a while */
+				if (Entity->Timer-- == 0)
+				{
+					Entity->State = 0;
+					Entity->Health = 100;
+				}
+				break;
+		}
+
+		if (++Cursor == NumEntities)
+		{
+			Cursor = 0;
+		}
+	}
+
+	Work->Cursor = Cursor;
+	Work->Random = Random;
+	Work->Sink += Hits;
+}
+
+static inline void WorkloadRunTranspose(struct Workload* Work, unsigned long long Steps)
+{
+	size_t Side = 1, Row = Work->Row, Column = Work->Column, ElementIdx = Work->Cursor;
+	char* WorkSet = Work->WorkSet;
+	unsigned long long IdxStep;
+
+	while ((Side + 1) * (Side + 1) * WORKLOAD_DEFAULT_STRIDE <= Work->WorkSetSize)
+	{
+		++Side;
+	}
+
+	for (IdxStep = 0; IdxStep < Steps; ++IdxStep)
+	{
+		WorkSet[(Row * Side + Column) * WORKLOAD_DEFAULT_STRIDE + ElementIdx] = WorkSet[(Column * Side + Row) * WORKLOAD_DEFAULT_STRIDE + ElementIdx];
+		ElementIdx = (ElementIdx + 1) % WORKLOAD_DEFAULT_STRIDE;
+		if (++Row == Side)
+		{
+			Row = 0;
+			if (++Column == Side)
+			{
+				Column = 0;
+			}
+		}
+	}
+
+	Work->Row = Row;
+	Work->Column = Column;
+	Work->Cursor = ElementIdx;
+}
+
+/** Runs given number of steps of the kernel, continuing where the previous run stopped. */
+static inline void WorkloadRun(struct Workload* Work, unsigned long long Steps)
+{
+	switch (Work->Kernel)
+	{
+		case WorkloadKernel_Strided:        WorkloadRunStrided(Work, Steps); break;
+		case WorkloadKernel_PointerChase:   WorkloadRunPointerChase(Work, Steps); break;
+		case WorkloadKernel_Simd:           WorkloadRunSimd(Work, Steps); break;
+		case WorkloadKernel_Branchy:        WorkloadRunBranchy(Work, Steps); break;
+		default:                            WorkloadRunTranspose(Work, Steps); break;
+	}
+}
+
+/**
+ * Measures the cost of a step and sets StepsPerFrame to fill BudgetFraction of FrameBudgetNs, unless it was given.
+ * Trials are long enough to go through the working set's caches the way frames will; the fastest one is used,
+ * as the others were likely interrupted.
+ */
+static inline void WorkloadCalibrate(struct Workload* Work, unsigned long long FrameBudgetNs)
+{
+	unsigned long long Steps = 1024, StartNs, ElapsedNs;
+	double BestNsPerStep = 0;
+	int IdxTrial;
+
+	/* warm up and find a step count that takes long enough to time */
+	for (;;)
+	{
+		StartNs = GetTimeInNs();
+		WorkloadRun(Work, Steps);
+		ElapsedNs = GetTimeInNs() - StartNs;
+		if (ElapsedNs >= WORKLOAD_CALIBRATION_TRIAL_NS)
+		{
+			break;
+		}
+		Steps *= 2;
+	}
+
+	for (IdxTrial = 0; IdxTrial < WORKLOAD_CALIBRATION_TRIALS; ++IdxTrial)
+	{
+		double NsPerStep;
+
+		StartNs = GetTimeInNs();
+		WorkloadRun(Work, Steps);
+		NsPerStep = (double)(GetTimeInNs() - StartNs) / (double)Steps;
+		if (IdxTrial == 0 || NsPerStep < BestNsPerStep)
+		{
+			BestNsPerStep = NsPerStep;
+		}
+	}
+
+	Work->NsPerStep = BestNsPerStep;
+	if (Work->StepsPerFrame == 0 && BestNsPerStep > 0)
+	{
+		Work->StepsPerFrame = (unsigned long long)(Work->BudgetFraction * (double)FrameBudgetNs / BestNsPerStep);
+	}
+}
+
+/**
+ * Parses a comma separated list of kernel[:fraction[:workset_kb[:steps]]] into Works, filling what is not given
+ * with DefaultFraction and DefaultWorkSetSize. Steps of 0 (the default) means calibrate.
+ *
+ * Fractions must be between 0 and 1, and so must their sum.
+ *
+ * @return number of kernels, or -1 if the list is invalid
+ */
+static inline int ParseWorkloadMix(const char* Mix, struct Workload* Works, int MaxWorks, double DefaultFraction, size_t DefaultWorkSetSize)
+{
+	int NumWorks = 0;
+	const char* Spec = Mix;
+	double SumFractions = 0;
+
+	while (*Spec != 0)
+	{
+		struct Workload* Work;
+		const char* End = strchr(Spec, ',');
+		const char* Colon = strchr(Spec, ':');
+		size_t SpecLength = (End != NULL) ? (size_t)(End - Spec) : strlen(Spec);
+		char Params[128];
+		char* Field;
+		char* Rest = Params;
+
+		if (NumWorks == MaxWorks)
+		{
+			return -1;
+		}
+
+		Work = &Works[NumWorks];
+		memset(Work, 0, sizeof(*Work));
+		Work->BudgetFraction = DefaultFraction;
+		Work->WorkSetSize = DefaultWorkSetSize;
+
+		if (Colon == NULL || Colon > Spec + SpecLength)
+		{
+			Colon = Spec + SpecLength;
+		}
+		if (ParseWorkloadKernel(Spec, (size_t)(Colon - Spec), &Work->Kernel) != 0)
+		{
+			return -1;
+		}
+
+		/* optional fields after the name */
+		if (Colon < Spec + SpecLength)
+		{
+			size_t ParamsLength = (size_t)(Spec + SpecLength - Colon - 1);
+			if (ParamsLength >= sizeof(Params))
+			{
+				return -1;
+			}
+			memcpy(Params, Colon + 1, ParamsLength);
+			Params[ParamsLength] = 0;
+
+			/* strsep keeps empty fields, so kernel::workset_kb skips just the fraction */
+			Field = strsep(&Rest, ":");
+			if (Field != NULL && *Field != 0)
+			{
+				Work->BudgetFraction = atof(Field);
+				SumFractions += Work->BudgetFraction;
+				if (Work->BudgetFraction < 0 || Work->BudgetFraction > 1 || SumFractions > 1)
+				{
+					return -1;
+				}
+			}
+			Field = strsep(&Rest, ":");
+			if (Field != NULL && *Field != 0)
+			{
+				Work->WorkSetSize = (size_t)atol(Field) * 1024UL;
+			}
+			Field = strsep(&Rest, ":");
+			if (Field != NULL && *Field != 0)
+			{
+				Work->StepsPerFrame = (unsigned long long)atoll(Field);
+			}
+		}
+
+		++NumWorks;
+		Spec += SpecLength;
+		if (*Spec == ',')
+		{
+			++Spec;
+		}
+	}
+
+	return NumWorks;
+}
@@ -0,0 +1,135 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+
+/*
+ * Wire format between ds_benchmark_client and ds_benchmark_server, shared so the two cannot drift apart.
+ * Messages start with a versioned header; later versions only append fields, so a receiver built for
+ * an older version reads the fields it knows. The original headerless message is still accepted.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+/** "DSBM", marks a versioned message */
+#define MESSAGE_MAGIC       0x4D425344u
+
+/** Version sent by this build */
+#define MESSAGE_VERSION     3
+
+/** Room for the host tag, including the terminating zero */
+#define MESSAGE_HOST_TAG_SIZE   16
+
+enum MessageFlags
+{
+    /** Client asks the server to send the message back, to measure the round trip */
+    MessageFlag_EchoRequest = 1,
+    /** Message is the server's echo */
+    MessageFlag_Echo = 2,
+};
+
+#pragma pack(push, 1)
+
+/** Original message, without a header. Version 1 */
+struct MessageV1
+{
+    /** Unique Id of this client */
+    unsigned long long UniqueId;
+    /** Actual frame time in nanoseconds */
+    unsigned long long FrameTimeNs;
+    /** Number of the frame (and message, because it is sent once per frame). */
+    unsigned long long FrameNumber;
+};
+
+struct MessageHeader
+{
+    unsigned int Magic;
+    unsigned short Version;
+    unsigned short Flags;
+};
+
+/** Current message */
+struct Message
+{
+    struct MessageHeader Header;
+    /** Unique Id of this client */
+    unsigned long long UniqueId;
+    /** Number of the frame (and message, because it is sent once per frame), lets the receiver spot loss and reordering */
+    unsigned long long FrameNumber;
+    /** Actual frame time in nanoseconds */
+    unsigned long long FrameTimeNs;
+    /** Part of the frame spent working, the rest was spent waiting for the deadline */
+    unsigned long long WorkTimeNs;
+    /** Client's BENCH_CLOCK_ID when sent, comes back unchanged in the echo */
+    unsigned long long SendTimeNs;
+    /** Client's CLOCK_REALTIME when sent, for one-way delays between hosts with synchronized clocks */
+    unsigned long long SendRealTimeNs;
+    /** Set in echoes: how long the server held the message before echoing it, to take out of the round trip */
+    unsigned long long ServerHoldNs;
+    /** Names the physical host the client runs on, so the server can group clients by it. Version 3 */
+    char HostTag[MESSAGE_HOST_TAG_SIZE];
+};
+
+#pragma pack(pop)
+
+/** Size of a version 2 message, the smallest versioned one */
+#define MESSAGE_V2_SIZE     offsetof(struct Message, HostTag)
+
+/**
+ * Reads a received datagram of either version into Msg, fields the sender did not have are zero.
+ *
+ * @return 0 on success, -1 if the datagram is not a message
+ */
+static inline int DecodeMessage(const void* Buffer, size_t Length, struct Message* Msg)
+{
+    const struct MessageHeader* Header = (const struct MessageHeader*)Buffer;
+
+    memset(Msg, 0, sizeof(*Msg));
+
+    if (Length >= MESSAGE_V2_SIZE && Header->Magic == MESSAGE_MAGIC && Header->Version >= 2)
+    {
+        memcpy(Msg, Buffer, (Length < sizeof(*Msg)) ? Length : sizeof(*Msg));
+        Msg->HostTag[MESSAGE_HOST_TAG_SIZE - 1] = 0;
+        return 0;
+    }
+
+    if (Length == sizeof(struct MessageV1))
+    {
+        const struct MessageV1* Old = (const struct MessageV1*)Buffer;
+        Msg->Header.Magic = MESSAGE_MAGIC;
+        Msg->Header.Version = 1;
+        Msg->UniqueId = Old->UniqueId;
+        Msg->FrameTimeNs = Old->FrameTimeNs;
+        Msg->FrameNumber = Old->FrameNumber;
+        return 0;
+    }
+
+    return -1;
+}
@@ -0,0 +1,498 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "bench_core.h"
+#include "ds_protocol.h"
+
+/*
+ * Load generator for ds_benchmark_server: many synthetic clients sending valid messages at a controlled
+ * rate, stepping through rising offered loads. Every client id keeps its own frame numbers, so the server's
+ * loss and reordering counters work as with real clients. A sample of the messages asks for an echo, which
+ * tells us here how much of the load got through and how long the server held it before getting to it.
+ *
+ * Run the server with -k (kernel timestamps, so the hold includes the time spent in its socket buffer) and
+ * -i set to the step duration, and its periods line up with our steps.
+ */
+
+/** How often each thread catches up with its share of the offered rate */
+#define SEND_TICK_NS            100000ULL
+
+/** Most messages handed to a single sendmmsg() */
+#define SEND_BATCH              64
+
+/** Echoes read per recvmmsg() call */
+#define ECHO_BATCH              64
+
+/** How long the threads keep collecting echoes after a step, before its stats are printed */
+#define ECHO_DRAIN_NS           200000000ULL
+
+/** What synthetic clients report as their frame time, the server's nominal 30 Hz */
+#define NOMINAL_FRAME_TIME_NS   (1000000000ULL / 30ULL)
+
+/** Offered loads stepped through unless given with -r, messages per second */
+#define DEFAULT_RATES           "10000,50000,100000,200000,500000,1000000"
+
+/** Room in the socket buffer for echoes coming back while we are busy sending */
+#define ECHO_RCVBUF_SIZE        (4 * 1024 * 1024)
+
+/** What happened to a step's messages, as seen by one thread */
+struct StepStats
+{
+    unsigned long long NumSent;
+    /** Messages the kernel would not take (full socket buffer, or no server yet) */
+    unsigned long long NumSendErrors;
+    unsigned long long NumEchoRequested;
+    unsigned long long NumEchoes;
+    /** How long the server held echoed messages, from arrival (with its -k) to echoing them */
+    struct LatencyHistogram ServerHold;
+    /** Round trip without the server's hold time */
+    struct LatencyHistogram Rtt;
+};
+
+/** A sending thread, with its own socket and share of the client ids */
+struct Sender
+{
+    int Index;
+    int Socket;
+    /** Ids FirstId .. FirstId + NumIds - 1, relative to BaseUniqueId */
+    unsigned long long FirstId;
+    unsigned long long NumIds;
+    /** Next frame number of each of our ids */
+    unsigned long long* FrameNumbers;
+    /** Id the next message is sent as */
+    unsigned long long NextId;
+    /** Messages sent over all steps, picks the ones that ask for an echo */
+    unsigned long long NumSentTotal;
+    pthread_t Thread;
+    struct StepStats Stats;
+};
+
+/** Settings, set from the command line */
+unsigned long long NumIds = 10000;
+int NumSenders = 2;
+int FirstCpu = -1;
+unsigned long long StepNs = 10ULL * 1000000000ULL;
+unsigned long long EchoInterval = 100;
+unsigned long long BaseUniqueId = 0;
+char HostTag[MESSAGE_HOST_TAG_SIZE] = "loadgen";
+struct sockaddr_in ServerAddr;
+
+/** Step being run, set by the main thread between the barriers */
+unsigned long long StepRate = 0;
+unsigned long long StepStartNs = 0;
+int Quit = 0;
+pthread_barrier_t StepBarrier;
+
+/** Reads the echoes that arrived so far, without blocking */
+void ReceiveEchoes(struct Sender* Sender, unsigned long long StepStartTimeNs)
+{
+    struct Message Buffers[ECHO_BATCH];
+    struct iovec Vecs[ECHO_BATCH];
+    struct mmsghdr Headers[ECHO_BATCH];
+    int Idx, NumReceived;
+
+    for (;;)
+    {
+        memset(Headers, 0, sizeof(Headers));
+        for (Idx = 0; Idx < ECHO_BATCH; ++Idx)
+        {
+            Vecs[Idx].iov_base = &Buffers[Idx];
+            Vecs[Idx].iov_len = sizeof(Buffers[Idx]);
+            Headers[Idx].msg_hdr.msg_iov = &Vecs[Idx];
+            Headers[Idx].msg_hdr.msg_iovlen = 1;
+        }
+
+        NumReceived = recvmmsg(Sender->Socket, Headers, ECHO_BATCH, MSG_DONTWAIT, NULL);
+        if (NumReceived <= 0)
+        {
+            return;
+        }
+
+        unsigned long long Now = GetTimeInNs();
+        for (Idx = 0; Idx < NumReceived; ++Idx)
+        {
+            struct Message Echo;
+
+            /* echoes of an earlier step that came in late are not counted against this one */
+            if (DecodeMessage(&Buffers[Idx], Headers[Idx].msg_len, &Echo) != 0 || (Echo.Header.Flags & MessageFlag_Echo) == 0 ||
+                Echo.SendTimeNs < StepStartTimeNs)
+            {
+                continue;
+            }
+
+            ++Sender->Stats.NumEchoes;
+            UpdateHistogram(&Sender->Stats.ServerHold, Echo.ServerHoldNs);
+            if (Now > Echo.SendTimeNs + Echo.ServerHoldNs)
+            {
+                UpdateHistogram(&Sender->Stats.Rtt, Now - Echo.SendTimeNs - Echo.ServerHoldNs);
+            }
+        }
+    }
+}
+
+/** Sends Count messages, cycling through our ids. Returns how many the kernel took. */
+int SendBatch(struct Sender* Sender, struct Message* Msgs, struct mmsghdr* Headers, int Count)
+{
+    unsigned long long Now = GetTimeInNs();
+    unsigned long long Id = Sender->NextId;
+    int Idx, NumSent;
+
+    for (Idx = 0; Idx < Count; ++Idx)
+    {
+        int WantEcho = EchoInterval > 0 && (Sender->NumSentTotal + Idx) % EchoInterval == 0;
+
+        Msgs[Idx].Header.Flags = WantEcho ? MessageFlag_EchoRequest : 0;
+        Msgs[Idx].UniqueId = BaseUniqueId + Sender->FirstId + Id;
+        Msgs[Idx].FrameNumber = Sender->FrameNumbers[Id];
+        Msgs[Idx].SendTimeNs = Now;
+        Headers[Idx].msg_len = 0;
+
+        Id = (Id + 1 < Sender->NumIds) ? Id + 1 : 0;
+    }
+
+    NumSent = sendmmsg(Sender->Socket, Headers, Count, 0);
+    if (NumSent < 0)
+    {
+        /* a connected socket reports the server's port unreachable on the next send, keep offering the load */
+        if (errno != ENOBUFS && errno != EAGAIN && errno != ECONNREFUSED)
+        {
+            perror("sendmmsg failed");
+            exit(1);
+        }
+        NumSent = 0;
+    }
+
+    /* only the messages that went out use up a frame number, the first one refused goes out next */
+    for (Idx = 0; Idx < NumSent; ++Idx)
+    {
+        unsigned long long SentId = Msgs[Idx].UniqueId - BaseUniqueId - Sender->FirstId;
+        ++Sender->FrameNumbers[SentId];
+        if (Msgs[Idx].Header.Flags & MessageFlag_EchoRequest)
+        {
+            ++Sender->Stats.NumEchoRequested;
+        }
+    }
+    if (NumSent > 0)
+    {
+        Sender->NextId = (Msgs[NumSent - 1].UniqueId - BaseUniqueId - Sender->FirstId + 1) % Sender->NumIds;
+    }
+
+    Sender->NumSentTotal += NumSent;
+    Sender->Stats.NumSent += NumSent;
+    Sender->Stats.NumSendErrors += Count - NumSent;
+    return NumSent;
+}
+
+void* SenderThread(void* Data)
+{
+    struct Sender* Sender = (struct Sender*)Data;
+    struct Message Msgs[SEND_BATCH];
+    struct iovec Vecs[SEND_BATCH];
+    struct mmsghdr Headers[SEND_BATCH];
+    int Idx;
+
+    if (FirstCpu >= 0)
+    {
+        PinThreadToCpu((FirstCpu + Sender->Index) % sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    memset(Msgs, 0, sizeof(Msgs));
+    memset(Headers, 0, sizeof(Headers));
+    for (Idx = 0; Idx < SEND_BATCH; ++Idx)
+    {
+        Msgs[Idx].Header.Magic = MESSAGE_MAGIC;
+        Msgs[Idx].Header.Version = MESSAGE_VERSION;
+        Msgs[Idx].FrameTimeNs = NOMINAL_FRAME_TIME_NS;
+        memcpy(Msgs[Idx].HostTag, HostTag, sizeof(HostTag));
+        Vecs[Idx].iov_base = &Msgs[Idx];
+        Vecs[Idx].iov_len = sizeof(Msgs[Idx]);
+        Headers[Idx].msg_hdr.msg_iov = &Vecs[Idx];
+        Headers[Idx].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* a batch never holds the same id twice, so rolling back unsent frame numbers stays simple */
+    int MaxBatch = (Sender->NumIds < SEND_BATCH) ? (int)Sender->NumIds : SEND_BATCH;
+
+    for (;;)
+    {
+        pthread_barrier_wait(&StepBarrier);
+        if (Quit)
+        {
+            break;
+        }
+
+        /* our share of the rate, the first threads take the remainder */
+        unsigned long long Rate = StepRate / NumSenders + (((unsigned long long)Sender->Index < StepRate % NumSenders) ? 1 : 0);
+        unsigned long long StepStartTimeNs = GetTimeInNs();
+        unsigned long long NumDue = 0, NumSent = 0;
+        unsigned long long TickNs;
+
+        memset(&Sender->Stats, 0, sizeof(Sender->Stats));
+
+        for (TickNs = StepStartNs; TickNs < StepStartNs + StepNs; TickNs += SEND_TICK_NS)
+        {
+            SleepUntilNs(TickNs);
+
+            /* whatever earlier ticks fell behind is sent now, so the rate holds on average */
+            NumDue = (TickNs - StepStartNs + SEND_TICK_NS) * Rate / 1000000000ULL;
+            while (NumSent < NumDue)
+            {
+                int Count = (NumDue - NumSent < (unsigned long long)MaxBatch) ? (int)(NumDue - NumSent) : MaxBatch;
+                int Result = SendBatch(Sender, Msgs, Headers, Count);
+
+                /* refused messages count as offered, retrying them would only pile up behind a server that is not keeping up */
+                NumSent += Count;
+                if (Result < Count)
+                {
+                    break;
+                }
+            }
+
+            ReceiveEchoes(Sender, StepStartTimeNs);
+        }
+
+        for (TickNs = StepStartNs + StepNs; TickNs < StepStartNs + StepNs + ECHO_DRAIN_NS; TickNs += SEND_TICK_NS * 10)
+        {
+            SleepUntilNs(TickNs);
+            ReceiveEchoes(Sender, StepStartTimeNs);
+        }
+
+        pthread_barrier_wait(&StepBarrier);
+    }
+
+    return NULL;
+}
+
+/** Prints the stats of a step, merged over all senders */
+void PrintStep(struct Sender* Senders, unsigned long long Rate)
+{
+    struct StepStats Total;
+    int Idx;
+
+    memset(&Total, 0, sizeof(Total));
+    for (Idx = 0; Idx < NumSenders; ++Idx)
+    {
+        struct StepStats* Stats = &Senders[Idx].Stats;
+        Total.NumSent += Stats->NumSent;
+        Total.NumSendErrors += Stats->NumSendErrors;
+        Total.NumEchoRequested += Stats->NumEchoRequested;
+        Total.NumEchoes += Stats->NumEchoes;
+        MergeHistogram(&Total.ServerHold, &Stats->ServerHold);
+        MergeHistogram(&Total.Rtt, &Stats->Rtt);
+    }
+
+    double Seconds = (double)StepNs / 1e9;
+    double EchoLoss = (Total.NumEchoRequested > 0) ? 100.0 * (double)(Total.NumEchoRequested - Total.NumEchoes) / (double)Total.NumEchoRequested : 0.0;
+
+    printf("Load, OfferedRate, %llu, SentRate, %.0f, Sent, %llu, SendErrors, %llu, EchoRequested, %llu, Echoes, %llu, EchoLoss(%%), %.3f, ServerHold, ",
+        Rate, (double)Total.NumSent / Seconds, Total.NumSent, Total.NumSendErrors, Total.NumEchoRequested, Total.NumEchoes, EchoLoss);
+    PrintPercentiles(&Total.ServerHold, 1000.0, "us");
+    printf(", Rtt, ");
+    PrintPercentiles(&Total.Rtt, 1000.0, "us");
+    printf(", %s", UtcTimeString());
+}
+
+void PrintUsage(const char* Name)
+{
+    printf("Usage: %s [-n num_ids] [-t threads] [-r rate,...] [-d seconds] [-e count] [-c first_cpu] [-u id] [-H tag] [server] [port]\n", Name);
+    printf("  -n count      number of synthetic clients, each with its own unique id (default %llu)\n", NumIds);
+    printf("  -t count      sending threads, each with its own socket and share of the ids (default %d)\n", NumSenders);
+    printf("  -r rates      offered loads to step through, messages per second over all clients (default %s)\n", DEFAULT_RATES);
+    printf("  -d seconds    duration of each step (default %.0f)\n", (double)StepNs / 1e9);
+    printf("  -e count      ask the server to echo every count-th message, 0 for none (default %llu)\n", EchoInterval);
+    printf("  -c cpu        pin sending thread N to cpu first_cpu + N (default: not pinned)\n");
+    printf("  -u id         unique id of the first client, the rest count up from it (default random)\n");
+    printf("  -H tag        host tag sent by all clients, up to %d characters (default %s)\n", MESSAGE_HOST_TAG_SIZE - 1, HostTag);
+}
+
+int main(int argc, char* const argv[])
+{
+    const char* Rates = DEFAULT_RATES;
+    const char* ServerURL = "127.0.0.1";
+    int Port = 56636;
+    int HaveUniqueId = 0;
+    int Opt, Idx;
+
+    setlinebuf(stdout);
+
+    while ((Opt = getopt(argc, argv, "n:t:r:d:e:c:u:H:h")) != -1)
+    {
+        switch (Opt)
+        {
+            case 'n':
+                NumIds = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                NumSenders = atoi(optarg);
+                break;
+            case 'r':
+                Rates = optarg;
+                break;
+            case 'd':
+                StepNs = (unsigned long long)(atof(optarg) * 1e9);
+                break;
+            case 'e':
+                EchoInterval = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                FirstCpu = atoi(optarg);
+                break;
+            case 'u':
+                BaseUniqueId = strtoull(optarg, NULL, 0);
+                HaveUniqueId = 1;
+                break;
+            case 'H':
+                strncpy(HostTag, optarg, sizeof(HostTag) - 1);
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc)
+    {
+        ServerURL = argv[optind];
+    }
+    if (optind + 1 < argc)
+    {
+        Port = atoi(argv[optind + 1]);
+    }
+
+    if (NumSenders < 1 || NumIds < (unsigned long long)NumSenders || StepNs == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    memset(&ServerAddr, 0, sizeof(ServerAddr));
+    ServerAddr.sin_family = AF_INET;
+    ServerAddr.sin_port = htons(Port);
+    if (inet_pton(AF_INET, ServerURL, &ServerAddr.sin_addr) == 0)
+    {
+        perror("Cannot convert server address to binary, make sure it is given as an IPv4 and not a hostname.");
+        return 1;
+    }
+
+    if (!HaveUniqueId)
+    {
+        FILE* DevUrandom = fopen("/dev/urandom", "rb");
+        if (DevUrandom == NULL || fread(&BaseUniqueId, sizeof(BaseUniqueId), 1, DevUrandom) != 1)
+        {
+            perror("Cannot read unique id from /dev/urandom");
+            return 1;
+        }
+        fclose(DevUrandom);
+    }
+
+    printf("Distributed synth benchmark load generator.\n");
+    printf("Sending to %s:%d, Clients, %llu, UniqueIds, 0x%llx-0x%llx, HostTag, %s, Threads, %d, Step(s), %.3f, EchoEvery, %llu\n",
+        ServerURL, Port, NumIds, BaseUniqueId, BaseUniqueId + NumIds - 1, HostTag, NumSenders, (double)StepNs / 1e9, EchoInterval);
+    printf("Run the server with -k -i %.3f to line its periods up with the steps.\n", (double)StepNs / 1e9);
+
+    struct Sender* Senders = (struct Sender*)calloc(NumSenders, sizeof(struct Sender));
+    if (Senders == NULL)
+    {
+        perror("Cannot allocate senders");
+        return 1;
+    }
+
+    pthread_barrier_init(&StepBarrier, NULL, NumSenders + 1);
+    for (Idx = 0; Idx < NumSenders; ++Idx)
+    {
+        struct Sender* Sender = &Senders[Idx];
+        int RcvBufSize = ECHO_RCVBUF_SIZE;
+
+        Sender->Index = Idx;
+        Sender->FirstId = NumIds * Idx / NumSenders;
+        Sender->NumIds = NumIds * (Idx + 1) / NumSenders - Sender->FirstId;
+        Sender->FrameNumbers = (unsigned long long*)calloc(Sender->NumIds, sizeof(unsigned long long));
+
+        /* connected, so sendmmsg() needs no addresses and only the server's echoes come back.
+           Each socket has its own source port, which spreads the load over the server's SO_REUSEPORT sockets */
+        Sender->Socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (Sender->FrameNumbers == NULL || Sender->Socket < 0 || connect(Sender->Socket, (struct sockaddr*)&ServerAddr, sizeof(ServerAddr)) != 0)
+        {
+            perror("Cannot set up sender");
+            return 1;
+        }
+        if (setsockopt(Sender->Socket, SOL_SOCKET, SO_RCVBUF, &RcvBufSize, sizeof(RcvBufSize)) < 0)
+        {
+            perror("Cannot set SO_RCVBUF");
+        }
+
+        if (pthread_create(&Sender->Thread, NULL, SenderThread, Sender) != 0)
+        {
+            fprintf(stderr, "Cannot create sender thread %d\n", Idx);
+            return 1;
+        }
+    }
+
+    char* RateList = strdup(Rates);
+    char* Cursor = RateList;
+    char* Token;
+    while ((Token = strsep(&Cursor, ",")) != NULL)
+    {
+        if (*Token == 0)
+        {
+            continue;
+        }
+
+        /* threads start on a common deadline a little ahead, so the step's rate holds from its first tick */
+        StepRate = strtoull(Token, NULL, 10);
+        StepStartNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID) + 10ULL * SEND_TICK_NS;
+        pthread_barrier_wait(&StepBarrier);
+        pthread_barrier_wait(&StepBarrier);
+
+        PrintStep(Senders, StepRate);
+    }
+    free(RateList);
+
+    Quit = 1;
+    pthread_barrier_wait(&StepBarrier);
+    for (Idx = 0; Idx < NumSenders; ++Idx)
+    {
+        pthread_join(Senders[Idx].Thread, NULL);
+        close(Senders[Idx].Socket);
+        free(Senders[Idx].FrameNumbers);
+    }
+    free(Senders);
+
+    return 0;
+}
@@ -0,0 +1,336 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Preallocated client table keyed by UniqueId, with expiry of stale entries.
+ *
+ * Lookups go through an open-addressing (linear probing) hash table of { key, entry index } pairs kept
+ * at most half full, so a packet typically costs one or two cache lines. Values live in a separate pool
+ * and never move while they are in the table, so the expiry wheel can refer to them by index.
+ *
+ * Expiry is a lazy timing wheel: every entry sits in the slot of the tick at which it would time out,
+ * judging by LastTimeHeard when it was (re)scheduled. Packets only update LastTimeHeard; when a slot comes
+ * due, entries that were heard from since are rescheduled and the rest are removed. Every live client is
+ * therefore visited about once per timeout, and each Expire() call does a bounded amount of that work,
+ * no matter how many clients there are.
+ *
+ * ValueType needs an unsigned long long LastTimeHeard member, in the same time base as Now passed to Add() and Expire().
+ * Pointers returned by Find() and Add() stay valid until the next Add() or Expire().
+ */
+template <typename ValueType>
+class ClientTable
+{
+public:
+
+    /** Marks an empty hash bucket and the end of a slot or free list */
+    static const uint32_t InvalidIndex = 0xFFFFFFFFu;
+
+    /**
+     * @param InitialCapacity number of clients to preallocate for, the table grows past it if needed
+     * @param InTimeoutNs clients not heard from for this long are removed
+     * @param NumSlots number of slots in the expiry wheel, more slots means less work per tick
+     */
+    ClientTable(size_t InitialCapacity, unsigned long long InTimeoutNs, uint32_t NumSlots = 1024)
+        : TimeoutNs(InTimeoutNs)
+        , NumEntries(0)
+        , FreeHead(InvalidIndex)
+        , CurrentTick(0)
+    {
+        // wheel needs to cover the whole timeout plus the tick being processed and rounding on both ends
+        if (NumSlots < 8)
+        {
+            NumSlots = 8;
+        }
+        TickNs = TimeoutNs / (NumSlots - 4);
+        if (TickNs == 0)
+        {
+            TickNs = 1;
+        }
+        SlotHeads.assign(NumSlots, InvalidIndex);
+
+        Entries.reserve(InitialCapacity);
+        Resize(InitialCapacity);
+    }
+
+    size_t Size() const
+    {
+        return NumEntries;
+    }
+
+    /** Calls Func with every client in the table, in no particular order. Func must not add or remove clients. */
+    template <typename FuncType>
+    void ForEach(FuncType Func)
+    {
+        for (const Bucket& B : Buckets)
+        {
+            if (B.EntryIdx != InvalidIndex)
+            {
+                Func(Entries[B.EntryIdx].Value);
+            }
+        }
+    }
+
+    /** Returns the client with given id or nullptr. */
+    ValueType* Find(unsigned long long Key)
+    {
+        for (size_t BucketIdx = Hash(Key) & BucketMask; ; BucketIdx = (BucketIdx + 1) & BucketMask)
+        {
+            const Bucket& B = Buckets[BucketIdx];
+            if (B.EntryIdx == InvalidIndex)
+            {
+                return nullptr;
+            }
+            if (B.Key == Key)
+            {
+                return &Entries[B.EntryIdx].Value;
+            }
+        }
+    }
+
+    /** Adds a client that is not in the table yet and returns it for the caller to fill in (including LastTimeHeard). */
+    ValueType* Add(unsigned long long Key, unsigned long long Now)
+    {
+        if ((NumEntries + 1) * 2 > Buckets.size())
+        {
+            Resize(Buckets.size());
+        }
+
+        uint32_t EntryIdx = FreeHead;
+        if (EntryIdx != InvalidIndex)
+        {
+            FreeHead = Entries[EntryIdx].Next;
+        }
+        else
+        {
+            EntryIdx = (uint32_t)Entries.size();
+            Entries.push_back(Entry());
+        }
+
+        Entry& E = Entries[EntryIdx];
+        E.Key = Key;
+        E.Value = ValueType();
+        E.Value.LastTimeHeard = Now;
+        InsertBucket(Key, EntryIdx);
+        ++NumEntries;
+
+        if (NumEntries == 1)
+        {
+            CurrentTick = Now / TickNs;
+        }
+        Schedule(EntryIdx, Now);
+
+        return &E.Value;
+    }
+
+    /**
+     * Removes clients that have not been heard from for TimeoutNs as of Now. Visits at most MaxVisits
+     * entries, the rest of the due work is picked up by the next call.
+     *
+     * @return number of clients removed
+     */
+    size_t Expire(unsigned long long Now, size_t MaxVisits = 256)
+    {
+        size_t NumRemoved = 0, NumVisits = 0;
+        unsigned long long NowTick = Now / TickNs;
+
+        if (NumEntries == 0)
+        {
+            CurrentTick = NowTick;
+            return 0;
+        }
+
+        // stepping over an empty slot counts as a visit too, so catching up after a long pause is bounded as well
+        for (; NumVisits < MaxVisits; ++NumVisits)
+        {
+            uint32_t& Head = SlotHeads[CurrentTick % SlotHeads.size()];
+            if (Head == InvalidIndex)
+            {
+                if (CurrentTick >= NowTick)
+                {
+                    break;
+                }
+                ++CurrentTick;
+                continue;
+            }
+
+            uint32_t EntryIdx = Head;
+            Entry& E = Entries[EntryIdx];
+            Head = E.Next;
+
+            if (Now - E.Value.LastTimeHeard >= TimeoutNs)
+            {
+                RemoveBucket(E.Key);
+                E.Next = FreeHead;
+                FreeHead = EntryIdx;
+                --NumEntries;
+                ++NumRemoved;
+            }
+            else
+            {
+                Schedule(EntryIdx, E.Value.LastTimeHeard);
+            }
+        }
+
+        return NumRemoved;
+    }
+
+private:
+
+    struct Entry
+    {
+        unsigned long long  Key;
+        /** Next entry in the same wheel slot, or in the free list */
+        uint32_t            Next;
+        ValueType           Value;
+    };
+
+    struct Bucket
+    {
+        unsigned long long  Key;
+        uint32_t            EntryIdx;
+    };
+
+    /** Ids are random in production, but load generators use sequential ones - mix them anyway (splitmix64 finalizer). */
+    static size_t Hash(unsigned long long Key)
+    {
+        Key ^= Key >> 30;
+        Key *= 0xbf58476d1ce4e5b9ULL;
+        Key ^= Key >> 27;
+        Key *= 0x94d049bb133111ebULL;
+        Key ^= Key >> 31;
+        return (size_t)Key;
+    }
+
+    /**
+     * Puts the entry into the slot of the tick at which it would time out, if not heard from after LastTimeHeard.
+     * If expiry lags behind, that tick can be more than a wheel turn away; the entry is then visited early and
+     * rescheduled again, but never lands back in the slot being processed.
+     */
+    void Schedule(uint32_t EntryIdx, unsigned long long LastTimeHeard)
+    {
+        unsigned long long DueTick = (LastTimeHeard + TimeoutNs) / TickNs + 1;
+        if (DueTick <= CurrentTick)
+        {
+            DueTick = CurrentTick + 1;
+        }
+        else if (DueTick >= CurrentTick + SlotHeads.size())
+        {
+            DueTick = CurrentTick + SlotHeads.size() - 1;
+        }
+
+        uint32_t& Head = SlotHeads[DueTick % SlotHeads.size()];
+        Entries[EntryIdx].Next = Head;
+        Head = EntryIdx;
+    }
+
+    void InsertBucket(unsigned long long Key, uint32_t EntryIdx)
+    {
+        size_t BucketIdx = Hash(Key) & BucketMask;
+        while (Buckets[BucketIdx].EntryIdx != InvalidIndex)
+        {
+            BucketIdx = (BucketIdx + 1) & BucketMask;
+        }
+        Buckets[BucketIdx].Key = Key;
+        Buckets[BucketIdx].EntryIdx = EntryIdx;
+    }
+
+    /** Backward shift deletion, keeps probe sequences intact without tombstones. */
+    void RemoveBucket(unsigned long long Key)
+    {
+        size_t BucketIdx = Hash(Key) & BucketMask;
+        while (Buckets[BucketIdx].Key != Key || Buckets[BucketIdx].EntryIdx == InvalidIndex)
+        {
+            BucketIdx = (BucketIdx + 1) & BucketMask;
+        }
+
+        for (size_t NextIdx = (BucketIdx + 1) & BucketMask; Buckets[NextIdx].EntryIdx != InvalidIndex; NextIdx = (NextIdx + 1) & BucketMask)
+        {
+            // the next bucket can fill the hole only if its home position is not between the hole and itself
+            size_t HomeIdx = Hash(Buckets[NextIdx].Key) & BucketMask;
+            if (((NextIdx - HomeIdx) & BucketMask) >= ((NextIdx - BucketIdx) & BucketMask))
+            {
+                Buckets[BucketIdx] = Buckets[NextIdx];
+                BucketIdx = NextIdx;
+            }
+        }
+
+        Buckets[BucketIdx].EntryIdx = InvalidIndex;
+    }
+
+    /** Rehashes into a power of two bucket array that keeps NumClients at most half full. */
+    void Resize(size_t NumClients)
+    {
+        size_t NumBuckets = 16;
+        while (NumBuckets < NumClients * 2)
+        {
+            NumBuckets *= 2;
+        }
+
+        std::vector<Bucket> OldBuckets;
+        OldBuckets.swap(Buckets);
+
+        Bucket Empty;
+        Empty.Key = 0;
+        Empty.EntryIdx = InvalidIndex;
+        Buckets.assign(NumBuckets, Empty);
+        BucketMask = NumBuckets - 1;
+
+        for (const Bucket& B : OldBuckets)
+        {
+            if (B.EntryIdx != InvalidIndex)
+            {
+                InsertBucket(B.Key, B.EntryIdx);
+            }
+        }
+    }
+
+    std::vector<Bucket>     Buckets;
+    size_t                  BucketMask;
+
+    std::vector<Entry>      Entries;
+
+    /** Head of each wheel slot list */
+    std::vector<uint32_t>   SlotHeads;
+
+    unsigned long long      TimeoutNs;
+    unsigned long long      TickNs;
+    size_t                  NumEntries;
+    uint32_t                FreeHead;
+
+    /** Tick whose slot is being expired, all earlier ones are done */
+    unsigned long long      CurrentTick;
+};
+
+template <typename ValueType>
+const uint32_t ClientTable<ValueType>::InvalidIndex;
@@ -0,0 +1,240 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "bench_core.h"
+#include "client_table.h"
+
+/**
+ * Compares the server's client table against the std::map it replaced. Each client sends once per
+ * simulated 30 Hz frame, in a fixed shuffled order; a tenth of them go silent after a few frames and
+ * have to be expired. The map is swept in full once per timeout, like the old book keeping did, while
+ * the table is expired incrementally every receive batch.
+ */
+
+/** Simulated frame duration - each client sends once per frame */
+#define FRAME_NS            (1000000000ULL / 30ULL)
+
+/** Clients silent for this many frames are expired */
+#define TIMEOUT_FRAMES      4
+
+/** Frame after which the clients that go silent stop sending */
+#define SILENT_AFTER_FRAME  2
+
+/** Packets per receive batch, the table is expired once per batch (as the server does per loop iteration) */
+#define BATCH_PACKETS       64
+
+/** Packets to simulate at least, so small tables run long enough to be timed */
+#define MIN_PACKETS         10000000ULL
+
+/** Same layout as the server's Client */
+struct BenchClient
+{
+    unsigned long long      UniqueId;
+    unsigned long long      LastTimeHeard;
+    unsigned long long      LastPacketTimestamp;
+};
+
+/** Deterministic id source (splitmix64), unique ids are random 64-bit numbers in production too */
+unsigned long long NextRandom(unsigned long long* State)
+{
+    unsigned long long Z = (*State += 0x9e3779b97f4a7c15ULL);
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+    return Z ^ (Z >> 31);
+}
+
+struct BenchResult
+{
+    double NsPerPacket;
+    double MaxPauseUs;
+    double TotalExpireMs;
+    size_t Remaining;
+};
+
+/** Sends NumFrames frames of packets from Ids, updating the table the same way the server does */
+template <typename UpdateFunc, typename ExpireFunc>
+BenchResult RunBenchmark(const std::vector<unsigned long long>& Ids, unsigned long long NumFrames, UpdateFunc Update, ExpireFunc Expire, unsigned long long ExpireEveryPackets)
+{
+    BenchResult Result;
+    memset(&Result, 0, sizeof(Result));
+
+    unsigned long long ExpireNs = 0, MaxExpireNs = 0, NumPackets = 0;
+    unsigned long long NsPerPacket = FRAME_NS / Ids.size();
+    unsigned long long SimulatedNs = FRAME_NS;
+    size_t NumSilent = Ids.size() / 10;
+
+    unsigned long long StartNs = GetTimeInNs();
+    for (unsigned long long Frame = 0; Frame < NumFrames; ++Frame)
+    {
+        // the first tenth of the clients go silent after a few frames
+        size_t First = (Frame > SILENT_AFTER_FRAME) ? NumSilent : 0;
+        for (size_t Idx = First; Idx < Ids.size(); ++Idx)
+        {
+            Update(Ids[Idx], SimulatedNs);
+            SimulatedNs += NsPerPacket;
+
+            if (++NumPackets % ExpireEveryPackets == 0)
+            {
+                unsigned long long ExpireStartNs = GetTimeInNs();
+                Expire(SimulatedNs);
+                unsigned long long PauseNs = GetTimeInNs() - ExpireStartNs;
+
+                ExpireNs += PauseNs;
+                MaxExpireNs = std::max(MaxExpireNs, PauseNs);
+            }
+        }
+    }
+    unsigned long long TotalNs = GetTimeInNs() - StartNs;
+
+    Result.NsPerPacket = (double)(TotalNs - ExpireNs) / (double)NumPackets;
+    Result.MaxPauseUs = (double)MaxExpireNs / 1000.0;
+    Result.TotalExpireMs = (double)ExpireNs / 1000000.0;
+    return Result;
+}
+
+void PrintResult(const char* Name, size_t NumClients, const BenchResult& Result)
+{
+    printf("Clients, %zu, Table, %s, NsPerPacket, %.1f, MaxExpirePause(us), %.1f, TotalExpire(ms), %.1f, Remaining, %zu\n",
+        NumClients, Name, Result.NsPerPacket, Result.MaxPauseUs, Result.TotalExpireMs, Result.Remaining);
+}
+
+void Benchmark(size_t NumClients)
+{
+    std::vector<unsigned long long> Ids(NumClients);
+    unsigned long long RandomState = 0x1234567ULL + NumClients;
+    for (size_t Idx = 0; Idx < NumClients; ++Idx)
+    {
+        Ids[Idx] = NextRandom(&RandomState);
+    }
+
+    unsigned long long NumFrames = std::max((unsigned long long)(TIMEOUT_FRAMES * 3), MIN_PACKETS / NumClients);
+    unsigned long long TimeoutNs = TIMEOUT_FRAMES * FRAME_NS;
+
+    // std::map, swept once per timeout like the old DoBookkeeping()
+    {
+        std::map<unsigned long long, BenchClient> Clients;
+        unsigned long long PacketsPerSweep = (unsigned long long)NumClients * TIMEOUT_FRAMES;
+
+        BenchResult Result = RunBenchmark(Ids, NumFrames,
+            [&](unsigned long long UniqueId, unsigned long long Timestamp)
+            {
+                std::map<unsigned long long, BenchClient>::iterator ClientIter = Clients.find(UniqueId);
+                if (ClientIter == Clients.end())
+                {
+                    BenchClient New;
+                    New.UniqueId = UniqueId;
+                    New.LastTimeHeard = Timestamp;
+                    New.LastPacketTimestamp = Timestamp;
+                    Clients.insert(std::map<unsigned long long, BenchClient>::value_type(UniqueId, New));
+                }
+                else
+                {
+                    ClientIter->second.LastTimeHeard = Timestamp;
+                    ClientIter->second.LastPacketTimestamp = Timestamp;
+                }
+            },
+            [&](unsigned long long CurrentTime)
+            {
+                for (std::map<unsigned long long, BenchClient>::iterator It = Clients.begin(); It != Clients.end();)
+                {
+                    if (CurrentTime - It->second.LastTimeHeard >= TimeoutNs)
+                    {
+                        Clients.erase(It++);
+                    }
+                    else
+                    {
+                        ++It;
+                    }
+                }
+            },
+            PacketsPerSweep);
+
+        Result.Remaining = Clients.size();
+        PrintResult("std::map", NumClients, Result);
+    }
+
+    // flat table with the expiry wheel
+    {
+        ClientTable<BenchClient> Clients(NumClients, TimeoutNs);
+
+        BenchResult Result = RunBenchmark(Ids, NumFrames,
+            [&](unsigned long long UniqueId, unsigned long long Timestamp)
+            {
+                BenchClient* Existing = Clients.Find(UniqueId);
+                if (Existing == nullptr)
+                {
+                    BenchClient* New = Clients.Add(UniqueId, Timestamp);
+                    New->UniqueId = UniqueId;
+                    New->LastPacketTimestamp = Timestamp;
+                }
+                else
+                {
+                    Existing->LastTimeHeard = Timestamp;
+                    Existing->LastPacketTimestamp = Timestamp;
+                }
+            },
+            [&](unsigned long long CurrentTime)
+            {
+                Clients.Expire(CurrentTime);
+            },
+            BATCH_PACKETS);
+
+        Result.Remaining = Clients.Size();
+        PrintResult("ClientTable", NumClients, Result);
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    printf("Client table benchmark, %d%% of clients go silent and are expired after %d frames.\n", 10, TIMEOUT_FRAMES);
+    printf("Usage: %s [num_clients ...] (default 1000 100000 1000000)\n", argv[0]);
+
+    if (argc > 1)
+    {
+        for (int Idx = 1; Idx < argc; ++Idx)
+        {
+            Benchmark(strtoull(argv[Idx], nullptr, 10));
+        }
+    }
+    else
+    {
+        Benchmark(1000);
+        Benchmark(100000);
+        Benchmark(1000000);
+    }
+
+    return 0;
+}
@@ -35,200 +35,697 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
 #include <map>
+#include <string>
+#include <vector>
+#include "bench_core.h"
+#include "series.h"
+#include "ds_protocol.h"
+#include "client_table.h"
+#include "uring_receiver.h"
+#include "runtime_config.h"
 
 /** Port to listen on */
 #define SERVER_PORT         56636
 
-/** Book keeping interval in seconds */
+/** Default book keeping interval in seconds */
 #define BOOK_KEEP_INTERVAL  30ULL
 
-/** Internal value, easier to use */
-#define BOOK_KEEP_INTERVAL_NS       BOOK_KEEP_INTERVAL * 1000000000ULL
+/** Clients not heard from for this long are dropped. Independent of the book keeping interval, which can be much shorter */
+#define CLIENT_TIMEOUT_NS   (30ULL * 1000000000ULL)
 
-/* Clock ID to use */
-clockid_t ClockSource = CLOCK_MONOTONIC_RAW;
+/** Largest number of datagrams drained by a single recvmmsg() call */
+#define MAX_RECV_BATCH      1024
 
-/** Gets current time in ns */
-unsigned long long GetTimeInNs()
+/** A frame number this far behind the expected one means the client restarted, not that the packet was reordered */
+#define REORDER_WINDOW      1024ULL
+
+/** Number of worst clients printed each book keeping interval by default */
+#define DEFAULT_TOP_OFFENDERS   5
+
+/** How often the reporter checks whether a receiver has handed its period over */
+#define HANDOVER_POLL_NS    100000ULL
+
+/** Receivers that block still wake up this often, to expire clients and hand periods over */
+#define WAIT_TIMER_INTERVAL_NS  10000000ULL
+
+/** Default time the adaptive strategy keeps polling after the last datagram, and how long busy polling receives poll the device */
+#define DEFAULT_SPIN_US     50
+
+struct Client
 {
-    struct timespec TimeSpec;
-    
-    if (clock_gettime(ClockSource, &TimeSpec) == -1)
-    {
-        fprintf(stderr, "Cannot use clock source %d\n", ClockSource);
-        exit(1);
-        return 0;
-    };
+    /** Unique Id */
+    unsigned long long      UniqueId;
+
+    /** Time in nanoseconds we last time heard from them. */
+    unsigned long long      LastTimeHeard;
+
+    /** Receive timestamp of their last packet, used for packet intervals. Same as LastTimeHeard unless kernel timestamps are used. */
+    unsigned long long      LastPacketTimestamp;
+
+    /** Frame number we expect next, one past the highest seen */
+    unsigned long long      NextFrameNumber;
+
+    /** Frame numbers skipped over, and packets that arrived after a later one */
+    unsigned long long      NumMissing;
+    unsigned long long      NumReordered;
+
+    /** This client's own frame times and packet intervals in the current period, ms */
+    StabilityParams         FrameTimes;
+    StabilityParams         PacketTimes;
+
+    /** Host the client said it runs on, empty for older clients */
+    char                    HostTag[MESSAGE_HOST_TAG_SIZE];
+};
+
+/** A client's stats as collected at the end of a period */
+struct ClientSummary
+{
+    unsigned long long      UniqueId;
+    char                    HostTag[MESSAGE_HOST_TAG_SIZE];
+    StabilityParams         FrameTimes;
+    StabilityParams         PacketTimes;
+    unsigned long long      NumLost;
+};
 
-    return (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+/** Stats of all clients on one host */
+struct HostSummary
+{
+    size_t                  NumClients;
+    StabilityParams         FrameTimes;
+    StabilityParams         PacketTimes;
+    unsigned long long      NumLost;
+};
+
+/** Packet counts of a receiver. Missing packets that show up later count as reordered, lost is the difference */
+struct PacketCounts
+{
+    unsigned long long      NumReceived;
+    unsigned long long      NumMissing;
+    unsigned long long      NumReordered;
+    unsigned long long      NumEchoed;
+    unsigned long long      NumMalformed;
+};
+
+/** How a receiver waits for datagrams */
+enum WaitStrategy
+{
+    /** Poll the non-blocking socket in a tight loop, burns a whole core */
+    Wait_Spin,
+    /**
+     * Blocking receives with SO_BUSY_POLL: the kernel polls the device queue for SpinUs before putting the thread
+     * to sleep, and SO_RCVTIMEO wakes it up to book keep. Only NAPI devices are polled, not loopback. Non-blocking
+     * receives would only get a single device poll each, so this strategy is the one that blocks.
+     */
+    Wait_BusyPoll,
+    /** Block in epoll_wait() until a datagram arrives (or the timer fires) */
+    Wait_Epoll,
+    /** Poll for SpinUs after the last datagram, then block like Wait_Epoll */
+    Wait_Adaptive,
+};
+
+const char* WaitStrategyName(WaitStrategy Strategy)
+{
+    switch (Strategy)
+    {
+        case Wait_Spin:         return "spin";
+        case Wait_BusyPoll:     return "busypoll";
+        case Wait_Epoll:        return "epoll";
+        case Wait_Adaptive:     return "adaptive";
+    }
+    return "unknown";
 }
 
-/** Message format; needs to stay in sync with the client */
-#pragma pack(push, 1)
-struct Message
+/** What waiting for datagrams cost during a period */
+struct WaitStats
+{
+    /** CPU time the receive threads used */
+    unsigned long long      CpuTimeNs;
+    /** Times a receiver blocked, and receives that came back empty */
+    unsigned long long      NumWaits;
+    unsigned long long      NumEmptyPolls;
+
+    /** io_uring only: times the provided buffers ran out (datagrams wait in the socket, lag grows), and the receive was re-armed */
+    unsigned long long      NumBufferStalls;
+    unsigned long long      NumRearms;
+
+    /** Kernel receive to read of the first datagram after blocking, microseconds. Only with kernel timestamps. */
+    StabilityParams         WakeLatency;
+    LatencyHistogram        WakeLatencyHistogram;
+};
+
+/** Everything measured during one book keeping period */
+struct PeriodStats
+{
+    StabilityParams         PacketTimes;
+    StabilityParams         FrameTimes;
+    StabilityParams         WorkTimes;
+
+    /** Time between the kernel receiving a packet and us reading it, microseconds. Only with kernel timestamps. */
+    StabilityParams         DeliveryLag;
+
+    /** Same series as above, as histograms of nanoseconds */
+    LatencyHistogram        PacketTimesHistogram;
+    LatencyHistogram        FrameTimesHistogram;
+    LatencyHistogram        WorkTimesHistogram;
+    LatencyHistogram        DeliveryLagHistogram;
+
+    PacketCounts            Packets;
+
+    WaitStats               Wait;
+
+    /** Length of the period, set by the reporter - it adds up when periods are merged */
+    unsigned long long      PeriodNs;
+
+    /** Clients in the table at the end of the period */
+    size_t                  NumClients;
+
+    /** Per-client stats of the period, only collected when outliers are printed */
+    std::vector<ClientSummary> Clients;
+};
+
+/** How datagrams are pulled off the socket */
+enum ReceiveBackend
+{
+    /** One recvfrom() per datagram */
+    Backend_RecvFrom,
+    /** Up to BatchSize datagrams per recvmmsg() */
+    Backend_RecvMMsg,
+    /** Multishot recvmsg on io_uring into provided buffers, drained up to BatchSize datagrams at a time */
+    Backend_IoUring
+};
+
+/** Provided buffers per io_uring receiver, the kernel leaves datagrams in the socket buffer while all of them wait to be drained */
+#define URING_NUM_BUFFERS   4096
+
+/** Number of clients preallocated for by default, split between receivers */
+#define DEFAULT_MAX_CLIENTS 65536
+
+/** Largest number of clients a receiver looks at for expiry per loop iteration */
+#define MAX_EXPIRE_VISITS   256
+
+/**
+ * State of one receive thread. Each thread owns its own SO_REUSEPORT socket, and since the kernel
+ * hashes a client's address to the same socket every time, each thread also owns its share of clients.
+ *
+ * Stats are double buffered: the receiver fills Periods[Current] while the reporter reads and resets the other
+ * one. To end a period the reporter flips Current; the receiver notices at the top of its loop, finishes off
+ * the period it was filling (per-client stats) and bumps NumHandedOver. Neither side ever waits on a lock, and the
+ * receive path does no I/O.
+ */
+struct Receiver
 {
-        /** Unique Id of this client */
-        unsigned long long UniqueId;
-        /** Actual frame time in nanoseconds */
-        unsigned long long FrameTimeNs;
-        /** Number of the frame (and message, because it is sent once per frame). */
-        unsigned long long FrameNumber;
+    /** Index of this receiver */
+    int                     Index;
+
+    /** Socket this receiver drains */
+    int                     Socket;
+
+    /** Ring the socket is received through, with the io_uring backend */
+    UringReceiver           Uring;
+
+    /** Only touched by the receive thread. Clients are dropped once we haven't heard from them for CLIENT_TIMEOUT_NS */
+    ClientTable<Client>     Clients;
+
+    /** Period the receiver should be filling, written by the reporter */
+    int                     Current;
+
+    /** Periods the receiver has finished with, written by the receiver */
+    unsigned long long      NumHandedOver;
+
+    /** Thread CPU time and io_uring counters at the start of the period, only used by the receiver */
+    unsigned long long      PeriodCpuTimeNs;
+    unsigned long long      PeriodBufferStalls;
+    unsigned long long      PeriodRearms;
+
+    PeriodStats             Periods[2];
+
+    Receiver(size_t MaxClients)
+        : Clients(MaxClients, CLIENT_TIMEOUT_NS)
+        , Current(0)
+        , NumHandedOver(0)
+        , PeriodCpuTimeNs(0)
+        , PeriodBufferStalls(0)
+        , PeriodRearms(0)
+    {
+    }
 };
-#pragma pack(pop)
 
+/** Receive settings, set from the command line */
+ReceiveBackend Backend = Backend_RecvFrom;
+int NumReceivers = 1;
+int BatchSize = 64;
+int FirstCpu = -1;
+int RecvBufferSize = 0;
+size_t MaxClients = DEFAULT_MAX_CLIENTS;
+bool KernelTimestamps = false;
+size_t NumTopOffenders = DEFAULT_TOP_OFFENDERS;
+unsigned long long BookKeepIntervalNs = BOOK_KEEP_INTERVAL * 1000000000ULL;
+WaitStrategy Strategy = Wait_Spin;
+unsigned long long SpinUs = DEFAULT_SPIN_US;
+const char* SeriesPath = nullptr;
+// timer slack, scheduling policy and memory settings, applied by main() and each receiver
+RuntimeConfig Runtime;
 
-struct StabilityParams
+/** Series written to SeriesPath each period, in the order of the Series_ indices */
+enum ServerSeries
 {
-    double NumObservations;
-    double Mean, Mean2;
-    double Min, Max;
+    Series_PacketTimes,
+    Series_FrameTimes,
+    Series_WorkTimes,
+    Series_DeliveryLag,
+    Series_WakeLatency,
+    Series_Count
 };
 
-/** Updates state of an online std dev calculation. */
-void UpdateObservation(struct StabilityParams* Params, double Value)
+const SeriesInfo ServerSeriesInfo[Series_Count] =
 {
-    double Delta;
+    { "PacketTimes", "ms", 1000000.0 },
+    { "FrameTimes", "ms", 1000000.0 },
+    { "WorkTimes", "ms", 1000000.0 },
+    { "DeliveryLag", "us", 1000.0 },
+    { "WakeLatency", "us", 1000.0 },
+};
+
+SeriesWriter Series;
 
-    ++Params->NumObservations;
+std::vector<Receiver*> Receivers;
 
-    Delta = Value - Params->Mean;
+size_t AllTimeClients = 0;
+
+/**
+ * Must only be called from the receive thread. Timestamp is our clock at reception, PacketTimestamp is when
+ * the packet arrived - either the same, or the kernel receive time (CLOCK_REALTIME) with kernel timestamps.
+ */
+void UpdateClient(Receiver* Recv, PeriodStats* Stats, const Message& Msg, unsigned long long Timestamp, unsigned long long PacketTimestamp)
+{
+    Client* Existing = Recv->Clients.Find(Msg.UniqueId);
+    Client* Sender = Existing;
 
-    Params->Mean += Delta / Params->NumObservations;
-    Params->Mean2 += Delta * (Value - Params->Mean);
+    ++Stats->Packets.NumReceived;
 
-    if (Params->NumObservations > 1)
+    if (Existing == nullptr || Msg.FrameNumber + REORDER_WINDOW < Existing->NextFrameNumber)
     {
-        Params->Min = (Value < Params->Min) ? Value : Params->Min;
-        Params->Max = (Value > Params->Max) ? Value : Params->Max;
+        // new (or restarted) client, frames it sent before we knew it do not count as lost
+        Client* New = (Existing != nullptr) ? Existing : Recv->Clients.Add(Msg.UniqueId, Timestamp);
+        New->UniqueId = Msg.UniqueId;
+        New->LastTimeHeard = Timestamp;
+        New->LastPacketTimestamp = PacketTimestamp;
+        New->NextFrameNumber = Msg.FrameNumber + 1;
+        memcpy(New->HostTag, Msg.HostTag, sizeof(New->HostTag));
+        Sender = New;
+    }
+    else if (Msg.FrameNumber < Existing->NextFrameNumber)
+    {
+        // arrived after a later frame, its interval would be meaningless
+        Existing->LastTimeHeard = Timestamp;
+        ++Existing->NumReordered;
+        ++Stats->Packets.NumReordered;
     }
     else
     {
-        Params->Min = Value;
-        Params->Max = Value;
+        unsigned long long Delta = PacketTimestamp - Existing->LastPacketTimestamp;
+        unsigned long long NumMissing = Msg.FrameNumber - Existing->NextFrameNumber;
+        Existing->LastTimeHeard = Timestamp;
+        Existing->LastPacketTimestamp = PacketTimestamp;
+        Existing->NextFrameNumber = Msg.FrameNumber + 1;
+
+        if (NumMissing == 0)
+        {
+            double DeltaMs = (double)(Delta) / 1000000.0;
+            UpdateObservation(&Existing->PacketTimes, DeltaMs);
+            UpdateObservation(&Stats->PacketTimes, DeltaMs);
+            UpdateHistogram(&Stats->PacketTimesHistogram, Delta);
+        }
+        else
+        {
+            // an interval spanning lost packets is the network's doing, not a stall - keep it out of PacketTimes
+            Existing->NumMissing += NumMissing;
+            Stats->Packets.NumMissing += NumMissing;
+        }
+    }
+
+    double FrameTimeMs = (double)(Msg.FrameTimeNs) / 1000000.0;
+    UpdateObservation(&Sender->FrameTimes, FrameTimeMs);
+    UpdateObservation(&Stats->FrameTimes, FrameTimeMs);
+    UpdateHistogram(&Stats->FrameTimesHistogram, Msg.FrameTimeNs);
+
+    // only newer clients report how much of the frame was work
+    if (Msg.Header.Version >= 2)
+    {
+        UpdateObservation(&Stats->WorkTimes, (double)(Msg.WorkTimeNs) / 1000000.0);
+        UpdateHistogram(&Stats->WorkTimesHistogram, Msg.WorkTimeNs);
     }
 }
 
-/** Calculates values and prints them. */
-void PrintValues(struct StabilityParams* Params)
+/** Adds Other's counts to Counts. */
+void MergePacketCounts(PacketCounts* Counts, const PacketCounts* Other)
 {
-    double Variance = 0, StandardDeviation = 0, RelativeStdDev = 0;
+    Counts->NumReceived += Other->NumReceived;
+    Counts->NumMissing += Other->NumMissing;
+    Counts->NumReordered += Other->NumReordered;
+    Counts->NumEchoed += Other->NumEchoed;
+    Counts->NumMalformed += Other->NumMalformed;
+}
 
-    if (Params->NumObservations > 1)
-    {
-        Variance = Params->Mean2 / (Params->NumObservations - 1);
-        StandardDeviation = sqrt( Variance );
+/** Prints packet counts. Packets reported missing that arrived later (reordered) are not lost. */
+void PrintPacketCounts(const PacketCounts* Counts)
+{
+    unsigned long long NumLost = (Counts->NumMissing > Counts->NumReordered) ? Counts->NumMissing - Counts->NumReordered : 0;
+    unsigned long long NumSent = Counts->NumReceived + NumLost;
+
+    printf("Received, %llu, Lost, %llu, Reordered, %llu, Loss(%%), %.3f, Echoed, %llu, Malformed, %llu",
+        Counts->NumReceived, NumLost, Counts->NumReordered, NumSent ? 100.0 * (double)NumLost / (double)NumSent : 0.0,
+        Counts->NumEchoed, Counts->NumMalformed);
+}
 
-        if (Params->Mean * Params->Mean > 0.0001)
+/** Starts the period over, keeping the memory of the client list. */
+void ResetPeriodStats(PeriodStats* Stats)
+{
+    memset(&Stats->PacketTimes, 0, sizeof(Stats->PacketTimes));
+    memset(&Stats->FrameTimes, 0, sizeof(Stats->FrameTimes));
+    memset(&Stats->WorkTimes, 0, sizeof(Stats->WorkTimes));
+    memset(&Stats->DeliveryLag, 0, sizeof(Stats->DeliveryLag));
+    memset(&Stats->PacketTimesHistogram, 0, sizeof(Stats->PacketTimesHistogram));
+    memset(&Stats->FrameTimesHistogram, 0, sizeof(Stats->FrameTimesHistogram));
+    memset(&Stats->WorkTimesHistogram, 0, sizeof(Stats->WorkTimesHistogram));
+    memset(&Stats->DeliveryLagHistogram, 0, sizeof(Stats->DeliveryLagHistogram));
+    memset(&Stats->Packets, 0, sizeof(Stats->Packets));
+    memset(&Stats->Wait, 0, sizeof(Stats->Wait));
+    Stats->PeriodNs = 0;
+    Stats->NumClients = 0;
+    Stats->Clients.clear();
+}
+
+/** Adds Other's stats to Stats, except for the per-client ones. */
+void MergePeriodStats(PeriodStats* Stats, const PeriodStats* Other)
+{
+    MergeObservations(&Stats->PacketTimes, &Other->PacketTimes);
+    MergeObservations(&Stats->FrameTimes, &Other->FrameTimes);
+    MergeObservations(&Stats->WorkTimes, &Other->WorkTimes);
+    MergeObservations(&Stats->DeliveryLag, &Other->DeliveryLag);
+    MergeHistogram(&Stats->PacketTimesHistogram, &Other->PacketTimesHistogram);
+    MergeHistogram(&Stats->FrameTimesHistogram, &Other->FrameTimesHistogram);
+    MergeHistogram(&Stats->WorkTimesHistogram, &Other->WorkTimesHistogram);
+    MergeHistogram(&Stats->DeliveryLagHistogram, &Other->DeliveryLagHistogram);
+    MergePacketCounts(&Stats->Packets, &Other->Packets);
+    Stats->Wait.CpuTimeNs += Other->Wait.CpuTimeNs;
+    Stats->Wait.NumWaits += Other->Wait.NumWaits;
+    Stats->Wait.NumEmptyPolls += Other->Wait.NumEmptyPolls;
+    Stats->Wait.NumBufferStalls += Other->Wait.NumBufferStalls;
+    Stats->Wait.NumRearms += Other->Wait.NumRearms;
+    MergeObservations(&Stats->Wait.WakeLatency, &Other->Wait.WakeLatency);
+    MergeHistogram(&Stats->Wait.WakeLatencyHistogram, &Other->Wait.WakeLatencyHistogram);
+    Stats->PeriodNs += Other->PeriodNs;
+    Stats->NumClients += Other->NumClients;
+}
+
+/** Returns the standard deviation of the observations, 0 if there are too few. */
+double StandardDeviation(const StabilityParams* Params)
+{
+    return (Params->NumObservations > 1) ? sqrt(Params->Mean2 / (Params->NumObservations - 1)) : 0.0;
+}
+
+/** Collects the receiver's per-client stats into Summaries and starts them over. Must only be called from the receive thread. */
+void CollectClientSummaries(Receiver* Recv, std::vector<ClientSummary>& Summaries)
+{
+    Recv->Clients.ForEach([&Summaries](Client& C)
+    {
+        if (C.FrameTimes.NumObservations > 0)
         {
-                RelativeStdDev = 100.0 * StandardDeviation / Params->Mean;
+            ClientSummary Summary;
+            Summary.UniqueId = C.UniqueId;
+            memcpy(Summary.HostTag, C.HostTag, sizeof(Summary.HostTag));
+            Summary.FrameTimes = C.FrameTimes;
+            Summary.PacketTimes = C.PacketTimes;
+            Summary.NumLost = (C.NumMissing > C.NumReordered) ? C.NumMissing - C.NumReordered : 0;
+            Summaries.push_back(Summary);
         }
-    }
 
-    printf("Min(ms), %.1f, Max(ms), %.1f, Mean(ms), %.1f, StdDev(ms), %.1f, RelStdDev(%%), %.1f, DataSize, %.f", 
-        Params->Min, Params->Max, Params->Mean, StandardDeviation, RelativeStdDev, Params->NumObservations);
+        memset(&C.FrameTimes, 0, sizeof(C.FrameTimes));
+        memset(&C.PacketTimes, 0, sizeof(C.PacketTimes));
+    });
 }
 
-struct Client
+/** Finishes off the period the receiver was filling and lets the reporter have it. Called from the receive thread. */
+void HandOverPeriod(Receiver* Recv, PeriodStats* Stats)
 {
-    /** Unique Id */
-    unsigned long long      UniqueId;
+    if (NumTopOffenders > 0)
+    {
+        CollectClientSummaries(Recv, Stats->Clients);
+    }
+    Stats->NumClients = Recv->Clients.Size();
 
-    /** Time in nanoseconds we last time heard from them. */
-    unsigned long long      LastTimeHeard;
-};
+    unsigned long long CpuTimeNs = GetClockInNs(CLOCK_THREAD_CPUTIME_ID);
+    Stats->Wait.CpuTimeNs = CpuTimeNs - Recv->PeriodCpuTimeNs;
+    Recv->PeriodCpuTimeNs = CpuTimeNs;
 
-std::map<unsigned long long, Client> Clients;
+    Stats->Wait.NumBufferStalls = Recv->Uring.NumBufferStalls - Recv->PeriodBufferStalls;
+    Stats->Wait.NumRearms = Recv->Uring.NumRearms - Recv->PeriodRearms;
+    Recv->PeriodBufferStalls = Recv->Uring.NumBufferStalls;
+    Recv->PeriodRearms = Recv->Uring.NumRearms;
 
-StabilityParams PacketTimes_AllTime;
-StabilityParams PacketTimes_SinceLastBookkeep;
-StabilityParams FrameTimes_AllTime;
-StabilityParams FrameTimes_SinceLastBookkeep;
-size_t AllTimeClients = 0;
+    __atomic_store_n(&Recv->NumHandedOver, Recv->NumHandedOver + 1, __ATOMIC_RELEASE);
+}
+
+/** Prints a client's or host's stats, after a caller-supplied label. */
+void PrintClientStats(const StabilityParams* FrameTimes, const StabilityParams* PacketTimes, unsigned long long NumLost)
+{
+    printf("FrameTimes, ");
+    PrintValues(FrameTimes, "ms");
+    printf(", PacketTimes, ");
+    PrintValues(PacketTimes, "ms");
+    printf(", PacketJitter(ms), %.3f, Lost, %llu\n", StandardDeviation(PacketTimes), NumLost);
+}
 
-void UpdateClient(const Message& Msg)
+/**
+ * Prints the NumTopOffenders clients with the longest frames and those with the most jitter in their
+ * packet intervals, then the clients' stats per host. A single bad client vanishes in the totals, here it stands out.
+ */
+void PrintClientOutliers(std::vector<ClientSummary>& Summaries)
 {
-    unsigned long long Timestamp = GetTimeInNs();
-    std::map<unsigned long long, Client>::iterator ClientIter = Clients.find(Msg.UniqueId);
+    size_t NumTop = std::min(NumTopOffenders, Summaries.size());
 
-    if (ClientIter == Clients.end())
+    std::partial_sort(Summaries.begin(), Summaries.begin() + NumTop, Summaries.end(),
+        [](const ClientSummary& A, const ClientSummary& B) { return A.FrameTimes.Max > B.FrameTimes.Max; });
+    for (size_t Idx = 0; Idx < NumTop; ++Idx)
     {
-        // new client
-        Client New;
-        New.UniqueId = Msg.UniqueId;
-        New.LastTimeHeard = Timestamp;
-
-        Clients.insert(std::map<unsigned long long, Client>::value_type(Msg.UniqueId, New));
+        printf("Offender, ByFrameTime, Rank, %zu, UniqueId, 0x%llx, Host, %s, ", Idx + 1, Summaries[Idx].UniqueId, Summaries[Idx].HostTag[0] ? Summaries[Idx].HostTag : "-");
+        PrintClientStats(&Summaries[Idx].FrameTimes, &Summaries[Idx].PacketTimes, Summaries[Idx].NumLost);
     }
-    else
+
+    std::partial_sort(Summaries.begin(), Summaries.begin() + NumTop, Summaries.end(),
+        [](const ClientSummary& A, const ClientSummary& B) { return StandardDeviation(&A.PacketTimes) > StandardDeviation(&B.PacketTimes); });
+    for (size_t Idx = 0; Idx < NumTop; ++Idx)
     {
-        unsigned long long Delta = Timestamp - ClientIter->second.LastTimeHeard;
-        ClientIter->second.LastTimeHeard = Timestamp;
+        printf("Offender, ByJitter, Rank, %zu, UniqueId, 0x%llx, Host, %s, ", Idx + 1, Summaries[Idx].UniqueId, Summaries[Idx].HostTag[0] ? Summaries[Idx].HostTag : "-");
+        PrintClientStats(&Summaries[Idx].FrameTimes, &Summaries[Idx].PacketTimes, Summaries[Idx].NumLost);
+    }
 
-        double DeltaMs = (double)(Delta) / 1000000.0;
-        UpdateObservation(&PacketTimes_AllTime, DeltaMs);
-        UpdateObservation(&PacketTimes_SinceLastBookkeep, DeltaMs);
+    std::map<std::string, HostSummary> Hosts;
+    for (const ClientSummary& Summary : Summaries)
+    {
+        HostSummary& Host = Hosts[Summary.HostTag[0] ? Summary.HostTag : "-"];
+        ++Host.NumClients;
+        MergeObservations(&Host.FrameTimes, &Summary.FrameTimes);
+        MergeObservations(&Host.PacketTimes, &Summary.PacketTimes);
+        Host.NumLost += Summary.NumLost;
     }
 
-    double FrameTimeMs = (double)(Msg.FrameTimeNs) / 1000000.0;
-    UpdateObservation(&FrameTimes_AllTime, FrameTimeMs);
-    UpdateObservation(&FrameTimes_SinceLastBookkeep, FrameTimeMs);
+    for (const auto& Entry : Hosts)
+    {
+        printf("Host, %s, Clients, %zu, ", Entry.first.c_str(), Entry.second.NumClients);
+        PrintClientStats(&Entry.second.FrameTimes, &Entry.second.PacketTimes, Entry.second.NumLost);
+    }
 }
 
-/** Prints stats and removes clients we haven't heard from in a while. */
-void DoBookkeeping(unsigned long long CurrentTime)
+/** Prints one set of stats, after a caller-supplied label. */
+void PrintPeriodStats(const PeriodStats* Stats, size_t NumClients)
 {
-    AllTimeClients = std::max(AllTimeClients, Clients.size());
-    printf("AllTime, Clients, %Zu, PacketTimes, ", AllTimeClients);
-    PrintValues(&PacketTimes_AllTime);
-    printf(" FrameTimes, ");
-    PrintValues(&FrameTimes_AllTime);
-    printf("   Current, Clients, %Zu, PacketTimes, ", Clients.size());
-    PrintValues(&PacketTimes_SinceLastBookkeep);
+    printf("Clients, %zu, PacketTimes, ", NumClients);
+    PrintValues(&Stats->PacketTimes, "ms");
+    printf(", ");
+    PrintPercentiles(&Stats->PacketTimesHistogram, 1000000.0, "ms");
     printf(" FrameTimes, ");
-    PrintValues(&FrameTimes_SinceLastBookkeep);
+    PrintValues(&Stats->FrameTimes, "ms");
+    printf(", ");
+    PrintPercentiles(&Stats->FrameTimesHistogram, 1000000.0, "ms");
+    printf(" WorkTimes, ");
+    PrintValues(&Stats->WorkTimes, "ms");
+    printf(", ");
+    PrintPercentiles(&Stats->WorkTimesHistogram, 1000000.0, "ms");
+    printf(" Packets, ");
+    PrintPacketCounts(&Stats->Packets);
+    if (KernelTimestamps)
+    {
+        printf(" DeliveryLag, ");
+        PrintValues(&Stats->DeliveryLag, "us");
+        printf(", ");
+        PrintPercentiles(&Stats->DeliveryLagHistogram, 1000.0, "us");
+    }
+    printf(" Wait, %s, ReceiveCpu(%%), %.1f, Waits, %llu, EmptyPolls, %llu", WaitStrategyName(Strategy),
+        Stats->PeriodNs ? 100.0 * (double)Stats->Wait.CpuTimeNs / (double)Stats->PeriodNs : 0.0, Stats->Wait.NumWaits, Stats->Wait.NumEmptyPolls);
+    if (Backend == Backend_IoUring)
+    {
+        printf(", BufferStalls, %llu, Rearms, %llu", Stats->Wait.NumBufferStalls, Stats->Wait.NumRearms);
+    }
+    if (KernelTimestamps && (Strategy == Wait_Epoll || Strategy == Wait_Adaptive))
+    {
+        printf(" WakeLatency, ");
+        PrintValues(&Stats->Wait.WakeLatency, "us");
+        printf(", ");
+        PrintPercentiles(&Stats->Wait.WakeLatencyHistogram, 1000.0, "us");
+    }
+}
 
-    time_t Time = time(nullptr);
-    struct tm* UtcTime = gmtime(&Time);
-    printf(", %s", asctime(UtcTime));
+/** Appends the period's stats to the series file. */
+void AppendSeries(const PeriodStats* Stats, unsigned long long PeriodNs)
+{
+    int Result = SeriesAppend(&Series, Series_PacketTimes, PeriodNs, &Stats->PacketTimes, &Stats->PacketTimesHistogram);
+    Result = Result ? Result : SeriesAppend(&Series, Series_FrameTimes, PeriodNs, &Stats->FrameTimes, &Stats->FrameTimesHistogram);
+    Result = Result ? Result : SeriesAppend(&Series, Series_WorkTimes, PeriodNs, &Stats->WorkTimes, &Stats->WorkTimesHistogram);
+    if (KernelTimestamps)
+    {
+        Result = Result ? Result : SeriesAppend(&Series, Series_DeliveryLag, PeriodNs, &Stats->DeliveryLag, &Stats->DeliveryLagHistogram);
+        if (Strategy == Wait_Epoll || Strategy == Wait_Adaptive)
+        {
+            Result = Result ? Result : SeriesAppend(&Series, Series_WakeLatency, PeriodNs, &Stats->Wait.WakeLatency, &Stats->Wait.WakeLatencyHistogram);
+        }
+    }
 
-    // reset
-    memset(&PacketTimes_SinceLastBookkeep, 0, sizeof(PacketTimes_SinceLastBookkeep));
-    memset(&FrameTimes_SinceLastBookkeep, 0, sizeof(FrameTimes_SinceLastBookkeep));
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot append to series file %s: %s\n", SeriesPath, strerror(Result));
+    }
+}
 
-    // remove all clients we haven't heard from during this period
-    for(std::map<unsigned long long, Client>::iterator It = Clients.begin(); It != Clients.end();)
+/**
+ * Ends the period on all receivers, merges what they measured and prints it, every BookKeepIntervalNs.
+ * Runs on its own thread so that printing never holds up receiving. Never returns.
+ */
+void* ReporterThread(void*)
+{
+    // these are large, keep them off the stack
+    static PeriodStats AllTime, Current;
+    unsigned long long NumPeriods = 0;
+    unsigned long long NextReportNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID) + BookKeepIntervalNs;
+    unsigned long long PeriodStartNs = GetTimeInNs();
+
+    ResetPeriodStats(&AllTime);
+    for (;;)
     {
-        if (CurrentTime - It->second.LastTimeHeard >= BOOK_KEEP_INTERVAL_NS)
+        SleepUntilNs(NextReportNs);
+        NextReportNs += BookKeepIntervalNs;
+
+        // flip everyone first, so that the periods of all receivers end at about the same time
+        unsigned long long PeriodEndNs = GetTimeInNs();
+        ++NumPeriods;
+        for (Receiver* Recv : Receivers)
         {
-            Clients.erase(It++);
+            __atomic_store_n(&Recv->Current, 1 - Recv->Current, __ATOMIC_RELEASE);
         }
-        else
+
+        ResetPeriodStats(&Current);
+        for (Receiver* Recv : Receivers)
+        {
+            while (__atomic_load_n(&Recv->NumHandedOver, __ATOMIC_ACQUIRE) != NumPeriods)
+            {
+                SleepNs(HANDOVER_POLL_NS);
+            }
+
+            // the receiver is done with it until we flip back, so it is ours to read and clear
+            PeriodStats* Done = &Recv->Periods[1 - Recv->Current];
+            MergePeriodStats(&Current, Done);
+            Current.Clients.insert(Current.Clients.end(), Done->Clients.begin(), Done->Clients.end());
+            ResetPeriodStats(Done);
+        }
+
+        Current.PeriodNs = PeriodEndNs - PeriodStartNs;
+        MergePeriodStats(&AllTime, &Current);
+        AllTimeClients = std::max(AllTimeClients, Current.NumClients);
+
+        printf("AllTime, ");
+        PrintPeriodStats(&AllTime, AllTimeClients);
+        printf("   Current, ");
+        PrintPeriodStats(&Current, Current.NumClients);
+        printf(", %s", UtcTimeString());
+
+        if (NumTopOffenders > 0)
         {
-            ++It;
+            PrintClientOutliers(Current.Clients);
         }
+
+        if (SeriesPath != nullptr)
+        {
+            AppendSeries(&Current, Current.PeriodNs);
+        }
+        PeriodStartNs = PeriodEndNs;
     }
+
+    return nullptr;
 }
 
-int main(int argc, const char* argv[])
+/** Creates a socket bound to the server port, non-blocking unless busy polling. Returns -1 on failure. */
+int CreateSocket()
 {
-    setlinebuf(stdout);
-    printf("Distributed synth benchmark server.\n");
-
-    // non-blocking, because we want to book keep clients between receptions
-    int Socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    // non-blocking, because we want to book keep clients between receptions - busy polling blocks with a timeout for that instead
+    int Socket = socket(AF_INET, SOCK_DGRAM | ((Strategy == Wait_BusyPoll) ? 0 : SOCK_NONBLOCK), 0);
     if (Socket < 0) 
     {
         perror("Cannot create UDP socket");
-        return 1;
+        return -1;
     }
 
     int Opt = 1;
     // this is so port can be reused quickly, useful while testing
     setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, (const void *)&Opt, sizeof(Opt));
 
+    // lets several receivers bind the same port, the kernel spreads clients between them
+    if (setsockopt(Socket, SOL_SOCKET, SO_REUSEPORT, (const void *)&Opt, sizeof(Opt)) < 0)
+    {
+        perror("Cannot set SO_REUSEPORT");
+        close(Socket);
+        return -1;
+    }
+
+    if (RecvBufferSize > 0 && setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, (const void *)&RecvBufferSize, sizeof(RecvBufferSize)) < 0)
+    {
+        perror("Cannot set SO_RCVBUF");
+    }
+
+    // blocking receives poll the device queue for up to SpinUs before sleeping, and give up after WAIT_TIMER_INTERVAL_NS
+    int BusyPollUs = (int)SpinUs;
+    if (Strategy == Wait_BusyPoll && setsockopt(Socket, SOL_SOCKET, SO_BUSY_POLL, (const void *)&BusyPollUs, sizeof(BusyPollUs)) < 0)
+    {
+        perror("Cannot set SO_BUSY_POLL (raising it above net.core.busy_read needs CAP_NET_ADMIN)");
+        close(Socket);
+        return -1;
+    }
+    struct timeval Timeout;
+    Timeout.tv_sec = 0;
+    Timeout.tv_usec = WAIT_TIMER_INTERVAL_NS / 1000ULL;
+    if (Strategy == Wait_BusyPoll && setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, (const void *)&Timeout, sizeof(Timeout)) < 0)
+    {
+        perror("Cannot set SO_RCVTIMEO");
+        close(Socket);
+        return -1;
+    }
+
+    // have the kernel stamp each datagram on arrival, passed back as a SCM_TIMESTAMPNS control message
+    if (KernelTimestamps && setsockopt(Socket, SOL_SOCKET, SO_TIMESTAMPNS, (const void *)&Opt, sizeof(Opt)) < 0)
+    {
+        perror("Cannot set SO_TIMESTAMPNS");
+        close(Socket);
+        return -1;
+    }
+
     struct sockaddr_in MyAddr;
     memset(&MyAddr, 0, sizeof(MyAddr));
     MyAddr.sin_family = AF_INET;
@@ -236,48 +733,604 @@ int main(int argc, const char* argv[])
     MyAddr.sin_port = htons(SERVER_PORT);
     if (bind(Socket, (struct sockaddr *)&MyAddr, sizeof(MyAddr)) < 0)
     {
+        perror("Cannot bind UDP socket");
         close(Socket);
-        return 1;
+        return -1;
     }
 
-    printf("Listening on port %d.\n", SERVER_PORT);
-    printf("Stats printed each %llu seconds.\n", BOOK_KEEP_INTERVAL);
+    return Socket;
+}
+
+/** Returns kernel receive time of the datagram in ns (CLOCK_REALTIME), or 0 if it carries none. */
+unsigned long long GetKernelTimestamp(struct msghdr* Header)
+{
+    for (struct cmsghdr* ControlMsg = CMSG_FIRSTHDR(Header); ControlMsg != nullptr; ControlMsg = CMSG_NXTHDR(Header, ControlMsg))
+    {
+        if (ControlMsg->cmsg_level == SOL_SOCKET && ControlMsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec TimeSpec;
+            memcpy(&TimeSpec, CMSG_DATA(ControlMsg), sizeof(TimeSpec));
+            return TimespecToNs(&TimeSpec);
+        }
+    }
 
-    /* Enter infinite loop - server never sleeps for better measurements */
-    unsigned long long LastBookkeep = GetTimeInNs();
+    return 0;
+}
+
+/**
+ * Creates the epoll set a blocking receiver waits in: its socket (or ring), and a timer that wakes it every
+ * WAIT_TIMER_INTERVAL_NS so that client expiry and period handover go on when nothing arrives.
+ * Exits on failure.
+ */
+int CreateWaitSet(int Fd, int* Timer)
+{
+    struct epoll_event Event;
+    struct itimerspec Interval;
+
+    int Epoll = epoll_create1(0);
+    *Timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (Epoll < 0 || *Timer < 0)
+    {
+        perror("Cannot create epoll set");
+        exit(1);
+    }
+
+    NsToTimespec(WAIT_TIMER_INTERVAL_NS, &Interval.it_interval);
+    NsToTimespec(WAIT_TIMER_INTERVAL_NS, &Interval.it_value);
+    if (timerfd_settime(*Timer, 0, &Interval, nullptr) != 0)
+    {
+        perror("timerfd_settime failed");
+        exit(1);
+    }
+
+    memset(&Event, 0, sizeof(Event));
+    Event.events = EPOLLIN;
+    Event.data.fd = Fd;
+    if (epoll_ctl(Epoll, EPOLL_CTL_ADD, Fd, &Event) != 0)
+    {
+        perror("Cannot add socket to epoll set");
+        exit(1);
+    }
+    Event.data.fd = *Timer;
+    if (epoll_ctl(Epoll, EPOLL_CTL_ADD, *Timer, &Event) != 0)
+    {
+        perror("Cannot add timer to epoll set");
+        exit(1);
+    }
+
+    return Epoll;
+}
+
+/** Datagrams of one receive batch being processed */
+struct ReceiveBatch
+{
+    /** Our clocks when the batch was read, with kernel timestamps only */
+    unsigned long long              Timestamp = 0;
+    unsigned long long              RealTime = 0;
+
+    /** The first datagram after blocking, its delivery lag is the wake up latency */
+    bool                            WokeUp = false;
+
+    /** Echoes to send once the batch is processed, and where to */
+    std::vector<Message>            Echoes;
+    std::vector<struct sockaddr_in> EchoAddrs;
+};
+
+void BeginBatch(ReceiveBatch* Batch)
+{
+    // with kernel timestamps, packet intervals come from the kernel and our clock is read once per batch
+    if (KernelTimestamps)
+    {
+        Batch->RealTime = GetClockInNs(CLOCK_REALTIME);
+        Batch->Timestamp = GetTimeInNs();
+    }
+}
+
+/**
+ * Accounts a single datagram, straight from the buffer it was received into.
+ *
+ * @param Control message header carrying the control messages, only looked at with kernel timestamps
+ */
+void ProcessDatagram(Receiver* Recv, PeriodStats* Stats, ReceiveBatch* Batch, const void* Payload, size_t Length, const struct sockaddr_in* Addr, struct msghdr* Control)
+{
+    Message Msg;
+    if (DecodeMessage(Payload, Length, &Msg) != 0 || (Msg.Header.Flags & MessageFlag_Echo) != 0)
+    {
+        ++Stats->Packets.NumMalformed;
+        return;
+    }
+
+    unsigned long long ReceivedAt;
+
+    if (KernelTimestamps)
+    {
+        ReceivedAt = Batch->Timestamp;
+        unsigned long long KernelTimestamp = GetKernelTimestamp(Control);
+        if (KernelTimestamp != 0)
+        {
+            unsigned long long LagNs = (Batch->RealTime > KernelTimestamp) ? Batch->RealTime - KernelTimestamp : 0;
+            UpdateObservation(&Stats->DeliveryLag, (double)(LagNs) / 1000.0);
+            UpdateHistogram(&Stats->DeliveryLagHistogram, LagNs);
+
+            // the first datagram after blocking waited for us to be woken up and scheduled
+            if (Batch->WokeUp)
+            {
+                UpdateObservation(&Stats->Wait.WakeLatency, (double)(LagNs) / 1000.0);
+                UpdateHistogram(&Stats->Wait.WakeLatencyHistogram, LagNs);
+                Batch->WokeUp = false;
+            }
+
+            // the echo hold time then includes the time the packet sat in the socket buffer
+            ReceivedAt = Batch->Timestamp - LagNs;
+        }
+        else
+        {
+            // should not happen, but fall back to our own clock, on the same time base
+            KernelTimestamp = Batch->RealTime;
+        }
+
+        UpdateClient(Recv, Stats, Msg, Batch->Timestamp, KernelTimestamp);
+    }
+    else
+    {
+        ReceivedAt = GetTimeInNs();
+        UpdateClient(Recv, Stats, Msg, ReceivedAt, ReceivedAt);
+    }
+
+    // hold time is filled in when sending, from the time we received it
+    if (Msg.Header.Flags & MessageFlag_EchoRequest)
+    {
+        Msg.Header.Flags = MessageFlag_Echo;
+        Msg.ServerHoldNs = ReceivedAt;
+        Batch->Echoes.push_back(Msg);
+        Batch->EchoAddrs.push_back(*Addr);
+    }
+}
+
+/**
+ * Sends the echoes of the batch. They go out after the batch, so that sending them does not delay reading the rest.
+ * Dropped if the socket buffer is full - the client treats a missing echo as a lost round trip
+ */
+void EndBatch(Receiver* Recv, PeriodStats* Stats, ReceiveBatch* Batch)
+{
+    for (size_t Idx = 0; Idx < Batch->Echoes.size(); ++Idx)
+    {
+        Message& Echo = Batch->Echoes[Idx];
+        unsigned long long Now = GetTimeInNs();
+        Echo.ServerHoldNs = (Now > Echo.ServerHoldNs) ? Now - Echo.ServerHoldNs : 0;
+        if (sendto(Recv->Socket, &Echo, sizeof(Message), MSG_DONTWAIT, (struct sockaddr*)&Batch->EchoAddrs[Idx], sizeof(Batch->EchoAddrs[Idx])) == sizeof(Message))
+        {
+            ++Stats->Packets.NumEchoed;
+        }
+    }
+    Batch->Echoes.clear();
+    Batch->EchoAddrs.clear();
+}
+
+/** Receive loop of a single receiver. Only returns on error. */
+void* ReceiverThread(void* Data)
+{
+    Receiver* Recv = (Receiver*)Data;
+    int MaxBatch = (Backend == Backend_RecvMMsg) ? BatchSize : 1;
+
+    const char* Failed = "";
+    int Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot apply %s on receiver %d: %s\n", Failed, Recv->Index, strerror(Result));
+        exit(1);
+    }
+
+    // datagrams are read into buffers of the current message size, newer versions get truncated to the fields we know.
+    // io_uring has buffers of its own
+    std::vector<Message> IncomingMsgs(MaxBatch);
+    std::vector<struct sockaddr_in> Addrs(MaxBatch);
+    std::vector<struct iovec> Vecs(MaxBatch);
+    std::vector<struct mmsghdr> Headers(MaxBatch);
+    const size_t ControlSize = CMSG_SPACE(sizeof(struct timespec));
+    std::vector<char> Controls(KernelTimestamps ? ControlSize * MaxBatch : 0);
+    ReceiveBatch Batch;
+
+    memset(Headers.data(), 0, sizeof(struct mmsghdr) * MaxBatch);
+    for (int Idx = 0; Idx < MaxBatch; ++Idx)
+    {
+        Vecs[Idx].iov_base = &IncomingMsgs[Idx];
+        Vecs[Idx].iov_len = sizeof(Message);
+        Headers[Idx].msg_hdr.msg_iov = &Vecs[Idx];
+        Headers[Idx].msg_hdr.msg_iovlen = 1;
+        Headers[Idx].msg_hdr.msg_name = &Addrs[Idx];
+        Headers[Idx].msg_hdr.msg_namelen = sizeof(Addrs[Idx]);
+        if (KernelTimestamps)
+        {
+            Headers[Idx].msg_hdr.msg_control = &Controls[Idx * ControlSize];
+            Headers[Idx].msg_hdr.msg_controllen = ControlSize;
+        }
+    }
+
+    // spinning strategies never sleep, for the best measurements - at the cost of a whole core each
+    int Timer = -1, Epoll = -1;
+    if (Strategy == Wait_Epoll || Strategy == Wait_Adaptive)
+    {
+        Epoll = CreateWaitSet((Backend == Backend_IoUring) ? Recv->Uring.GetFd() : Recv->Socket, &Timer);
+    }
+
+    int Active = 0;
+    Batch.WokeUp = false;
+    unsigned long long LastDatagramNs = GetTimeInNs();
+    Recv->PeriodCpuTimeNs = GetClockInNs(CLOCK_THREAD_CPUTIME_ID);
     for (;;)
     {
-        // we only expect to receive unique ids
-        Message IncomingMsg;
-        memset(&IncomingMsg, 0, sizeof(IncomingMsg));
-        int Len = recvfrom(Socket, &IncomingMsg, sizeof(IncomingMsg), 0, nullptr, nullptr);
-        if (Len == -1)
+        int NumReceived = 0;
+
+        // the reporter has ended the period: wrap it up, then fill the other one
+        int Next = __atomic_load_n(&Recv->Current, __ATOMIC_ACQUIRE);
+        if (Next != Active)
+        {
+            HandOverPeriod(Recv, &Recv->Periods[Active]);
+            Active = Next;
+        }
+        PeriodStats* Stats = &Recv->Periods[Active];
+
+        if (Backend == Backend_IoUring)
+        {
+            // completions are processed in place, there is nothing left to do per datagram below. The batch clocks are
+            // read at the first completion: after any io_uring_enter() that posted it, and not at all on an empty poll
+            bool BatchBegun = false;
+            NumReceived = Recv->Uring.Drain(
+                [&](const void* Payload, size_t Length, const struct sockaddr_in* Addr, struct msghdr* Control)
+                {
+                    if (!BatchBegun)
+                    {
+                        BeginBatch(&Batch);
+                        BatchBegun = true;
+                    }
+                    ProcessDatagram(Recv, Stats, &Batch, Payload, Length, Addr, Control);
+                },
+                BatchSize);
+            if (NumReceived < 0)
+            {
+                errno = -NumReceived;
+                NumReceived = -1;
+            }
+            else if (NumReceived == 0)
+            {
+                errno = EAGAIN;
+                NumReceived = -1;
+            }
+        }
+        else if (Backend == Backend_RecvMMsg)
+        {
+            // busy polling blocks for the first datagram only, then takes what else is there
+            NumReceived = recvmmsg(Recv->Socket, Headers.data(), MaxBatch, (Strategy == Wait_BusyPoll) ? MSG_WAITFORONE : MSG_DONTWAIT, nullptr);
+        }
+        else
+        {
+            // recvfrom() cannot return control messages
+            socklen_t AddrLen = sizeof(Addrs[0]);
+            int Len = KernelTimestamps ? recvmsg(Recv->Socket, &Headers[0].msg_hdr, 0) : recvfrom(Recv->Socket, &IncomingMsgs[0], sizeof(Message), 0, (struct sockaddr*)&Addrs[0], &AddrLen);
+            if (Len >= 0)
+            {
+                Headers[0].msg_len = Len;
+                NumReceived = 1;
+            }
+            else
+            {
+                NumReceived = -1;
+            }
+        }
+
+        if (NumReceived == -1)
         {
             if (errno != EAGAIN)
             {
-                fprintf(stderr, "recvfrom() failed with errno = %d (%s).\n", errno, strerror(errno));
-                close(Socket);
+                fprintf(stderr, "Receiving on socket %d failed with errno = %d (%s).\n", Recv->Index, errno, strerror(errno));
+                exit(1);
+            }
+            ++Stats->Wait.NumEmptyPolls;
+
+            if (Epoll >= 0 && (Strategy == Wait_Epoll || GetTimeInNs() - LastDatagramNs > SpinUs * 1000ULL))
+            {
+                struct epoll_event Events[2];
+                unsigned long long Expirations;
+
+                if (epoll_wait(Epoll, Events, 2, -1) < 0 && errno != EINTR)
+                {
+                    perror("epoll_wait failed");
+                    exit(1);
+                }
+                if (read(Timer, &Expirations, sizeof(Expirations)) < 0 && errno != EAGAIN)
+                {
+                    perror("Cannot read timerfd");
+                    exit(1);
+                }
+                ++Stats->Wait.NumWaits;
+                Batch.WokeUp = true;
+            }
+        }
+        else
+        {
+            if (Backend != Backend_IoUring)
+            {
+                BeginBatch(&Batch);
+                for (int Idx = 0; Idx < NumReceived; ++Idx)
+                {
+                    ProcessDatagram(Recv, Stats, &Batch, &IncomingMsgs[Idx], Headers[Idx].msg_len, &Addrs[Idx], &Headers[Idx].msg_hdr);
+
+                    if (KernelTimestamps)
+                    {
+                        // kernel overwrites it with the length actually used
+                        Headers[Idx].msg_hdr.msg_controllen = ControlSize;
+                    }
+                    Headers[Idx].msg_hdr.msg_namelen = sizeof(Addrs[Idx]);
+                }
+            }
+
+            EndBatch(Recv, Stats, &Batch);
+
+            LastDatagramNs = GetTimeInNs();
+            Batch.WokeUp = false;
+        }
+
+        // expire a few stale clients each time around instead of sweeping all of them at once
+        Recv->Clients.Expire(GetTimeInNs(), MAX_EXPIRE_VISITS);
+    }
+
+    return nullptr;
+}
+
+void PrintUsage(const char* Name)
+{
+    printf("Usage: %s [-b recvfrom|recvmmsg|io_uring] [-n batch_size] [-t num_sockets] [-c first_cpu] [-r rcvbuf_bytes] [-m max_clients] [-k] [-o top_k] [-i seconds] [-w series_file] [-W spin|busypoll|epoll|adaptive] [-s spin_us] " RUNTIME_CONFIG_SYNOPSIS "\n", Name);
+    printf("  -b   receive backend, io_uring falls back to recvmmsg where the kernel does not support it (default recvfrom)\n");
+    printf("  -n   max datagrams per recvmmsg() call or io_uring drain, up to %d (default %d)\n", MAX_RECV_BATCH, BatchSize);
+    printf("  -t   number of SO_REUSEPORT sockets, one receive thread each (default %d)\n", NumReceivers);
+    printf("  -c   pin receive thread N to cpu first_cpu + N (default: not pinned)\n");
+    printf("  -r   SO_RCVBUF size of each socket in bytes (default: system default)\n");
+    printf("  -m   number of clients to preallocate for, the client table grows past it if needed (default %zu)\n", MaxClients);
+    printf("  -k   use kernel receive timestamps (SO_TIMESTAMPNS) for packet intervals and report delivery lag\n");
+    printf("  -i   book keeping interval, stats are printed and start over this often (default %llu)\n", BOOK_KEEP_INTERVAL);
+    printf("  -W   how to wait for datagrams: spin on the socket, block in the socket with SO_BUSY_POLL (NAPI devices, not loopback), block in epoll, or spin for a while then block (default spin)\n");
+    printf("  -s   how long adaptive spins after the last datagram, and how long busypoll's blocking receives poll the device (SO_BUSY_POLL) before sleeping, in microseconds (default %llu)\n", SpinUs);
+    printf("  -w   also append each period's stats to this binary series file, see series-query\n");
+    printf("  -o   number of worst clients to print each interval, by frame time and by packet jitter, 0 to not track clients (default %zu)\n", NumTopOffenders);
+    RuntimeConfigPrintUsage();
+}
+
+int main(int argc, char* const argv[])
+{
+    setlinebuf(stdout);
+    printf("Distributed synth benchmark server.\n");
+
+    RuntimeConfigInit(&Runtime);
+
+    int Opt;
+    while ((Opt = getopt(argc, argv, "b:n:t:c:r:m:ko:i:w:W:s:h" RUNTIME_CONFIG_OPTIONS)) != -1)
+    {
+        switch (Opt)
+        {
+            case 'b':
+                if (strcmp(optarg, "recvfrom") == 0)
+                {
+                    Backend = Backend_RecvFrom;
+                }
+                else if (strcmp(optarg, "recvmmsg") == 0)
+                {
+                    Backend = Backend_RecvMMsg;
+                }
+                else if (strcmp(optarg, "io_uring") == 0)
+                {
+                    Backend = Backend_IoUring;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown receive backend '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                BatchSize = atoi(optarg);
+                break;
+            case 't':
+                NumReceivers = atoi(optarg);
+                break;
+            case 'c':
+                FirstCpu = atoi(optarg);
+                break;
+            case 'r':
+                RecvBufferSize = atoi(optarg);
+                break;
+            case 'm':
+                MaxClients = strtoull(optarg, nullptr, 10);
+                break;
+            case 'k':
+                KernelTimestamps = true;
+                break;
+            case 'o':
+                NumTopOffenders = strtoull(optarg, nullptr, 10);
+                break;
+            case 'i':
+                BookKeepIntervalNs = (unsigned long long)(atof(optarg) * 1e9);
+                break;
+            case 'w':
+                SeriesPath = optarg;
+                break;
+            case 'W':
+                if (strcmp(optarg, "spin") == 0)
+                {
+                    Strategy = Wait_Spin;
+                }
+                else if (strcmp(optarg, "busypoll") == 0)
+                {
+                    Strategy = Wait_BusyPoll;
+                }
+                else if (strcmp(optarg, "epoll") == 0)
+                {
+                    Strategy = Wait_Epoll;
+                }
+                else if (strcmp(optarg, "adaptive") == 0)
+                {
+                    Strategy = Wait_Adaptive;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown wait strategy '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                SpinUs = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                if (RuntimeConfigParseOption(&Runtime, Opt, optarg) == 0)
+                {
+                    break;
+                }
+                PrintUsage(argv[0]);
                 return 1;
+        }
+    }
+
+    if (BatchSize < 1 || BatchSize > MAX_RECV_BATCH || NumReceivers < 1 || BookKeepIntervalNs == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // io_uring receives never block in the socket, which is where the kernel busy polls
+    if (Strategy == Wait_BusyPoll && (Backend == Backend_IoUring || SpinUs == 0))
+    {
+        fprintf(stderr, "-W busypoll needs -b recvfrom or recvmmsg, and -s above 0\n");
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // before the client tables are allocated, so locking covers them
+    const char* Failed = "";
+    int Result = RuntimeConfigApply(&Runtime, &Failed);
+    if (Result != 0)
+    {
+        fprintf(stderr, "Cannot apply %s: %s\n", Failed, strerror(Result));
+        return 1;
+    }
+
+    for (int Idx = 0; Idx < NumReceivers; ++Idx)
+    {
+        Receiver* Recv = new Receiver(MaxClients / NumReceivers + 1);
+        Recv->Index = Idx;
+        Recv->Socket = CreateSocket();
+        if (Recv->Socket < 0)
+        {
+            return 1;
+        }
+
+        // older kernels, seccomp and the kernel.io_uring_disabled sysctl all show up here, the first receiver decides for all
+        if (Backend == Backend_IoUring)
+        {
+            int Result = Recv->Uring.Init(Recv->Socket, URING_NUM_BUFFERS, KernelTimestamps ? CMSG_SPACE(sizeof(struct timespec)) : 0, sizeof(Message));
+            if (Result != 0)
+            {
+                if (Idx != 0)
+                {
+                    fprintf(stderr, "Cannot set up io_uring for socket %d: %s\n", Idx, strerror(Result));
+                    return 1;
+                }
+                printf("io_uring receive is not available (%s), falling back to recvmmsg.\n", strerror(Result));
+                Backend = Backend_RecvMMsg;
             }
         }
-        else if (Len == sizeof(IncomingMsg))
+
+        ResetPeriodStats(&Recv->Periods[0]);
+        ResetPeriodStats(&Recv->Periods[1]);
+
+        Receivers.push_back(Recv);
+    }
+
+    const char* BackendName = (Backend == Backend_IoUring) ? "io_uring multishot recvmsg" : (Backend == Backend_RecvMMsg) ? "recvmmsg" : "recvfrom";
+    printf("Listening on port %d.\n", SERVER_PORT);
+    printf("Receiving with %s on %d socket(s)", BackendName, NumReceivers);
+    if (Backend == Backend_IoUring)
+    {
+        printf(", %d buffers each, drained up to %d datagrams at a time", URING_NUM_BUFFERS, BatchSize);
+    }
+    else if (Backend == Backend_RecvMMsg)
+    {
+        printf(", up to %d datagrams per call", BatchSize);
+    }
+    if (FirstCpu >= 0)
+    {
+        printf(", pinned starting at cpu %d", FirstCpu);
+    }
+    printf(", waiting with %s", WaitStrategyName(Strategy));
+    if (Strategy == Wait_BusyPoll || Strategy == Wait_Adaptive)
+    {
+        printf(" (%llu us)", SpinUs);
+    }
+    printf(".\n");
+    if (KernelTimestamps)
+    {
+        printf("Packet intervals use kernel receive timestamps, delivery lag reported in microseconds.\n");
+    }
+    printf("Stats printed each %.3f seconds.\n", (double)BookKeepIntervalNs / 1e9);
+    RuntimeConfigPrint(&Runtime);
+
+    if (SeriesPath != nullptr)
+    {
+        int Result = SeriesOpen(&Series, SeriesPath, "ds_benchmark_server", ServerSeriesInfo, Series_Count);
+        if (Result != 0)
+        {
+            fprintf(stderr, "Cannot open series file %s: %s\n", SeriesPath, (Result == EINVAL) ? "written by another tool or version" : strerror(Result));
+            return 1;
+        }
+        printf("Appending stats to series file %s.\n", SeriesPath);
+    }
+
+    pthread_t Reporter;
+    if (pthread_create(&Reporter, nullptr, ReporterThread, nullptr) != 0)
+    {
+        fprintf(stderr, "Cannot create reporter thread\n");
+        return 1;
+    }
+
+    // receiver 0 runs on the main thread, so the default single socket mode has no extra threads
+    long NumCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int Idx = NumReceivers - 1; Idx >= 0; --Idx)
+    {
+        pthread_attr_t Attr;
+        pthread_attr_init(&Attr);
+
+        if (FirstCpu >= 0)
         {
-            UpdateClient(IncomingMsg);
+            cpu_set_t CpuSet;
+            CPU_ZERO(&CpuSet);
+            CPU_SET((FirstCpu + Idx) % NumCpus, &CpuSet);
+
+            int Result = (Idx == 0) ? pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet) : pthread_attr_setaffinity_np(&Attr, sizeof(CpuSet), &CpuSet);
+            if (Result != 0)
+            {
+                fprintf(stderr, "Cannot pin receiver %d to cpu %ld: %s\n", Idx, (FirstCpu + Idx) % NumCpus, strerror(Result));
+                return 1;
+            }
         }
-	else
-	{
-		printf("Received malformed message of %d bytes\n", Len);
-	}
 
-        unsigned long long CurrentTime = GetTimeInNs();
-        if (CurrentTime - LastBookkeep > BOOK_KEEP_INTERVAL_NS)
+        if (Idx != 0)
         {
-            DoBookkeeping(CurrentTime);
-            LastBookkeep = CurrentTime;
+            pthread_t Thread;
+            if (pthread_create(&Thread, &Attr, ReceiverThread, Receivers[Idx]) != 0)
+            {
+                fprintf(stderr, "Cannot create receive thread %d\n", Idx);
+                return 1;
+            }
         }
+
+        pthread_attr_destroy(&Attr);
     }
 
+    ReceiverThread(Receivers[0]);
+
     /** Never reached, but just in case. */
-    close(Socket);
+    for (Receiver* Recv : Receivers)
+    {
+        close(Recv->Socket);
+    }
     return 0;
 }
@@ -0,0 +1,365 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <vector>
+#include "bench_core.h"
+#include "ds_protocol.h"
+#include "uring_receiver.h"
+
+/**
+ * Compares the server's receive backends at rising packet rates. A sender thread offers messages at a fixed
+ * rate over loopback, on absolute deadlines, and the main thread receives them with each backend in turn,
+ * spinning like the server's default wait strategy. For each rate it prints how many messages made it, how
+ * long receiving took per message while there was something to receive (the part that competes with the
+ * rest of the server for the core), and how late messages were delivered.
+ *
+ * Sender and receiver share the machine, so give it two idle cores (see -c) for numbers that mean something.
+ */
+
+/** How often the sender catches up with the offered rate */
+#define SEND_TICK_NS        50000ULL
+
+/** Most messages handed to a single sendmmsg() */
+#define SEND_BATCH          64
+
+/** Datagrams received per recvmmsg() call or io_uring drain, as the server's default -n */
+#define RECEIVE_BATCH       64
+
+/** Time the receiver keeps going after the sender stopped, for what is still in flight */
+#define DRAIN_NS            50000000ULL
+
+enum Backend
+{
+    Backend_RecvFrom,
+    Backend_RecvMMsg,
+    Backend_IoUring,
+    Backend_Count
+};
+
+const char* BackendNames[Backend_Count] = { "recvfrom", "recvmmsg", "io_uring" };
+
+struct SenderParams
+{
+    int                     Socket;
+    unsigned long long      Rate;
+    unsigned long long      DurationNs;
+    int                     Cpu;
+    unsigned long long      NumSent;
+};
+
+struct BenchResult
+{
+    unsigned long long      NumReceived;
+    unsigned long long      NumCalls;
+    unsigned long long      BusyNs;
+    unsigned long long      NumBufferStalls;
+    struct LatencyHistogram Lag;
+};
+
+int Cpus[2] = { -1, -1 };
+
+/** Sends Rate messages per second for DurationNs, numbering them so that the receiver can count them */
+void* SenderThread(void* Data)
+{
+    SenderParams* Params = (SenderParams*)Data;
+    std::vector<Message> Msgs(SEND_BATCH);
+    std::vector<struct iovec> Vecs(SEND_BATCH);
+    std::vector<struct mmsghdr> Headers(SEND_BATCH);
+
+    if (Params->Cpu >= 0)
+    {
+        PinThreadToCpu(Params->Cpu);
+    }
+
+    memset(Msgs.data(), 0, sizeof(Message) * SEND_BATCH);
+    memset(Headers.data(), 0, sizeof(struct mmsghdr) * SEND_BATCH);
+    for (int Idx = 0; Idx < SEND_BATCH; ++Idx)
+    {
+        Msgs[Idx].Header.Magic = MESSAGE_MAGIC;
+        Msgs[Idx].Header.Version = MESSAGE_VERSION;
+        Msgs[Idx].UniqueId = 1;
+        Vecs[Idx].iov_base = &Msgs[Idx];
+        Vecs[Idx].iov_len = sizeof(Message);
+        Headers[Idx].msg_hdr.msg_iov = &Vecs[Idx];
+        Headers[Idx].msg_hdr.msg_iovlen = 1;
+    }
+
+    unsigned long long StartNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+    unsigned long long NumSent = 0;
+    for (unsigned long long TickNs = StartNs; TickNs < StartNs + Params->DurationNs; TickNs += SEND_TICK_NS)
+    {
+        SleepUntilNs(TickNs);
+
+        // whatever the previous ticks fell behind is sent now, so the rate holds on average
+        unsigned long long Due = (TickNs - StartNs + SEND_TICK_NS) * Params->Rate / 1000000000ULL;
+        while (NumSent < Due)
+        {
+            int NumBatch = (Due - NumSent < SEND_BATCH) ? (int)(Due - NumSent) : SEND_BATCH;
+            unsigned long long Now = GetTimeInNs();
+            for (int Idx = 0; Idx < NumBatch; ++Idx)
+            {
+                Msgs[Idx].FrameNumber = NumSent + Idx;
+                Msgs[Idx].SendTimeNs = Now;
+            }
+
+            // a full socket buffer loses the rest of the batch, like it would on the network
+            int Result = sendmmsg(Params->Socket, Headers.data(), NumBatch, 0);
+            if (Result < 0 && errno != ENOBUFS && errno != EAGAIN)
+            {
+                perror("sendmmsg failed");
+                exit(1);
+            }
+            NumSent += NumBatch;
+        }
+    }
+
+    Params->NumSent = NumSent;
+    return nullptr;
+}
+
+/** Accounts a received datagram */
+void ProcessDatagram(BenchResult* Result, const void* Payload, size_t Length)
+{
+    Message Msg;
+    if (DecodeMessage(Payload, Length, &Msg) == 0)
+    {
+        unsigned long long Now = GetTimeInNs();
+        UpdateHistogram(&Result->Lag, (Now > Msg.SendTimeNs) ? Now - Msg.SendTimeNs : 0);
+        ++Result->NumReceived;
+    }
+}
+
+/**
+ * Runs one backend at one rate.
+ *
+ * @return false if the backend is not available
+ */
+bool RunBenchmark(Backend Kind, unsigned long long Rate, unsigned long long DurationNs, BenchResult* Result)
+{
+    memset(Result, 0, sizeof(*Result));
+
+    int Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int SendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in Addr;
+    socklen_t AddrLen = sizeof(Addr);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (Socket < 0 || SendSocket < 0 || bind(Socket, (struct sockaddr*)&Addr, sizeof(Addr)) != 0 ||
+        getsockname(Socket, (struct sockaddr*)&Addr, &AddrLen) != 0 || connect(SendSocket, (struct sockaddr*)&Addr, sizeof(Addr)) != 0)
+    {
+        perror("Cannot set up loopback sockets");
+        exit(1);
+    }
+
+    UringReceiver Uring;
+    if (Kind == Backend_IoUring)
+    {
+        int Error = Uring.Init(Socket, 4096, 0, sizeof(Message));
+        if (Error != 0)
+        {
+            printf("Backend, %s, not available: %s\n", BackendNames[Kind], strerror(Error));
+            close(Socket);
+            close(SendSocket);
+            return false;
+        }
+    }
+
+    std::vector<Message> IncomingMsgs(RECEIVE_BATCH);
+    std::vector<struct iovec> Vecs(RECEIVE_BATCH);
+    std::vector<struct mmsghdr> Headers(RECEIVE_BATCH);
+    memset(Headers.data(), 0, sizeof(struct mmsghdr) * RECEIVE_BATCH);
+    for (int Idx = 0; Idx < RECEIVE_BATCH; ++Idx)
+    {
+        Vecs[Idx].iov_base = &IncomingMsgs[Idx];
+        Vecs[Idx].iov_len = sizeof(Message);
+        Headers[Idx].msg_hdr.msg_iov = &Vecs[Idx];
+        Headers[Idx].msg_hdr.msg_iovlen = 1;
+    }
+
+    SenderParams Params;
+    Params.Socket = SendSocket;
+    Params.Rate = Rate;
+    Params.DurationNs = DurationNs;
+    Params.Cpu = Cpus[1];
+    Params.NumSent = 0;
+
+    pthread_t Sender;
+    if (pthread_create(&Sender, nullptr, SenderThread, &Params) != 0)
+    {
+        fprintf(stderr, "Cannot create sender thread\n");
+        exit(1);
+    }
+
+    unsigned long long EndNs = GetTimeInNs() + DurationNs + DRAIN_NS;
+    for (;;)
+    {
+        unsigned long long CallStartNs = GetTimeInNs();
+        if (CallStartNs > EndNs)
+        {
+            break;
+        }
+
+        int NumReceived = 0;
+        if (Kind == Backend_IoUring)
+        {
+            NumReceived = Uring.Drain(
+                [&](const void* Payload, size_t Length, const struct sockaddr_in*, struct msghdr*)
+                {
+                    ProcessDatagram(Result, Payload, Length);
+                },
+                RECEIVE_BATCH);
+        }
+        else
+        {
+            if (Kind == Backend_RecvMMsg)
+            {
+                NumReceived = recvmmsg(Socket, Headers.data(), RECEIVE_BATCH, MSG_DONTWAIT, nullptr);
+            }
+            else
+            {
+                struct sockaddr_in From;
+                socklen_t FromLen = sizeof(From);
+                int Len = recvfrom(Socket, &IncomingMsgs[0], sizeof(Message), MSG_DONTWAIT, (struct sockaddr*)&From, &FromLen);
+                Headers[0].msg_len = Len;
+                NumReceived = (Len >= 0) ? 1 : -1;
+            }
+
+            for (int Idx = 0; Idx < NumReceived; ++Idx)
+            {
+                ProcessDatagram(Result, &IncomingMsgs[Idx], Headers[Idx].msg_len);
+            }
+        }
+
+        if (NumReceived > 0)
+        {
+            Result->BusyNs += GetTimeInNs() - CallStartNs;
+            ++Result->NumCalls;
+        }
+        else if (NumReceived < 0)
+        {
+            int Error = (Kind == Backend_IoUring) ? -NumReceived : errno;
+            if (Error != EAGAIN)
+            {
+                fprintf(stderr, "Receiving with %s failed: %s\n", BackendNames[Kind], strerror(Error));
+                exit(1);
+            }
+        }
+    }
+
+    pthread_join(Sender, nullptr);
+    Result->NumBufferStalls = Uring.NumBufferStalls;
+
+    unsigned long long NumSent = Params.NumSent;
+    double LossPercent = (NumSent > 0) ? 100.0 * (double)(NumSent - Result->NumReceived) / (double)NumSent : 0.0;
+    printf("Backend, %s, OfferedRate, %llu, Sent, %llu, Received, %llu, Loss(%%), %.3f, BusyNsPerPacket, %.1f, PacketsPerCall, %.1f, BufferStalls, %llu, Lag, ",
+        BackendNames[Kind], Rate, NumSent, Result->NumReceived, LossPercent,
+        (Result->NumReceived > 0) ? (double)Result->BusyNs / (double)Result->NumReceived : 0.0,
+        (Result->NumCalls > 0) ? (double)Result->NumReceived / (double)Result->NumCalls : 0.0,
+        Result->NumBufferStalls);
+    PrintPercentiles(&Result->Lag, 1000.0, "us");
+    printf("\n");
+
+    close(Socket);
+    close(SendSocket);
+    return true;
+}
+
+void PrintUsage(const char* Name)
+{
+    printf("Usage: %s [-d seconds] [-c receive_cpu,send_cpu] [rate ...] (default rates 25000 50000 100000 200000 400000 800000 messages per second)\n", Name);
+}
+
+int main(int argc, char* const argv[])
+{
+    setlinebuf(stdout);
+    printf("Receive backend benchmark, messages of %zu bytes over loopback.\n", sizeof(Message));
+
+    unsigned long long DurationNs = 2000000000ULL;
+    int Opt;
+    while ((Opt = getopt(argc, argv, "d:c:h")) != -1)
+    {
+        switch (Opt)
+        {
+            case 'd':
+                DurationNs = (unsigned long long)(atof(optarg) * 1e9);
+                break;
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &Cpus[0], &Cpus[1]) != 2)
+                {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<unsigned long long> Rates;
+    for (int Idx = optind; Idx < argc; ++Idx)
+    {
+        Rates.push_back(strtoull(argv[Idx], nullptr, 10));
+    }
+    if (Rates.empty())
+    {
+        Rates = { 25000, 50000, 100000, 200000, 400000, 800000 };
+    }
+
+    if (Cpus[0] >= 0 && PinThreadToCpu(Cpus[0]) != 0)
+    {
+        fprintf(stderr, "Cannot pin receiver to cpu %d\n", Cpus[0]);
+        return 1;
+    }
+
+    // rates go up per backend, so each backend's breaking point shows in a block of its own
+    BenchResult Result;
+    for (int Kind = 0; Kind < Backend_Count; ++Kind)
+    {
+        for (unsigned long long Rate : Rates)
+        {
+            if (!RunBenchmark((Backend)Kind, Rate, DurationNs, &Result))
+            {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+/**
+ * Receives datagrams from a UDP socket through io_uring, without a syscall per datagram (or per batch).
+ *
+ * A single multishot recvmsg stays armed on the socket and picks a buffer from a ring of provided buffers
+ * for every datagram, so the kernel keeps receiving while we process. Each buffer holds what recvmsg
+ * returns - an io_uring_recvmsg_out header, the source address, control messages and the payload - and
+ * Drain() hands those to the caller in place, then gives the buffer back to the kernel.
+ *
+ * Uses raw syscalls, so it does not need liburing. Needs Linux 6.0 for multishot recvmsg; Init() fails
+ * with an errno on older kernels or where io_uring is disabled (ENOSYS or EPERM under seccomp, or with
+ * the kernel.io_uring_disabled sysctl), and the caller falls back to another backend.
+ *
+ * The ring file descriptor becomes readable when completions are pending, so it can be waited on with epoll.
+ */
+class UringReceiver
+{
+public:
+
+    /** Buffer group id of the provided buffers, we only have one */
+    static const unsigned BufferGroup = 0;
+
+    UringReceiver()
+        : NumRearms(0)
+        , NumBufferStalls(0)
+        , RingFd(-1)
+        , RingMemory(MAP_FAILED)
+        , RingMemorySize(0)
+        , SubmissionEntries(MAP_FAILED)
+        , SubmissionEntriesSize(0)
+        , BufferRing(MAP_FAILED)
+        , BufferRingSize(0)
+        , Buffers(MAP_FAILED)
+        , BuffersSize(0)
+        , Socket(-1)
+        , Armed(false)
+    {
+    }
+
+    ~UringReceiver()
+    {
+        Release();
+    }
+
+    /**
+     * Sets up the rings and arms the receive.
+     *
+     * @param InSocket UDP socket to receive from, stays owned by the caller
+     * @param InNumBuffers number of provided buffers, a power of two up to 32768. Datagrams arriving while all of them wait to be drained are left in the socket buffer
+     * @param InControlSize room for control messages per datagram, 0 if none are wanted
+     * @param InPayloadSize room for the payload per datagram, longer datagrams are truncated
+     * @return 0 on success, errno otherwise
+     */
+    int Init(int InSocket, unsigned InNumBuffers, unsigned InControlSize, unsigned InPayloadSize)
+    {
+        Socket = InSocket;
+        NumBuffers = InNumBuffers;
+        ControlSize = InControlSize;
+        PayloadSize = InPayloadSize;
+        BufferSize = (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + ControlSize + PayloadSize + 15) & ~15u;
+
+        if (NumBuffers == 0 || (NumBuffers & (NumBuffers - 1)) != 0 || NumBuffers > 32768)
+        {
+            return EINVAL;
+        }
+
+        // multishot posts a completion per datagram, size the completion queue to hold as many as there are buffers.
+        // Completions are posted from task work on our thread; cooperative task running saves interrupting it for that,
+        // Drain() runs the work itself when the kernel flags some is pending
+        struct io_uring_params Params;
+        memset(&Params, 0, sizeof(Params));
+        Params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+        Params.cq_entries = NumBuffers;
+
+        RingFd = (int)syscall(__NR_io_uring_setup, 4, &Params);
+        if (RingFd < 0 && errno == EINVAL)
+        {
+            // before 5.19, without the flag the kernel interrupts us to run the task work instead
+            memset(&Params, 0, sizeof(Params));
+            Params.flags = IORING_SETUP_CQSIZE;
+            Params.cq_entries = NumBuffers;
+            RingFd = (int)syscall(__NR_io_uring_setup, 4, &Params);
+        }
+        if (RingFd < 0)
+        {
+            return Fail(errno);
+        }
+        if ((Params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+        {
+            return Fail(EOPNOTSUPP);
+        }
+
+        // submission and completion rings share a mapping
+        size_t SubmissionRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+        size_t CompletionRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+        RingMemorySize = (SubmissionRingSize > CompletionRingSize) ? SubmissionRingSize : CompletionRingSize;
+        RingMemory = mmap(nullptr, RingMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+        if (RingMemory == MAP_FAILED)
+        {
+            return Fail(errno);
+        }
+
+        SubmissionEntriesSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+        SubmissionEntries = mmap(nullptr, SubmissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+        if (SubmissionEntries == MAP_FAILED)
+        {
+            return Fail(errno);
+        }
+
+        char* Ring = (char*)RingMemory;
+        SqTail = (unsigned*)(Ring + Params.sq_off.tail);
+        SqFlags = (unsigned*)(Ring + Params.sq_off.flags);
+        SqMask = *(unsigned*)(Ring + Params.sq_off.ring_mask);
+        SqArray = (unsigned*)(Ring + Params.sq_off.array);
+        CqHead = (unsigned*)(Ring + Params.cq_off.head);
+        CqTail = (unsigned*)(Ring + Params.cq_off.tail);
+        CqMask = *(unsigned*)(Ring + Params.cq_off.ring_mask);
+        Cqes = (struct io_uring_cqe*)(Ring + Params.cq_off.cqes);
+
+        // provided buffer ring, must be page aligned
+        BufferRingSize = NumBuffers * sizeof(struct io_uring_buf);
+        BufferRing = mmap(nullptr, BufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        BuffersSize = (size_t)NumBuffers * BufferSize;
+        Buffers = mmap(nullptr, BuffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (BufferRing == MAP_FAILED || Buffers == MAP_FAILED)
+        {
+            return Fail(ENOMEM);
+        }
+
+        struct io_uring_buf_reg Registration;
+        memset(&Registration, 0, sizeof(Registration));
+        Registration.ring_addr = (unsigned long long)BufferRing;
+        Registration.ring_entries = NumBuffers;
+        Registration.bgid = BufferGroup;
+        if (syscall(__NR_io_uring_register, RingFd, IORING_REGISTER_PBUF_RING, &Registration, 1) < 0)
+        {
+            return Fail(errno);
+        }
+
+        BufferTail = 0;
+        for (unsigned BufferId = 0; BufferId < NumBuffers; ++BufferId)
+        {
+            RecycleBuffer(BufferId);
+        }
+        PublishBuffers();
+
+        // only the lengths matter to multishot recvmsg, the buffer comes from the ring
+        memset(&Template, 0, sizeof(Template));
+        Template.msg_namelen = sizeof(struct sockaddr_in);
+        Template.msg_controllen = ControlSize;
+
+        int Result = Arm();
+        if (Result != 0)
+        {
+            return Fail(Result);
+        }
+
+        // an unsupported opcode or flag fails right on submission, catch it here rather than in the receive loop
+        unsigned Head = *CqHead;
+        if (Head != __atomic_load_n(CqTail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe* Cqe = &Cqes[Head & CqMask];
+            if (Cqe->res < 0 && Cqe->res != -ENOBUFS)
+            {
+                return Fail(-Cqe->res);
+            }
+        }
+
+        return 0;
+    }
+
+    /** File descriptor of the ring, readable while completions are pending */
+    int GetFd() const
+    {
+        return RingFd;
+    }
+
+    /**
+     * Hands up to MaxDatagrams received datagrams to Func(const void* Payload, size_t Length, const sockaddr_in* Addr, struct msghdr* Control)
+     * without blocking, then returns their buffers and re-arms the receive if the kernel stopped it. Control only has
+     * msg_control and msg_controllen filled in, for CMSG_FIRSTHDR() and friends. Nothing is valid after Func returns.
+     *
+     * @return number of datagrams, 0 if none were pending, or -errno if the receive failed
+     */
+    template <typename DatagramFunc>
+    int Drain(DatagramFunc Func, unsigned MaxDatagrams)
+    {
+        unsigned Head = *CqHead;
+        unsigned Tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+        int NumDatagrams = 0, Error = 0;
+
+        // only costs a syscall when there is nothing to drain and the kernel has completions to post
+        if (Head == Tail && (__atomic_load_n(SqFlags, __ATOMIC_RELAXED) & (IORING_SQ_TASKRUN | IORING_SQ_CQ_OVERFLOW)) != 0)
+        {
+            if (syscall(__NR_io_uring_enter, RingFd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            {
+                return -errno;
+            }
+            Tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+        }
+
+        for (; Head != Tail && (unsigned)NumDatagrams < MaxDatagrams; ++Head)
+        {
+            const struct io_uring_cqe* Cqe = &Cqes[Head & CqMask];
+
+            if ((Cqe->flags & IORING_CQE_F_MORE) == 0)
+            {
+                // the kernel stopped receiving, typically because we let it run out of buffers
+                Armed = false;
+            }
+
+            if (Cqe->res < 0)
+            {
+                if (Cqe->res == -ENOBUFS)
+                {
+                    ++NumBufferStalls;
+                }
+                else
+                {
+                    Error = Cqe->res;
+                }
+                continue;
+            }
+
+            if ((Cqe->flags & IORING_CQE_F_BUFFER) == 0)
+            {
+                continue;
+            }
+
+            unsigned BufferId = Cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char* Buffer = (char*)Buffers + (size_t)BufferId * BufferSize;
+            const struct io_uring_recvmsg_out* Out = (const struct io_uring_recvmsg_out*)Buffer;
+
+            // the layout follows the lengths we asked for, whatever the kernel actually used
+            char* Name = Buffer + sizeof(struct io_uring_recvmsg_out);
+            char* ControlData = Name + Template.msg_namelen;
+            char* Payload = ControlData + Template.msg_controllen;
+
+            struct msghdr Control;
+            memset(&Control, 0, sizeof(Control));
+            Control.msg_control = (Out->controllen != 0) ? ControlData : nullptr;
+            Control.msg_controllen = Out->controllen;
+
+            size_t Length = (Out->payloadlen < PayloadSize) ? Out->payloadlen : PayloadSize;
+            Func((const void*)Payload, Length, (const struct sockaddr_in*)Name, &Control);
+
+            RecycleBuffer(BufferId);
+            ++NumDatagrams;
+        }
+
+        __atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+        PublishBuffers();
+
+        if (Error != 0)
+        {
+            return Error;
+        }
+
+        // re-arm only once the completions of the previous receive are all consumed, so none can come after the new ones
+        if (!Armed && Head == __atomic_load_n(CqTail, __ATOMIC_ACQUIRE))
+        {
+            ++NumRearms;
+            int Result = Arm();
+            if (Result != 0)
+            {
+                return -Result;
+            }
+        }
+
+        return NumDatagrams;
+    }
+
+    /** Times the receive was re-armed after the kernel stopped it */
+    unsigned long long NumRearms;
+
+    /** Times the kernel ran out of provided buffers (datagrams wait in the socket buffer meanwhile) */
+    unsigned long long NumBufferStalls;
+
+private:
+
+    /** Queues the multishot recvmsg and submits it. Returns 0 or errno. */
+    int Arm()
+    {
+        unsigned Tail = *SqTail;
+        unsigned Index = Tail & SqMask;
+        struct io_uring_sqe* Sqe = &((struct io_uring_sqe*)SubmissionEntries)[Index];
+
+        memset(Sqe, 0, sizeof(*Sqe));
+        Sqe->opcode = IORING_OP_RECVMSG;
+        Sqe->fd = Socket;
+        Sqe->addr = (unsigned long long)&Template;
+        Sqe->len = 1;
+        Sqe->flags = IOSQE_BUFFER_SELECT;
+        Sqe->buf_group = BufferGroup;
+        Sqe->ioprio = IORING_RECV_MULTISHOT;
+
+        SqArray[Index] = Index;
+        __atomic_store_n(SqTail, Tail + 1, __ATOMIC_RELEASE);
+
+        if (syscall(__NR_io_uring_enter, RingFd, 1, 0, 0, nullptr, 0) < 0)
+        {
+            return errno;
+        }
+
+        Armed = true;
+        return 0;
+    }
+
+    /** Queues a buffer to be given back to the kernel by the next PublishBuffers() */
+    void RecycleBuffer(unsigned BufferId)
+    {
+        // not through io_uring_buf_ring::bufs, the empty struct in front of it takes a byte in C++ and moves it
+        struct io_uring_buf* Entry = (struct io_uring_buf*)BufferRing + (BufferTail & (NumBuffers - 1));
+        Entry->addr = (unsigned long long)((char*)Buffers + (size_t)BufferId * BufferSize);
+        Entry->len = BufferSize;
+        Entry->bid = (unsigned short)BufferId;
+        ++BufferTail;
+    }
+
+    void PublishBuffers()
+    {
+        __atomic_store_n(&((struct io_uring_buf_ring*)BufferRing)->tail, BufferTail, __ATOMIC_RELEASE);
+    }
+
+    /** Releases whatever Init() got so far and returns Error, for a one line bail out */
+    int Fail(int Error)
+    {
+        Release();
+        return Error;
+    }
+
+    void Release()
+    {
+        // closing the ring cancels the receive and unregisters the buffers
+        if (RingFd >= 0)
+        {
+            close(RingFd);
+            RingFd = -1;
+        }
+        if (RingMemory != MAP_FAILED)
+        {
+            munmap(RingMemory, RingMemorySize);
+            RingMemory = MAP_FAILED;
+        }
+        if (SubmissionEntries != MAP_FAILED)
+        {
+            munmap(SubmissionEntries, SubmissionEntriesSize);
+            SubmissionEntries = MAP_FAILED;
+        }
+        if (BufferRing != MAP_FAILED)
+        {
+            munmap(BufferRing, BufferRingSize);
+            BufferRing = MAP_FAILED;
+        }
+        if (Buffers != MAP_FAILED)
+        {
+            munmap(Buffers, BuffersSize);
+            Buffers = MAP_FAILED;
+        }
+    }
+
+    int                     RingFd;
+    void*                   RingMemory;
+    size_t                  RingMemorySize;
+    void*                   SubmissionEntries;
+    size_t                  SubmissionEntriesSize;
+
+    unsigned*               SqTail;
+    unsigned*               SqFlags;
+    unsigned                SqMask;
+    unsigned*               SqArray;
+    unsigned*               CqHead;
+    unsigned*               CqTail;
+    unsigned                CqMask;
+    struct io_uring_cqe*    Cqes;
+
+    void*                   BufferRing;
+    size_t                  BufferRingSize;
+    void*                   Buffers;
+    size_t                  BuffersSize;
+    unsigned                NumBuffers;
+    unsigned                BufferSize;
+    unsigned                ControlSize;
+    unsigned                PayloadSize;
+    /** Our copy of the buffer ring tail, published with PublishBuffers() */
+    unsigned short          BufferTail;
+
+    int                     Socket;
+    /** Lengths of the name and control areas in each buffer, the kernel reads them on every datagram */
+    struct msghdr           Template;
+    bool                    Armed;
+};
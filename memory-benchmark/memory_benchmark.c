@@ -0,0 +1,942 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Memory subsystem benchmark: latency and bandwidth curves over working sets from below L1 to several
+ * times the last level cache. The strided and pointer chase tests are the memory access patterns of the
+ * client's frame work (the original transpose touched 16 MB 256 bytes apart), measured on their own so
+ * that noisy neighbours show up as a shifted curve rather than as slower frames.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "bench_core.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMORY_HAS_X86_SIMD		1
+#else
+#define MEMORY_HAS_X86_SIMD		0
+#endif
+
+/** Working sets are whole pages, which keeps every kernel's blocks aligned too */
+#define MEMORY_PAGE_SIZE		4096UL
+
+/** Default sweep starts well inside L1 */
+#define DEFAULT_MIN_SIZE		(4UL * 1024UL)
+
+/** Default sweep ends at this many times the last level cache */
+#define DEFAULT_LLC_FACTOR		4
+
+/** Default sweep end if the cache sizes cannot be read */
+#define FALLBACK_MAX_SIZE		(256UL * 1024UL * 1024UL)
+
+#define DEFAULT_TRIAL_MS		20
+#define DEFAULT_TRIALS			3
+#define DEFAULT_STRIDES			"64,256,4096"
+#define DEFAULT_TESTS			"latency,stride,bandwidth,scaling"
+
+/** Loads per timed chunk of the pointer chase */
+#define CHASE_CHUNK				4096
+
+/** Accesses per timed chunk of the strided test, small working sets repeat their pass until there are this many */
+#define STRIDE_CHUNK			4096
+
+/** Bytes per timed chunk of the streaming kernels, small working sets repeat their pass until there are this many */
+#define STREAM_CHUNK			(1024UL * 1024UL)
+
+#define MAX_CACHE_LEVELS		4
+
+/** Sizes of the data caches of the CPU we run on, from sysfs */
+struct CacheInfo
+{
+	int NumLevels;
+	size_t Sizes[MAX_CACHE_LEVELS];
+};
+
+enum MemoryOp
+{
+	MemoryOp_Read,
+	MemoryOp_Write,
+	MemoryOp_Copy,
+
+	MemoryOp_Count
+};
+
+static const char* MemoryOpNames[MemoryOp_Count] = { "read", "write", "copy" };
+
+/** Streams over Size bytes of Buffer once: reads it, writes it, or copies its first half into its second. Returns a sum to keep reads alive. */
+typedef unsigned long long (*StreamKernel)(char* Buffer, size_t Size);
+
+struct StreamKernelInfo
+{
+	enum MemoryOp Op;
+	const char* Isa;
+	StreamKernel Kernel;
+	int Available;
+};
+
+/** Runs a streaming kernel over its own buffer, on its own CPU, for the thread scaling test */
+struct ScalingThread
+{
+	pthread_t Thread;
+	/** -1 to leave it to the scheduler */
+	int Cpu;
+	const struct StreamKernelInfo* Kernel;
+	size_t Size;
+	int NumTrials;
+	pthread_barrier_t* Barrier;
+
+	/** Bytes moved and when, per trial */
+	unsigned long long* TrialBytes;
+	unsigned long long* TrialStartNs;
+	unsigned long long* TrialEndNs;
+	unsigned long long Sink;
+	int Failed;
+} BENCH_CACHE_ALIGNED;
+
+struct CacheInfo Caches;
+unsigned long long TrialNs = DEFAULT_TRIAL_MS * 1000000ULL;
+int NumTrials = DEFAULT_TRIALS;
+volatile unsigned long long Sink;
+
+/* Scalar kernels, kept scalar: at -O2 gcc would otherwise vectorize them, or turn them into memset/memcpy */
+#define MEMORY_SCALAR	__attribute__((noinline, optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+
+MEMORY_SCALAR unsigned long long ReadScalar(char* Buffer, size_t Size)
+{
+	const unsigned long long* Words = (const unsigned long long*)Buffer;
+	unsigned long long Sum0 = 0, Sum1 = 0, Sum2 = 0, Sum3 = 0;
+	size_t Idx, NumWords = Size / sizeof(unsigned long long);
+
+	for (Idx = 0; Idx < NumWords; Idx += 4)
+	{
+		Sum0 += Words[Idx];
+		Sum1 += Words[Idx + 1];
+		Sum2 += Words[Idx + 2];
+		Sum3 += Words[Idx + 3];
+	}
+
+	return Sum0 + Sum1 + Sum2 + Sum3;
+}
+
+MEMORY_SCALAR unsigned long long WriteScalar(char* Buffer, size_t Size)
+{
+	unsigned long long* Words = (unsigned long long*)Buffer;
+	size_t Idx, NumWords = Size / sizeof(unsigned long long);
+
+	for (Idx = 0; Idx < NumWords; Idx += 4)
+	{
+		Words[Idx] = Idx;
+		Words[Idx + 1] = Idx;
+		Words[Idx + 2] = Idx;
+		Words[Idx + 3] = Idx;
+	}
+
+	return 0;
+}
+
+MEMORY_SCALAR unsigned long long CopyScalar(char* Buffer, size_t Size)
+{
+	const unsigned long long* Source = (const unsigned long long*)Buffer;
+	unsigned long long* Destination = (unsigned long long*)(Buffer + Size / 2);
+	size_t Idx, NumWords = Size / 2 / sizeof(unsigned long long);
+
+	for (Idx = 0; Idx < NumWords; Idx += 4)
+	{
+		Destination[Idx] = Source[Idx];
+		Destination[Idx + 1] = Source[Idx + 1];
+		Destination[Idx + 2] = Source[Idx + 2];
+		Destination[Idx + 3] = Source[Idx + 3];
+	}
+
+	return 0;
+}
+
+#if MEMORY_HAS_X86_SIMD
+/* SSE2 is part of x86-64, AVX2 is compiled per function and only run where the CPU has it */
+
+unsigned long long ReadSse2(char* Buffer, size_t Size)
+{
+	const __m128i* Vectors = (const __m128i*)Buffer;
+	__m128i Sum0 = _mm_setzero_si128(), Sum1 = _mm_setzero_si128(), Sum2 = _mm_setzero_si128(), Sum3 = _mm_setzero_si128();
+	size_t Idx, NumVectors = Size / sizeof(__m128i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		Sum0 = _mm_add_epi64(Sum0, _mm_load_si128(Vectors + Idx));
+		Sum1 = _mm_add_epi64(Sum1, _mm_load_si128(Vectors + Idx + 1));
+		Sum2 = _mm_add_epi64(Sum2, _mm_load_si128(Vectors + Idx + 2));
+		Sum3 = _mm_add_epi64(Sum3, _mm_load_si128(Vectors + Idx + 3));
+	}
+
+	Sum0 = _mm_add_epi64(_mm_add_epi64(Sum0, Sum1), _mm_add_epi64(Sum2, Sum3));
+	return (unsigned long long)_mm_cvtsi128_si64(Sum0) + (unsigned long long)_mm_cvtsi128_si64(_mm_unpackhi_epi64(Sum0, Sum0));
+}
+
+unsigned long long WriteSse2(char* Buffer, size_t Size)
+{
+	__m128i* Vectors = (__m128i*)Buffer;
+	__m128i Value = _mm_set1_epi64x((long long)Size);
+	size_t Idx, NumVectors = Size / sizeof(__m128i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		_mm_store_si128(Vectors + Idx, Value);
+		_mm_store_si128(Vectors + Idx + 1, Value);
+		_mm_store_si128(Vectors + Idx + 2, Value);
+		_mm_store_si128(Vectors + Idx + 3, Value);
+	}
+
+	return 0;
+}
+
+unsigned long long CopySse2(char* Buffer, size_t Size)
+{
+	const __m128i* Source = (const __m128i*)Buffer;
+	__m128i* Destination = (__m128i*)(Buffer + Size / 2);
+	size_t Idx, NumVectors = Size / 2 / sizeof(__m128i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		_mm_store_si128(Destination + Idx, _mm_load_si128(Source + Idx));
+		_mm_store_si128(Destination + Idx + 1, _mm_load_si128(Source + Idx + 1));
+		_mm_store_si128(Destination + Idx + 2, _mm_load_si128(Source + Idx + 2));
+		_mm_store_si128(Destination + Idx + 3, _mm_load_si128(Source + Idx + 3));
+	}
+
+	return 0;
+}
+
+__attribute__((target("avx2"))) unsigned long long ReadAvx2(char* Buffer, size_t Size)
+{
+	const __m256i* Vectors = (const __m256i*)Buffer;
+	__m256i Sum0 = _mm256_setzero_si256(), Sum1 = _mm256_setzero_si256(), Sum2 = _mm256_setzero_si256(), Sum3 = _mm256_setzero_si256();
+	unsigned long long Lanes[4];
+	size_t Idx, NumVectors = Size / sizeof(__m256i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		Sum0 = _mm256_add_epi64(Sum0, _mm256_load_si256(Vectors + Idx));
+		Sum1 = _mm256_add_epi64(Sum1, _mm256_load_si256(Vectors + Idx + 1));
+		Sum2 = _mm256_add_epi64(Sum2, _mm256_load_si256(Vectors + Idx + 2));
+		Sum3 = _mm256_add_epi64(Sum3, _mm256_load_si256(Vectors + Idx + 3));
+	}
+
+	_mm256_storeu_si256((__m256i*)Lanes, _mm256_add_epi64(_mm256_add_epi64(Sum0, Sum1), _mm256_add_epi64(Sum2, Sum3)));
+	return Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3];
+}
+
+__attribute__((target("avx2"))) unsigned long long WriteAvx2(char* Buffer, size_t Size)
+{
+	__m256i* Vectors = (__m256i*)Buffer;
+	__m256i Value = _mm256_set1_epi64x((long long)Size);
+	size_t Idx, NumVectors = Size / sizeof(__m256i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		_mm256_store_si256(Vectors + Idx, Value);
+		_mm256_store_si256(Vectors + Idx + 1, Value);
+		_mm256_store_si256(Vectors + Idx + 2, Value);
+		_mm256_store_si256(Vectors + Idx + 3, Value);
+	}
+
+	return 0;
+}
+
+__attribute__((target("avx2"))) unsigned long long CopyAvx2(char* Buffer, size_t Size)
+{
+	const __m256i* Source = (const __m256i*)Buffer;
+	__m256i* Destination = (__m256i*)(Buffer + Size / 2);
+	size_t Idx, NumVectors = Size / 2 / sizeof(__m256i);
+
+	for (Idx = 0; Idx < NumVectors; Idx += 4)
+	{
+		_mm256_store_si256(Destination + Idx, _mm256_load_si256(Source + Idx));
+		_mm256_store_si256(Destination + Idx + 1, _mm256_load_si256(Source + Idx + 1));
+		_mm256_store_si256(Destination + Idx + 2, _mm256_load_si256(Source + Idx + 2));
+		_mm256_store_si256(Destination + Idx + 3, _mm256_load_si256(Source + Idx + 3));
+	}
+
+	return 0;
+}
+#endif /* MEMORY_HAS_X86_SIMD */
+
+struct StreamKernelInfo Kernels[] =
+{
+	{ MemoryOp_Read, "scalar", ReadScalar, 1 },
+	{ MemoryOp_Write, "scalar", WriteScalar, 1 },
+	{ MemoryOp_Copy, "scalar", CopyScalar, 1 },
+#if MEMORY_HAS_X86_SIMD
+	{ MemoryOp_Read, "sse2", ReadSse2, 1 },
+	{ MemoryOp_Write, "sse2", WriteSse2, 1 },
+	{ MemoryOp_Copy, "sse2", CopySse2, 1 },
+	{ MemoryOp_Read, "avx2", ReadAvx2, 0 },
+	{ MemoryOp_Write, "avx2", WriteAvx2, 0 },
+	{ MemoryOp_Copy, "avx2", CopyAvx2, 0 },
+#endif
+};
+
+#define NUM_KERNELS		((int)(sizeof(Kernels) / sizeof(Kernels[0])))
+
+/** Marks the kernels the CPU can run. */
+void DetectKernels(void)
+{
+#if MEMORY_HAS_X86_SIMD
+	int IdxKernel;
+
+	__builtin_cpu_init();
+	for (IdxKernel = 0; IdxKernel < NUM_KERNELS; ++IdxKernel)
+	{
+		if (strcmp(Kernels[IdxKernel].Isa, "avx2") == 0)
+		{
+			Kernels[IdxKernel].Available = __builtin_cpu_supports("avx2");
+		}
+	}
+#endif
+}
+
+/** The widest kernel of an op the CPU can run, kernels are listed from narrowest to widest. */
+const struct StreamKernelInfo* WidestKernel(enum MemoryOp Op)
+{
+	const struct StreamKernelInfo* Widest = NULL;
+	int IdxKernel;
+
+	for (IdxKernel = 0; IdxKernel < NUM_KERNELS; ++IdxKernel)
+	{
+		if (Kernels[IdxKernel].Op == Op && Kernels[IdxKernel].Available)
+		{
+			Widest = &Kernels[IdxKernel];
+		}
+	}
+
+	return Widest;
+}
+
+/** Reads the data and unified cache sizes of Cpu from sysfs, ordered by level. Returns the number of levels found. */
+int ReadCacheInfo(int Cpu, struct CacheInfo* Info)
+{
+	char Path[256], Type[32], Unit = 0;
+	unsigned long Size;
+	int IdxCache, Level;
+	FILE* File;
+
+	memset(Info, 0, sizeof(*Info));
+	for (IdxCache = 0; ; ++IdxCache)
+	{
+		snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", Cpu, IdxCache);
+		File = fopen(Path, "r");
+		if (File == NULL)
+		{
+			break;
+		}
+		Type[0] = 0;
+		if (fscanf(File, "%31s", Type) != 1)
+		{
+			Type[0] = 0;
+		}
+		fclose(File);
+		if (strcmp(Type, "Instruction") == 0)
+		{
+			continue;
+		}
+
+		snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", Cpu, IdxCache);
+		File = fopen(Path, "r");
+		if (File == NULL || fscanf(File, "%d", &Level) != 1 || Level < 1 || Level > MAX_CACHE_LEVELS)
+		{
+			if (File != NULL)
+			{
+				fclose(File);
+			}
+			continue;
+		}
+		fclose(File);
+
+		snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", Cpu, IdxCache);
+		File = fopen(Path, "r");
+		if (File == NULL || fscanf(File, "%lu%c", &Size, &Unit) < 1)
+		{
+			if (File != NULL)
+			{
+				fclose(File);
+			}
+			continue;
+		}
+		fclose(File);
+
+		Info->Sizes[Level - 1] = Size * ((Unit == 'K') ? 1024UL : (Unit == 'M') ? 1024UL * 1024UL : 1UL);
+		Info->NumLevels = (Level > Info->NumLevels) ? Level : Info->NumLevels;
+	}
+
+	return Info->NumLevels;
+}
+
+/** Smallest cache level a working set fits in, as printed with the results. */
+const char* CacheLevelName(size_t Size)
+{
+	static const char* Names[MAX_CACHE_LEVELS] = { "L1", "L2", "L3", "L4" };
+	int IdxLevel;
+
+	for (IdxLevel = 0; IdxLevel < Caches.NumLevels; ++IdxLevel)
+	{
+		if (Caches.Sizes[IdxLevel] > 0 && Size <= Caches.Sizes[IdxLevel])
+		{
+			return Names[IdxLevel];
+		}
+	}
+
+	return "DRAM";
+}
+
+/** Next working set of the sweep: powers of two with one step halfway (by factor 1.5) in between. */
+size_t NextSize(size_t Size)
+{
+	size_t PowerOfTwo = 1;
+
+	while (PowerOfTwo * 2 <= Size)
+	{
+		PowerOfTwo *= 2;
+	}
+
+	return (Size < PowerOfTwo + PowerOfTwo / 2) ? PowerOfTwo + PowerOfTwo / 2 : PowerOfTwo * 2;
+}
+
+/** xorshift64, good enough for access patterns. */
+static inline unsigned long long NextRandom(unsigned long long* State)
+{
+	*State ^= *State << 13;
+	*State ^= *State >> 7;
+	*State ^= *State << 17;
+	return *State;
+}
+
+/**
+ * Links the cache lines of the first Size bytes of Buffer into one random cycle (Sattolo's shuffle), each line
+ * pointing to the next. Random across pages too, so large working sets pay for TLB misses as real data does.
+ */
+void BuildChase(char* Buffer, size_t Size)
+{
+	size_t NumLines = Size / BENCH_CACHE_LINE_SIZE, IdxLine, Other, Temp;
+	size_t* Order = (size_t*)malloc(NumLines * sizeof(size_t));
+	unsigned long long Random = 0x9E3779B97F4A7C15ULL;
+
+	for (IdxLine = 0; IdxLine < NumLines; ++IdxLine)
+	{
+		Order[IdxLine] = IdxLine;
+	}
+	for (IdxLine = NumLines - 1; IdxLine > 0; --IdxLine)
+	{
+		Other = NextRandom(&Random) % IdxLine;
+		Temp = Order[IdxLine];
+		Order[IdxLine] = Order[Other];
+		Order[Other] = Temp;
+	}
+	for (IdxLine = 0; IdxLine < NumLines; ++IdxLine)
+	{
+		*(char**)(Buffer + Order[IdxLine] * BENCH_CACHE_LINE_SIZE) = Buffer + Order[(IdxLine + 1) % NumLines] * BENCH_CACHE_LINE_SIZE;
+	}
+
+	free(Order);
+}
+
+/** Average ns per load of a pointer chase started at Start, over TrialNs. */
+double TimeChase(char* Start)
+{
+	unsigned long long StartNs, EndNs, NumLoads = 0;
+	char* Current = Start;
+	int IdxLoad;
+
+	StartNs = GetTimeInNs();
+	do
+	{
+		for (IdxLoad = 0; IdxLoad < CHASE_CHUNK; IdxLoad += 8)
+		{
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+			Current = *(char**)Current;
+		}
+		NumLoads += CHASE_CHUNK;
+		EndNs = GetTimeInNs();
+	}
+	while (EndNs - StartNs < TrialNs);
+
+	Sink += (unsigned long long)(uintptr_t)Current;
+	return (double)(EndNs - StartNs) / (double)NumLoads;
+}
+
+/** Average ns per access of read-modify-writes of one byte every Stride bytes of Size, over TrialNs. */
+double TimeStrided(char* Buffer, size_t Size, size_t Stride)
+{
+	unsigned long long StartNs, EndNs, NumAccesses = 0;
+	volatile char* Bytes = (volatile char*)Buffer;
+	size_t Offset, AccessesPerPass = (Size + Stride - 1) / Stride;
+	size_t IdxPass, NumPasses = (STRIDE_CHUNK + AccessesPerPass - 1) / AccessesPerPass;
+
+	/* the clock is read once per chunk, reading it after a pass of a few accesses would mostly time the clock */
+	StartNs = GetTimeInNs();
+	do
+	{
+		for (IdxPass = 0; IdxPass < NumPasses; ++IdxPass)
+		{
+			for (Offset = 0; Offset < Size; Offset += Stride)
+			{
+				Bytes[Offset]++;
+			}
+		}
+		NumAccesses += NumPasses * AccessesPerPass;
+		EndNs = GetTimeInNs();
+	}
+	while (EndNs - StartNs < TrialNs);
+
+	return (double)(EndNs - StartNs) / (double)NumAccesses;
+}
+
+/** Runs a streaming kernel over Size bytes for at least Duration ns, returns bytes moved and when it ended. */
+unsigned long long RunStream(const struct StreamKernelInfo* Kernel, char* Buffer, size_t Size, unsigned long long StartNs, unsigned long long Duration,
+	unsigned long long* EndNs, unsigned long long* Sum)
+{
+	unsigned long long NumBytes = 0;
+	size_t IdxPass, NumPasses = (STREAM_CHUNK + Size - 1) / Size;
+
+	do
+	{
+		for (IdxPass = 0; IdxPass < NumPasses; ++IdxPass)
+		{
+			*Sum += Kernel->Kernel(Buffer, Size);
+		}
+		NumBytes += NumPasses * Size;
+		*EndNs = GetTimeInNs();
+	}
+	while (*EndNs - StartNs < Duration);
+
+	return NumBytes;
+}
+
+void TestLatency(char* Buffer, size_t MinSize, size_t MaxSize)
+{
+	struct StabilityParams Params;
+	size_t Size;
+	int IdxTrial;
+
+	for (Size = MinSize; Size <= MaxSize; Size = NextSize(Size))
+	{
+		BuildChase(Buffer, Size);
+		TimeChase(Buffer);
+
+		memset(&Params, 0, sizeof(Params));
+		for (IdxTrial = 0; IdxTrial < NumTrials; ++IdxTrial)
+		{
+			UpdateObservation(&Params, TimeChase(Buffer));
+		}
+
+		printf("Latency, WorkingSet(KB), %lu, Level, %s, NsPerLoad, ", (unsigned long)(Size / 1024UL), CacheLevelName(Size));
+		PrintValues(&Params, "ns");
+		printf("\n");
+		fflush(stdout);
+	}
+}
+
+void TestStrided(char* Buffer, size_t MinSize, size_t MaxSize, const char* Strides)
+{
+	struct StabilityParams Params;
+	char* StrideList = strdup(Strides);
+	char* Cursor = StrideList;
+	char* Token;
+	size_t Size, Stride;
+	int IdxTrial;
+
+	while ((Token = strsep(&Cursor, ",")) != NULL)
+	{
+		Stride = strtoul(Token, NULL, 10);
+		if (Stride == 0)
+		{
+			continue;
+		}
+
+		for (Size = MinSize; Size <= MaxSize; Size = NextSize(Size))
+		{
+			TimeStrided(Buffer, Size, Stride);
+
+			memset(&Params, 0, sizeof(Params));
+			for (IdxTrial = 0; IdxTrial < NumTrials; ++IdxTrial)
+			{
+				UpdateObservation(&Params, TimeStrided(Buffer, Size, Stride));
+			}
+
+			printf("Stride, Stride(B), %lu, WorkingSet(KB), %lu, Level, %s, NsPerAccess, ", (unsigned long)Stride, (unsigned long)(Size / 1024UL), CacheLevelName(Size));
+			PrintValues(&Params, "ns");
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	free(StrideList);
+}
+
+void TestBandwidth(char* Buffer, size_t MinSize, size_t MaxSize)
+{
+	struct StabilityParams Params;
+	unsigned long long StartNs, EndNs, NumBytes, Sum = 0;
+	size_t Size;
+	int IdxKernel, IdxTrial;
+
+	for (IdxKernel = 0; IdxKernel < NUM_KERNELS; ++IdxKernel)
+	{
+		const struct StreamKernelInfo* Kernel = &Kernels[IdxKernel];
+		if (!Kernel->Available)
+		{
+			continue;
+		}
+
+		for (Size = MinSize; Size <= MaxSize; Size = NextSize(Size))
+		{
+			/* one pass to warm the caches up to this working set */
+			Sum += Kernel->Kernel(Buffer, Size);
+
+			memset(&Params, 0, sizeof(Params));
+			for (IdxTrial = 0; IdxTrial < NumTrials; ++IdxTrial)
+			{
+				StartNs = GetTimeInNs();
+				NumBytes = RunStream(Kernel, Buffer, Size, StartNs, TrialNs, &EndNs, &Sum);
+				UpdateObservation(&Params, (double)NumBytes / (double)(EndNs - StartNs));
+			}
+
+			printf("Bandwidth, Op, %s, Isa, %s, WorkingSet(KB), %lu, Level, %s, ", MemoryOpNames[Kernel->Op], Kernel->Isa,
+				(unsigned long)(Size / 1024UL), CacheLevelName(Size));
+			PrintValues(&Params, "GB/s");
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	Sink += Sum;
+}
+
+/** Streams over its own buffer, touched from its own CPU so it is local to it, in trials started together with the other threads. */
+void* ScalingThreadFunc(void* Arg)
+{
+	struct ScalingThread* Thread = (struct ScalingThread*)Arg;
+	char* Buffer = NULL;
+	int IdxTrial;
+
+	if (Thread->Cpu >= 0)
+	{
+		PinThreadToCpu(Thread->Cpu);
+	}
+
+	if (posix_memalign((void**)&Buffer, MEMORY_PAGE_SIZE, Thread->Size) != 0)
+	{
+		Thread->Failed = 1;
+		Buffer = NULL;
+	}
+	else
+	{
+		memset(Buffer, 1, Thread->Size);
+		Thread->Sink += Thread->Kernel->Kernel(Buffer, Thread->Size);
+	}
+
+	for (IdxTrial = 0; IdxTrial < Thread->NumTrials; ++IdxTrial)
+	{
+		pthread_barrier_wait(Thread->Barrier);
+		Thread->TrialStartNs[IdxTrial] = GetTimeInNs();
+		Thread->TrialEndNs[IdxTrial] = Thread->TrialStartNs[IdxTrial];
+		if (Buffer != NULL)
+		{
+			Thread->TrialBytes[IdxTrial] = RunStream(Thread->Kernel, Buffer, Thread->Size, Thread->TrialStartNs[IdxTrial], TrialNs,
+				&Thread->TrialEndNs[IdxTrial], &Thread->Sink);
+		}
+	}
+
+	free(Buffer);
+	return NULL;
+}
+
+/**
+ * Runs the widest kernel of each op on 1 to MaxThreads threads at once, each pinned to its own CPU where there
+ * are enough. Working sets add up to at least TotalSize, so that together they never fit the last level cache,
+ * and each is at least a few times L2 so that it never fits a core's private caches either.
+ */
+void TestScaling(size_t TotalSize, int MaxThreads, const int* Cpus, int NumCpus)
+{
+	struct ScalingThread* Threads;
+	struct StabilityParams Params;
+	pthread_barrier_t Barrier;
+	unsigned long long StartNs, EndNs, NumBytes;
+	double SingleGBPerSec = 0, GBPerSec;
+	size_t Size;
+	int Op, NumThreads, IdxThread, IdxTrial, NumFailed, Result;
+
+	Threads = (struct ScalingThread*)aligned_alloc(BENCH_CACHE_LINE_SIZE, MaxThreads * sizeof(struct ScalingThread));
+	if (Threads == NULL)
+	{
+		fprintf(stderr, "Could not allocate %d scaling threads\n", MaxThreads);
+		exit(1);
+	}
+
+	for (Op = 0; Op < MemoryOp_Count; ++Op)
+	{
+		const struct StreamKernelInfo* Kernel = WidestKernel((enum MemoryOp)Op);
+
+		for (NumThreads = 1; NumThreads <= MaxThreads; ++NumThreads)
+		{
+			Size = TotalSize / NumThreads;
+			Size = (Caches.NumLevels >= 2 && Size < 4 * Caches.Sizes[1]) ? 4 * Caches.Sizes[1] : Size;
+			Size = (Size + MEMORY_PAGE_SIZE - 1) & ~(MEMORY_PAGE_SIZE - 1);
+
+			memset(Threads, 0, NumThreads * sizeof(struct ScalingThread));
+			pthread_barrier_init(&Barrier, NULL, NumThreads);
+			for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+			{
+				struct ScalingThread* Thread = &Threads[IdxThread];
+				Thread->Cpu = (NumCpus > 0) ? Cpus[IdxThread % NumCpus] : -1;
+				Thread->Kernel = Kernel;
+				Thread->Size = Size;
+				Thread->NumTrials = NumTrials;
+				Thread->Barrier = &Barrier;
+				Thread->TrialBytes = (unsigned long long*)calloc(NumTrials, sizeof(unsigned long long));
+				Thread->TrialStartNs = (unsigned long long*)calloc(NumTrials, sizeof(unsigned long long));
+				Thread->TrialEndNs = (unsigned long long*)calloc(NumTrials, sizeof(unsigned long long));
+				if (Thread->TrialBytes == NULL || Thread->TrialStartNs == NULL || Thread->TrialEndNs == NULL)
+				{
+					fprintf(stderr, "Could not allocate %d trials for scaling thread %d\n", NumTrials, IdxThread);
+					exit(1);
+				}
+				/* the others already wait on the barrier for this one, there is no way to go on without it */
+				Result = pthread_create(&Thread->Thread, NULL, ScalingThreadFunc, Thread);
+				if (Result != 0)
+				{
+					fprintf(stderr, "Could not start scaling thread %d of %d, error %d (%s)\n", IdxThread, NumThreads, Result, strerror(Result));
+					exit(1);
+				}
+			}
+
+			NumFailed = 0;
+			for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+			{
+				pthread_join(Threads[IdxThread].Thread, NULL);
+				NumFailed += Threads[IdxThread].Failed;
+				Sink += Threads[IdxThread].Sink;
+			}
+			pthread_barrier_destroy(&Barrier);
+
+			/* a trial spans from the first thread starting to the last one finishing */
+			memset(&Params, 0, sizeof(Params));
+			for (IdxTrial = 0; IdxTrial < NumTrials; ++IdxTrial)
+			{
+				StartNs = ~0ULL;
+				EndNs = 0;
+				NumBytes = 0;
+				for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+				{
+					StartNs = (Threads[IdxThread].TrialStartNs[IdxTrial] < StartNs) ? Threads[IdxThread].TrialStartNs[IdxTrial] : StartNs;
+					EndNs = (Threads[IdxThread].TrialEndNs[IdxTrial] > EndNs) ? Threads[IdxThread].TrialEndNs[IdxTrial] : EndNs;
+					NumBytes += Threads[IdxThread].TrialBytes[IdxTrial];
+				}
+				UpdateObservation(&Params, (EndNs > StartNs) ? (double)NumBytes / (double)(EndNs - StartNs) : 0.0);
+			}
+			for (IdxThread = 0; IdxThread < NumThreads; ++IdxThread)
+			{
+				free(Threads[IdxThread].TrialBytes);
+				free(Threads[IdxThread].TrialStartNs);
+				free(Threads[IdxThread].TrialEndNs);
+			}
+
+			if (NumFailed > 0)
+			{
+				fprintf(stderr, "Could not allocate %lu KB for %d of %d threads\n", (unsigned long)(Size / 1024UL), NumFailed, NumThreads);
+				break;
+			}
+
+			GBPerSec = Params.Mean;
+			SingleGBPerSec = (NumThreads == 1) ? GBPerSec : SingleGBPerSec;
+			printf("Scaling, Op, %s, Isa, %s, Threads, %d, Pinned, %s, WorkingSetPerThread(KB), %lu, ", MemoryOpNames[Op], Kernel->Isa, NumThreads,
+				(NumCpus <= 0) ? "no" : (NumThreads > NumCpus) ? "shared" : "yes", (unsigned long)(Size / 1024UL));
+			PrintValues(&Params, "GB/s");
+			printf(", PerThread(GB/s), %.2f, Efficiency(%%), %.1f\n", GBPerSec / NumThreads,
+				(SingleGBPerSec > 0) ? 100.0 * GBPerSec / (SingleGBPerSec * NumThreads) : 0.0);
+			fflush(stdout);
+		}
+	}
+
+	free(Threads);
+}
+
+void PrintUsage(const char* Name)
+{
+	printf("Usage: %s [-b tests] [-m min_kb] [-M max_kb] [-x factor] [-s stride,...] [-j threads] [-t ms] [-r trials]\n", Name);
+	printf("  -b tests      comma separated, out of %s (default all of them)\n", DEFAULT_TESTS);
+	printf("  -m kb         smallest working set of the sweep (default %lu)\n", DEFAULT_MIN_SIZE / 1024UL);
+	printf("  -M kb         largest working set of the sweep (default factor times the last level cache)\n");
+	printf("  -x factor     largest working set in multiples of the last level cache, unless given with -M (default %d)\n", DEFAULT_LLC_FACTOR);
+	printf("  -s bytes      strides of the strided test (default %s)\n", DEFAULT_STRIDES);
+	printf("  -j count      most threads of the scaling test, added one at a time (default: one per allowed cpu)\n");
+	printf("  -t ms         length of each timed trial (default %d)\n", DEFAULT_TRIAL_MS);
+	printf("  -r count      trials per point, min, max and mean are printed (default %d)\n", DEFAULT_TRIALS);
+}
+
+int main(int argc, char* const argv[])
+{
+	const char* Tests = DEFAULT_TESTS;
+	const char* Strides = DEFAULT_STRIDES;
+	size_t MinSize = DEFAULT_MIN_SIZE, MaxSize = 0, MemorySize;
+	int LlcFactor = DEFAULT_LLC_FACTOR, MaxThreads = 0, NumCpus, IdxLevel, IdxKernel, Opt;
+	int Cpus[CPU_SETSIZE];
+	char* Buffer = NULL;
+
+	setlinebuf(stdout);
+
+	while ((Opt = getopt(argc, argv, "b:m:M:x:s:j:t:r:h")) != -1)
+	{
+		switch (Opt)
+		{
+			case 'b':
+				Tests = optarg;
+				break;
+			case 'm':
+				MinSize = strtoul(optarg, NULL, 10) * 1024UL;
+				break;
+			case 'M':
+				MaxSize = strtoul(optarg, NULL, 10) * 1024UL;
+				break;
+			case 'x':
+				LlcFactor = atoi(optarg);
+				break;
+			case 's':
+				Strides = optarg;
+				break;
+			case 'j':
+				MaxThreads = atoi(optarg);
+				break;
+			case 't':
+				TrialNs = strtoull(optarg, NULL, 10) * 1000000ULL;
+				break;
+			case 'r':
+				NumTrials = atoi(optarg);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	NumCpus = GetAllowedCpus(Cpus, CPU_SETSIZE);
+	if (MaxThreads <= 0)
+	{
+		MaxThreads = (NumCpus > 0) ? NumCpus : 1;
+	}
+
+	if (MinSize < MEMORY_PAGE_SIZE || LlcFactor < 1 || NumTrials < 1 || TrialNs == 0)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	/* single threaded tests run on the first allowed cpu, the caches are that cpu's */
+	if (NumCpus > 0)
+	{
+		PinThreadToCpu(Cpus[0]);
+	}
+	ReadCacheInfo((NumCpus > 0) ? Cpus[0] : 0, &Caches);
+	for (IdxLevel = 0; IdxLevel < Caches.NumLevels; ++IdxLevel)
+	{
+		printf("Cache, L%d, Size(KB), %lu\n", IdxLevel + 1, (unsigned long)(Caches.Sizes[IdxLevel] / 1024UL));
+	}
+
+	if (MaxSize == 0)
+	{
+		MaxSize = (Caches.NumLevels > 0) ? Caches.Sizes[Caches.NumLevels - 1] * LlcFactor : FALLBACK_MAX_SIZE;
+
+		/* large last level caches times the factor can be more than a small VM has */
+		MemorySize = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+		if (MemorySize > 0 && MaxSize > MemorySize / 4)
+		{
+			MaxSize = MemorySize / 4;
+			printf("Largest working set limited to a quarter of memory\n");
+		}
+	}
+	MaxSize &= ~(MEMORY_PAGE_SIZE - 1);
+	if (MaxSize < MinSize)
+	{
+		MaxSize = MinSize;
+	}
+
+	DetectKernels();
+	printf("Sweep, MinWorkingSet(KB), %lu, MaxWorkingSet(KB), %lu, Trials, %d, Trial(ms), %llu, Kernels,", (unsigned long)(MinSize / 1024UL),
+		(unsigned long)(MaxSize / 1024UL), NumTrials, TrialNs / 1000000ULL);
+	for (IdxKernel = 0; IdxKernel < NUM_KERNELS; ++IdxKernel)
+	{
+		if (Kernels[IdxKernel].Available)
+		{
+			printf(" %s-%s", MemoryOpNames[Kernels[IdxKernel].Op], Kernels[IdxKernel].Isa);
+		}
+	}
+	printf("\n");
+	printf("Bandwidth counts bytes read plus bytes written, a copy of a working set moves half of it each way\n");
+
+	if (posix_memalign((void**)&Buffer, MEMORY_PAGE_SIZE, MaxSize) != 0)
+	{
+		fprintf(stderr, "Could not allocate %lu KB\n", (unsigned long)(MaxSize / 1024UL));
+		return 1;
+	}
+	memset(Buffer, 1, MaxSize);
+
+	if (strstr(Tests, "latency") != NULL)
+	{
+		TestLatency(Buffer, MinSize, MaxSize);
+	}
+	if (strstr(Tests, "stride") != NULL)
+	{
+		memset(Buffer, 1, MaxSize);
+		TestStrided(Buffer, MinSize, MaxSize, Strides);
+	}
+	if (strstr(Tests, "bandwidth") != NULL)
+	{
+		TestBandwidth(Buffer, MinSize, MaxSize);
+	}
+	free(Buffer);
+
+	if (strstr(Tests, "scaling") != NULL)
+	{
+		TestScaling(MaxSize, MaxThreads, NumCpus > 0 ? Cpus : NULL, NumCpus);
+	}
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Queries a binary time series written by ds_benchmark_server or clock_stability: merges the periods of each
+ * series within a time range, optionally into fixed windows, and prints them labelled like the tools do, or as CSV.
+ * Records are appended in time order, so the start of the range is found by bisection and the scan stops
+ * at its end; the file is only mapped, never read whole.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench_core.h"
+#include "series.h"
+
+/** Periods of one series merged over a window */
+struct Aggregate
+{
+	unsigned long long WindowNs;
+	unsigned long long FirstNs, LastNs;
+	unsigned long long NumRecords;
+	struct StabilityParams Params;
+	unsigned long long Counts[SERIES_NUM_BUCKETS];
+};
+
+/** Set from the command line */
+int Csv = 0;
+const struct SeriesFileHeader* Header = NULL;
+
+/** Parses a time given as unix seconds, or as seconds before LastNs if negative. */
+unsigned long long ParseTime(const char* Arg, unsigned long long LastNs)
+{
+	double Seconds = atof(Arg);
+
+	if (Seconds < 0)
+	{
+		return (LastNs > (unsigned long long)(-Seconds * 1e9)) ? LastNs - (unsigned long long)(-Seconds * 1e9) : 0;
+	}
+	return (unsigned long long)(Seconds * 1e9);
+}
+
+/** Prints the aggregate and starts it over. */
+void Flush(struct Aggregate* Aggregate, unsigned int Series)
+{
+	const char* Unit = Header->Units[Series];
+	double UnitNs = Header->UnitNs[Series];
+	double StdDev = (Aggregate->Params.NumObservations > 1) ? sqrt(Aggregate->Params.Mean2 / (Aggregate->Params.NumObservations - 1)) : 0;
+	int IdxPercentile;
+	static const double Percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+
+	if (Aggregate->NumRecords == 0)
+	{
+		return;
+	}
+
+	if (Csv)
+	{
+		printf("%.3f,%.3f,%s,%s,%llu,%.0f,%.9g,%.9g,%.9g,%.9g",
+			(double)Aggregate->FirstNs / 1e9, (double)Aggregate->LastNs / 1e9, Header->Names[Series], Unit, Aggregate->NumRecords,
+			Aggregate->Params.NumObservations, Aggregate->Params.Mean, StdDev, Aggregate->Params.Min, Aggregate->Params.Max);
+		for (IdxPercentile = 0; IdxPercentile < (int)(sizeof(Percentiles) / sizeof(Percentiles[0])); ++IdxPercentile)
+		{
+			printf(",%.9g", SeriesPercentile(Aggregate->Counts, Percentiles[IdxPercentile]) / UnitNs);
+		}
+		printf("\n");
+	}
+	else
+	{
+		printf("Series, %s, Records, %llu, ", Header->Names[Series], Aggregate->NumRecords);
+		PrintValues(&Aggregate->Params, Unit);
+		for (IdxPercentile = 0; IdxPercentile < (int)(sizeof(Percentiles) / sizeof(Percentiles[0])); ++IdxPercentile)
+		{
+			printf(", P%g(%s), %.3f", Percentiles[IdxPercentile], Unit, SeriesPercentile(Aggregate->Counts, Percentiles[IdxPercentile]) / UnitNs);
+		}
+		/* asctime() supplies the newline */
+		printf(", From, %.24s, To, %s", UtcTimeStringAt(Aggregate->FirstNs), UtcTimeStringAt(Aggregate->LastNs));
+	}
+
+	memset(Aggregate, 0, sizeof(*Aggregate));
+}
+
+void PrintUsage(const char* Name)
+{
+	printf("Usage: %s [-s series] [-f from] [-t to] [-a seconds] [-c] series_file\n", Name);
+	printf("  -s   only this series (default: all)\n");
+	printf("  -f   start of the range, unix seconds, or seconds before the last record if negative (default: first record)\n");
+	printf("  -t   end of the range, same format (default: last record)\n");
+	printf("  -a   merge periods into windows of this many seconds (default: the whole range at once)\n");
+	printf("  -c   print CSV instead of labelled values\n");
+}
+
+int main(int argc, char* const argv[])
+{
+	const char *SeriesName = NULL, *FromArg = NULL, *ToArg = NULL;
+	unsigned long long WindowNs = 0, FromNs = 0, ToNs = ~0ULL, NumRecords, Low, High, Idx;
+	const struct SeriesRecord* Records;
+	static struct Aggregate Aggregates[SERIES_MAX_SERIES];
+	struct stat Stat;
+	int Option, Fd, OnlySeries = -1;
+	unsigned int IdxSeries;
+	void* Map;
+
+	while ((Option = getopt(argc, argv, "s:f:t:a:ch")) != -1)
+	{
+		switch (Option)
+		{
+			case 's':
+				SeriesName = optarg;
+				break;
+			case 'f':
+				FromArg = optarg;
+				break;
+			case 't':
+				ToArg = optarg;
+				break;
+			case 'a':
+				WindowNs = (unsigned long long)(atof(optarg) * 1e9);
+				break;
+			case 'c':
+				Csv = 1;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return (Option == 'h') ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	Fd = open(argv[optind], O_RDONLY);
+	if (Fd < 0 || fstat(Fd, &Stat) != 0)
+	{
+		fprintf(stderr, "Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (Stat.st_size < SERIES_HEADER_SIZE)
+	{
+		fprintf(stderr, "%s is not a series file\n", argv[optind]);
+		return 1;
+	}
+
+	Map = mmap(NULL, Stat.st_size, PROT_READ, MAP_SHARED, Fd, 0);
+	if (Map == MAP_FAILED)
+	{
+		perror("Cannot map series file");
+		return 1;
+	}
+	Header = (const struct SeriesFileHeader*)Map;
+
+	if (memcmp(Header->Magic, SERIES_FILE_MAGIC, sizeof(Header->Magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a series file\n", argv[optind]);
+		return 1;
+	}
+
+	if (Header->Version != SERIES_FILE_VERSION || Header->RecordSize != sizeof(struct SeriesRecord) || Header->NumBuckets != SERIES_NUM_BUCKETS ||
+		Header->NumSeries > SERIES_MAX_SERIES)
+	{
+		fprintf(stderr, "%s has series version %u with %u byte records, expected version %d with %d byte records\n",
+			argv[optind], Header->Version, Header->RecordSize, SERIES_FILE_VERSION, (int)sizeof(struct SeriesRecord));
+		return 1;
+	}
+
+	/* a writer that is still running may have grown the file past the records it completed */
+	NumRecords = __atomic_load_n(&Header->NumRecords, __ATOMIC_ACQUIRE);
+	if (SERIES_HEADER_SIZE + NumRecords * sizeof(struct SeriesRecord) > (unsigned long long)Stat.st_size)
+	{
+		NumRecords = (Stat.st_size - SERIES_HEADER_SIZE) / sizeof(struct SeriesRecord);
+	}
+	Records = (const struct SeriesRecord*)((const char*)Map + SERIES_HEADER_SIZE);
+	madvise(Map, Stat.st_size, MADV_SEQUENTIAL);
+
+	if (SeriesName != NULL)
+	{
+		for (IdxSeries = 0; IdxSeries < Header->NumSeries; ++IdxSeries)
+		{
+			if (strncmp(Header->Names[IdxSeries], SeriesName, sizeof(Header->Names[IdxSeries])) == 0)
+			{
+				OnlySeries = (int)IdxSeries;
+			}
+		}
+		if (OnlySeries < 0)
+		{
+			fprintf(stderr, "No series '%s' in %s\n", SeriesName, argv[optind]);
+			return 1;
+		}
+	}
+
+	if (NumRecords > 0)
+	{
+		if (FromArg != NULL)
+		{
+			FromNs = ParseTime(FromArg, Records[NumRecords - 1].RealTimeNs);
+		}
+		if (ToArg != NULL)
+		{
+			ToNs = ParseTime(ToArg, Records[NumRecords - 1].RealTimeNs);
+		}
+	}
+
+	if (Csv)
+	{
+		printf("From,To,Series,Unit,Records,Count,Mean,StdDev,Min,Max,P50,P90,P99,P99.9,P99.99\n");
+	}
+	else
+	{
+		printf("Tool, %.32s, Records, %llu\n", Header->Tool, NumRecords);
+	}
+
+	/* first record at or after FromNs */
+	Low = 0;
+	High = NumRecords;
+	while (Low < High)
+	{
+		unsigned long long Middle = Low + (High - Low) / 2;
+		if (Records[Middle].RealTimeNs < FromNs)
+		{
+			Low = Middle + 1;
+		}
+		else
+		{
+			High = Middle;
+		}
+	}
+
+	memset(Aggregates, 0, sizeof(Aggregates));
+	for (Idx = Low; Idx < NumRecords && Records[Idx].RealTimeNs <= ToNs; ++Idx)
+	{
+		const struct SeriesRecord* Record = &Records[Idx];
+		struct Aggregate* Aggregate;
+		struct StabilityParams Params;
+		unsigned long long Window = WindowNs ? Record->RealTimeNs / WindowNs : 0;
+		int IdxBucket;
+
+		if (Record->Series >= Header->NumSeries || (OnlySeries >= 0 && Record->Series != (unsigned int)OnlySeries))
+		{
+			continue;
+		}
+
+		Aggregate = &Aggregates[Record->Series];
+		if (Aggregate->NumRecords > 0 && Aggregate->WindowNs != Window)
+		{
+			Flush(Aggregate, Record->Series);
+		}
+
+		if (Aggregate->NumRecords == 0)
+		{
+			Aggregate->WindowNs = Window;
+			Aggregate->FirstNs = Record->RealTimeNs;
+		}
+		Aggregate->LastNs = Record->RealTimeNs;
+		++Aggregate->NumRecords;
+
+		Params.NumObservations = Record->NumObservations;
+		Params.Mean = Record->Mean;
+		Params.Mean2 = Record->Mean2;
+		Params.Min = Record->Min;
+		Params.Max = Record->Max;
+		MergeObservations(&Aggregate->Params, &Params);
+		for (IdxBucket = 0; IdxBucket < SERIES_NUM_BUCKETS; ++IdxBucket)
+		{
+			Aggregate->Counts[IdxBucket] += Record->Counts[IdxBucket];
+		}
+	}
+
+	for (IdxSeries = 0; IdxSeries < Header->NumSeries; ++IdxSeries)
+	{
+		Flush(&Aggregates[IdxSeries], IdxSeries);
+	}
+
+	munmap(Map, Stat.st_size);
+	close(Fd);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+
+Copyright (c) 2016 Epic Games, Inc.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Prints a binary trace written by clock_continuity or zero_load, one event per line,
+ * and points out events the recording thread had to drop.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench_core.h"
+#include "trace.h"
+
+/** Rings tracked for dropped events, more than any tool uses */
+#define MAX_RINGS	4096
+
+int main(int argc, const char* argv[])
+{
+	struct TraceFileHeader Header;
+	struct TraceEvent Event;
+	static unsigned long long NextSequence[MAX_RINGS];
+	unsigned long long NumEvents = 0, NumMissing = 0;
+	unsigned long long StallStartNs, StallEndNs;
+	FILE* File;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s trace_file\n", argv[0]);
+		return 1;
+	}
+
+	File = fopen(argv[1], "rb");
+	if (File == NULL)
+	{
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	if (fread(&Header, sizeof(Header), 1, File) != 1 || memcmp(Header.Magic, TRACE_FILE_MAGIC, sizeof(Header.Magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a trace file\n", argv[1]);
+		return 1;
+	}
+
+	if (Header.Version != TRACE_FILE_VERSION || Header.EventSize != sizeof(struct TraceEvent))
+	{
+		fprintf(stderr, "%s has trace version %u with %u byte events, expected version %d with %d byte events\n",
+			argv[1], Header.Version, Header.EventSize, TRACE_FILE_VERSION, (int)sizeof(struct TraceEvent));
+		return 1;
+	}
+
+	Header.Tool[sizeof(Header.Tool) - 1] = 0;
+	printf("Tool, %s, Started, %s", Header.Tool, UtcTimeStringAt(Header.StartRealTimeNs));
+
+	while (fread(&Event, sizeof(Event), 1, File) == 1)
+	{
+		if (Event.Ring < MAX_RINGS)
+		{
+			if (Event.Sequence != NextSequence[Event.Ring])
+			{
+				printf("Ring, %u, Missing, %llu\n", Event.Ring, Event.Sequence - NextSequence[Event.Ring]);
+				NumMissing += Event.Sequence - NextSequence[Event.Ring];
+			}
+			NextSequence[Event.Ring] = Event.Sequence + 1;
+		}
+
+		printf("Event, %s, Ring, %u, Sequence, %llu, Pid, %u, Cpu, %d, SinceStart(s), %.3f, Value, %llu, Expected, %llu, Arg, %llu, ",
+			TraceEventTypeName(Event.Type), Event.Ring, Event.Sequence, Event.Pid, Event.Cpu,
+			(double)(Event.TimeNs - Header.StartNs) / 1e9, Event.Value, Event.Expected, Event.Arg);
+
+		/* what the sampler saw over stalls, the cause is judged against the part of the stall that was unexpected */
+		if (TraceEventStall(&Event, &StallStartNs, &StallEndNs))
+		{
+			unsigned long long StallNs = (Event.Type == TraceEvent_SleepOvershoot && Event.Value > Event.Expected) ? Event.Value - Event.Expected : Event.Value;
+			printf("Cause, %s, Window(ms), %.1f, Steal(us), %llu, Irq(us), %llu, Interrupts, %llu, RunDelay(us), %llu, VoluntarySwitches, %u, InvoluntarySwitches, %u, ",
+				SchedDeltasCause(&Event.Sched, StallNs), (double)Event.Sched.WindowNs / 1e6, Event.Sched.StealNs / 1000, Event.Sched.IrqTimeNs / 1000,
+				Event.Sched.NumInterrupts, Event.Sched.RunDelayNs / 1000, Event.Sched.NumVoluntarySwitches, Event.Sched.NumInvoluntarySwitches);
+		}
+		printf("Time, %s", UtcTimeStringAt(Event.RealTimeNs));
+		++NumEvents;
+	}
+
+	printf("Events, %llu, Missing, %llu\n", NumEvents, NumMissing);
+
+	fclose(File);
+	return 0;
+}
@@ -1,4 +1,3 @@
 #!/bin/sh
 
-gcc -O2 zero_load.c -lrt -o zero_load
-
+make
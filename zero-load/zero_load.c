@@ -27,74 +27,682 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <poll.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include "bench_core.h"
+#include "trace.h"
+#include "runtime_config.h"
 
-int main(int argc, const char* argv[])
+/** Ways of waiting for a timeout that frame loops use */
+enum SleepMechanism
 {
-	struct timespec TimeSpec, TimeSpecRemain;
-	unsigned long long StartNs = 0, EndNs = 0, DiffNs = 0;
-	time_t Time;
-	struct tm* UtcTime;
-	int SleepResult = 0;
+	Sleep_Relative,
+	Sleep_Absolute,
+	Sleep_Timerfd,
+	Sleep_Futex,
+	Sleep_Select,
+	Sleep_Poll,
 
-	printf("Checking if we ever overshoot clock_nanosleep() for too long (program never exits).\n");
+	Sleep_NumMechanisms
+};
+
+/** Names accepted by -m */
+static const char* SleepMechanismNames[Sleep_NumMechanisms] = { "relative", "absolute", "timerfd", "futex", "select", "poll" };
+
+/** Calls behind each mechanism, as printed for overshoots */
+static const char* SleepMechanismCalls[Sleep_NumMechanisms] = { "clock_nanosleep()", "clock_nanosleep(TIMER_ABSTIME)", "timerfd + epoll_wait()",
+	"futex(FUTEX_WAIT)", "select()", "ppoll()" };
+
+#define MAX_DURATIONS		64
+#define DEFAULT_DURATIONS	"33000"
+#define DEFAULT_MECHANISMS	"all"
+
+/** One sleep duration and mechanism pair, with the overshoot of every call made with it */
+struct SleepCase
+{
+	unsigned long long DurationNs;
+	enum SleepMechanism Mechanism;
+
+	/** Overshoot in us */
+	struct StabilityParams AllTime, LastPeriod;
+	/** Overshoot in ns */
+	struct LatencyHistogram AllTimeHistogram, LastPeriodHistogram;
+};
+
+/** Runs the whole sweep on one CPU, or wherever the scheduler puts it */
+struct Sleeper
+{
+	pthread_t Thread;
+	int Index;
+	/** -1 if not pinned */
+	int Cpu;
+
+	struct SleepCase* Cases;
+
+	/** Armed for each timerfd sleep, EpollFd waits on it */
+	int TimerFd, EpollFd;
+	/** Never changes, futex waits on it can only time out */
+	int FutexWord;
+};
+
+struct Tracer Tracer;
+struct RuntimeConfig Runtime;
 
+unsigned long long Durations[MAX_DURATIONS];
+int NumDurations = 0;
+enum SleepMechanism Mechanisms[Sleep_NumMechanisms];
+int NumMechanisms = 0;
+
+/** Overshoots above this are traced, the default flags a 33 ms sleep that took over 100 ms as this tool always has */
+unsigned long long TraceThresholdNs = 67000000ULL;
+unsigned long long PeriodNs = 60ULL * 1000000000ULL;
+
+/** Set by the first sleeper whose sleep fails, the others stop after their current sleep and main() stops the tracer */
+int SleepersStopping = 0;
+
+/** Prints an event the way this tool always has, called by the trace drainer. */
+void PrintSleepEvent(const struct TraceEvent* Event)
+{
+	const char* Call = (Event->Arg < Sleep_NumMechanisms) ? SleepMechanismCalls[Event->Arg] : "sleep";
+
+	/* sleepers print their stats from other threads, and the time strings share one static buffer */
+	flockfile(stdout);
+	if (Event->Type == TraceEvent_SleepFailed)
+	{
+		printf("pid %u: %s failed with %llu (%s) at %s",
+			Event->Pid,
+			Call,
+			Event->Value,
+			strerror((int)Event->Value),
+			UtcTimeStringAt(Event->RealTimeNs)
+		);
+	}
+	else
+	{
+		char Cause[256];
+
+		printf("pid %u: %s took %llu nanoseconds instead of %llu, on cpu %d%s at %s",
+			Event->Pid,
+			Call,
+			Event->Value,
+			Event->Expected,
+			Event->Cpu,
+			SchedDeltasFormat(Cause, sizeof(Cause), &Event->Sched, Event->Value - Event->Expected),
+			UtcTimeStringAt(Event->RealTimeNs)
+		);
+	}
+	funlockfile(stdout);
+}
+
+/**
+ * Waits once with one of the mechanisms that take a relative timeout.
+ *
+ * @return 0 when the timeout expired, EINTR if woken before it, otherwise the error the call failed with
+ */
+static int WaitOnce(struct Sleeper* Sleeper, enum SleepMechanism Mechanism, unsigned long long TimeoutNs)
+{
+	struct timespec TimeSpec;
+	struct timeval TimeVal;
+	unsigned long long TimeoutUs;
+
+	switch (Mechanism)
+	{
+		case Sleep_Futex:
+			NsToTimespec(TimeoutNs, &TimeSpec);
+			if (syscall(SYS_futex, &Sleeper->FutexWord, FUTEX_WAIT_PRIVATE, 0, &TimeSpec, NULL, 0) == 0)
+			{
+				return EINTR;	/* spurious wake-up, nobody wakes this word */
+			}
+			return (errno == ETIMEDOUT) ? 0 : (errno == EAGAIN) ? EINTR : errno;
+
+		case Sleep_Select:
+			/* select() only takes microseconds, round up so it never sleeps short */
+			TimeoutUs = (TimeoutNs + 999) / 1000;
+			TimeVal.tv_sec = TimeoutUs / 1000000ULL;
+			TimeVal.tv_usec = TimeoutUs % 1000000ULL;
+			return (select(0, NULL, NULL, NULL, &TimeVal) == 0) ? 0 : errno;
+
+		case Sleep_Poll:
+			/* ppoll() rather than poll(), whose milliseconds would hide the sub-millisecond sleeps */
+			NsToTimespec(TimeoutNs, &TimeSpec);
+			return (ppoll(NULL, 0, &TimeSpec, NULL) == 0) ? 0 : errno;
+
+		default:
+			return EINVAL;
+	}
+}
+
+/**
+ * Sleeps DurationNs with the given mechanism. Signals restart the wait for what is left of it.
+ *
+ * @return 0 on success, or the error the sleep failed with
+ */
+static int SleepWith(struct Sleeper* Sleeper, enum SleepMechanism Mechanism, unsigned long long DurationNs)
+{
+	unsigned long long DeadlineNs, NowNs;
+	struct itimerspec TimerSpec;
+	struct epoll_event Event;
+	uint64_t NumExpirations;
+	int Result;
+
+	switch (Mechanism)
+	{
+		case Sleep_Relative:
+			return SleepNs(DurationNs);
+
+		case Sleep_Absolute:
+			return SleepUntilNs(GetClockInNs(BENCH_SLEEP_CLOCK_ID) + DurationNs);
+
+		case Sleep_Timerfd:
+			memset(&TimerSpec, 0, sizeof(TimerSpec));
+			NsToTimespec(DurationNs, &TimerSpec.it_value);
+			if (timerfd_settime(Sleeper->TimerFd, 0, &TimerSpec, NULL) != 0)
+			{
+				return errno;
+			}
+			do
+			{
+				Result = epoll_wait(Sleeper->EpollFd, &Event, 1, -1);
+			}
+			while (Result < 0 && errno == EINTR);
+			if (Result < 0)
+			{
+				return errno;
+			}
+			return (read(Sleeper->TimerFd, &NumExpirations, sizeof(NumExpirations)) == sizeof(NumExpirations)) ? 0 : errno;
+
+		default:
+			break;
+	}
+
+	DeadlineNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID) + DurationNs;
 	for (;;)
 	{
-		clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-		StartNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+		Result = WaitOnce(Sleeper, Mechanism, DurationNs);
+		if (Result != EINTR)
+		{
+			return Result;
+		}
+
+		NowNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+		if (NowNs >= DeadlineNs)
+		{
+			return 0;
+		}
+		DurationNs = DeadlineNs - NowNs;
+	}
+}
+
+/** Prints overshoot stats of every case, one line each. */
+static void PrintSleeperStats(struct Sleeper* Sleeper)
+{
+	char Cpu[16];
+	int IdxCase;
+
+	if (Sleeper->Cpu >= 0)
+	{
+		snprintf(Cpu, sizeof(Cpu), "%d", Sleeper->Cpu);
+	}
+	else
+	{
+		snprintf(Cpu, sizeof(Cpu), "any");
+	}
+
+	flockfile(stdout);
+	for (IdxCase = 0; IdxCase < NumDurations * NumMechanisms; ++IdxCase)
+	{
+		struct SleepCase* Case = &Sleeper->Cases[IdxCase];
+
+		printf("pid, %d, Cpu, %s, Sleep, %s, Duration(us), %.1f, Overshoot, All time, ", getpid(), Cpu,
+			SleepMechanismNames[Case->Mechanism], (double)Case->DurationNs / 1000.0);
+		PrintValues(&Case->AllTime, "us");
+		printf(", ");
+		PrintPercentiles(&Case->AllTimeHistogram, 1000.0, "us");
+		printf(", Period, ");
+		PrintValues(&Case->LastPeriod, "us");
+		printf(", ");
+		PrintPercentiles(&Case->LastPeriodHistogram, 1000.0, "us");
+		printf(", %s", UtcTimeString());
+
+		memset(&Case->LastPeriod, 0, sizeof(Case->LastPeriod));
+		memset(&Case->LastPeriodHistogram, 0, sizeof(Case->LastPeriodHistogram));
+	}
+	fflush(stdout);
+	funlockfile(stdout);
+}
+
+/**
+ * Goes round all duration and mechanism pairs one call at a time, so each of them sees the same
+ * conditions over a period, and records how much longer than asked for each call slept.
+ */
+void* SleeperThread(void* Arg)
+{
+	struct Sleeper* Sleeper = (struct Sleeper*)Arg;
+	unsigned long long StartNs, EndNs, OvershootNs, LastPeriodStarted;
+	int NumCases = NumDurations * NumMechanisms;
+	const char* Failed = "";
+	int IdxCase, Result;
+
+	if (Sleeper->Cpu >= 0)
+	{
+		Result = PinThreadToCpu(Sleeper->Cpu);
+		if (Result != 0)
+		{
+			fprintf(stderr, "Could not pin sleeper to cpu %d, error %d (%s)\n", Sleeper->Cpu, Result, strerror(Result));
+			exit(1);
+		}
+	}
+	Result = RuntimeConfigApplyThread(&Runtime, &Failed);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s on sleeper %d, error %d (%s)\n", Failed, Sleeper->Index, Result, strerror(Result));
+		exit(1);
+	}
+	TracerRegisterThread(&Tracer, Sleeper->Index);
+
+	LastPeriodStarted = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+
+	for (IdxCase = 0; !__atomic_load_n(&SleepersStopping, __ATOMIC_ACQUIRE); IdxCase = (IdxCase + 1 == NumCases) ? 0 : IdxCase + 1)
+	{
+		struct SleepCase* Case = &Sleeper->Cases[IdxCase];
+
+		/* measured on the clock the timers run on, CLOCK_MONOTONIC_RAW drifts from it by enough to matter for short sleeps */
+		StartNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+
+		Result = SleepWith(Sleeper, Case->Mechanism, Case->DurationNs);
+		if (Result != 0)
+		{
+			/* the tracer outlives every sleeper that could still record into it, so only main() stops it */
+			TraceRecord(&Tracer, Sleeper->Index, TraceEvent_SleepFailed, Result, Case->DurationNs, Case->Mechanism);
+			__atomic_store_n(&SleepersStopping, 1, __ATOMIC_RELEASE);
+			break;
+		}
+
+		EndNs = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+
+		OvershootNs = (EndNs - StartNs > Case->DurationNs) ? EndNs - StartNs - Case->DurationNs : 0;
+
+		UpdateObservation(&Case->AllTime, (double)OvershootNs / 1000.0);
+		UpdateObservation(&Case->LastPeriod, (double)OvershootNs / 1000.0);
+		UpdateHistogram(&Case->AllTimeHistogram, OvershootNs);
+		UpdateHistogram(&Case->LastPeriodHistogram, OvershootNs);
+
+		if (OvershootNs > TraceThresholdNs)
+		{
+			TraceRecord(&Tracer, Sleeper->Index, TraceEvent_SleepOvershoot, EndNs - StartNs, Case->DurationNs, Case->Mechanism);
+		}
+
+		/* printing delays the next sleep, not the measurement of one */
+		if (EndNs - LastPeriodStarted > PeriodNs)
+		{
+			PrintSleeperStats(Sleeper);
+			LastPeriodStarted = GetClockInNs(BENCH_SLEEP_CLOCK_ID);
+		}
+	}
+
+	return NULL;
+}
+
+/** Sets up the timer and the cases of a sleeper, returns 0 on success or an errno value. */
+static int InitSleeper(struct Sleeper* Sleeper, int Index, int Cpu)
+{
+	struct epoll_event Event;
+	int IdxDuration, IdxMechanism;
+
+	memset(Sleeper, 0, sizeof(*Sleeper));
+	Sleeper->Index = Index;
+	Sleeper->Cpu = Cpu;
+
+	Sleeper->Cases = (struct SleepCase*)calloc(NumDurations * NumMechanisms, sizeof(struct SleepCase));
+	if (Sleeper->Cases == NULL)
+	{
+		return ENOMEM;
+	}
+	for (IdxDuration = 0; IdxDuration < NumDurations; ++IdxDuration)
+	{
+		for (IdxMechanism = 0; IdxMechanism < NumMechanisms; ++IdxMechanism)
+		{
+			struct SleepCase* Case = &Sleeper->Cases[IdxDuration * NumMechanisms + IdxMechanism];
+			Case->DurationNs = Durations[IdxDuration];
+			Case->Mechanism = Mechanisms[IdxMechanism];
+		}
+	}
+
+	Sleeper->TimerFd = timerfd_create(BENCH_SLEEP_CLOCK_ID, TFD_CLOEXEC);
+	Sleeper->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (Sleeper->TimerFd < 0 || Sleeper->EpollFd < 0)
+	{
+		return errno;
+	}
+
+	memset(&Event, 0, sizeof(Event));
+	Event.events = EPOLLIN;
+	if (epoll_ctl(Sleeper->EpollFd, EPOLL_CTL_ADD, Sleeper->TimerFd, &Event) != 0)
+	{
+		return errno;
+	}
+
+	return 0;
+}
+
+/** Fills Mechanisms from a comma separated list of names, or "all". Returns 0 on success. */
+static int ParseMechanisms(const char* List)
+{
+	char* Names = strdup(List);
+	char* Cursor = Names;
+	char* Token;
+	int IdxMechanism, Result = 0;
+
+	NumMechanisms = 0;
+	while (Result == 0 && (Token = strsep(&Cursor, ",")) != NULL)
+	{
+		if (*Token == 0)
+		{
+			continue;
+		}
+
+		if (strcmp(Token, "all") == 0)
+		{
+			for (IdxMechanism = 0; IdxMechanism < Sleep_NumMechanisms; ++IdxMechanism)
+			{
+				Mechanisms[IdxMechanism] = (enum SleepMechanism)IdxMechanism;
+			}
+			NumMechanisms = Sleep_NumMechanisms;
+			continue;
+		}
 
-		TimeSpec.tv_sec = 0;
-		TimeSpec.tv_nsec = 33000000;
-		for (;;)
+		for (IdxMechanism = 0; IdxMechanism < Sleep_NumMechanisms; ++IdxMechanism)
 		{
-			SleepResult = clock_nanosleep(CLOCK_MONOTONIC, 0, &TimeSpec, &TimeSpecRemain);
-			if (SleepResult == 0)
+			if (strcmp(Token, SleepMechanismNames[IdxMechanism]) == 0)
 			{
 				break;
 			}
-			else if (SleepResult != EINTR)
+		}
+		if (IdxMechanism == Sleep_NumMechanisms || NumMechanisms == Sleep_NumMechanisms)
+		{
+			Result = -1;
+			break;
+		}
+		Mechanisms[NumMechanisms++] = (enum SleepMechanism)IdxMechanism;
+	}
+	free(Names);
+
+	return (Result == 0 && NumMechanisms > 0) ? 0 : -1;
+}
+
+/** Fills Durations from a comma separated list in microseconds. Returns 0 on success. */
+static int ParseDurations(const char* List)
+{
+	char* Values = strdup(List);
+	char* Cursor = Values;
+	char* Token;
+	double DurationUs;
+	int Result = 0;
+
+	NumDurations = 0;
+	while ((Token = strsep(&Cursor, ",")) != NULL)
+	{
+		if (*Token == 0)
+		{
+			continue;
+		}
+
+		/* a zero timerfd timeout would disarm the timer rather than fire right away */
+		DurationUs = atof(Token);
+		if (DurationUs * 1000.0 < 1.0 || NumDurations == MAX_DURATIONS)
+		{
+			Result = -1;
+			break;
+		}
+		Durations[NumDurations++] = (unsigned long long)(DurationUs * 1000.0 + 0.5);
+	}
+	free(Values);
+
+	return (Result == 0 && NumDurations > 0) ? 0 : -1;
+}
+
+/** Fills Cpus from "all" or a comma separated list of cpu numbers, returns their number or 0 on error. */
+static int ParseCpus(const char* List, int* Cpus, int MaxCpus)
+{
+	char* Values;
+	char* Cursor;
+	char* Token;
+	int NumCpus = 0;
+
+	if (strcmp(List, "all") == 0)
+	{
+		return GetAllowedCpus(Cpus, MaxCpus);
+	}
+
+	Values = strdup(List);
+	Cursor = Values;
+	while ((Token = strsep(&Cursor, ",")) != NULL)
+	{
+		if (*Token == 0)
+		{
+			continue;
+		}
+		if (NumCpus == MaxCpus || atoi(Token) < 0)
+		{
+			NumCpus = 0;
+			break;
+		}
+		Cpus[NumCpus++] = atoi(Token);
+	}
+	free(Values);
+
+	return NumCpus;
+}
+
+void PrintUsage(const char* Name)
+{
+	printf("Usage: %s [-d us,...] [-m mechanism,...] [-c all|cpu,...] [-k cpu] [-p seconds] [-o ms] " RUNTIME_CONFIG_SYNOPSIS " [trace_file]\n", Name);
+	printf("  -d us         sleep durations to sweep, in microseconds (default %s)\n", DEFAULT_DURATIONS);
+	printf("  -m names      wake-up mechanisms to sweep, or all (default %s):\n", DEFAULT_MECHANISMS);
+	printf("                relative  clock_nanosleep() for the duration\n");
+	printf("                absolute  clock_nanosleep(TIMER_ABSTIME) until now plus the duration\n");
+	printf("                timerfd   one-shot timerfd, waited for with epoll_wait()\n");
+	printf("                futex     FUTEX_WAIT with a timeout, on a word nobody wakes\n");
+	printf("                select    select() with no descriptors\n");
+	printf("                poll      ppoll() with no descriptors\n");
+	printf("  -c cpus       run the sweep on each of these cpus at once, pinned, or on all allowed ones (default: one unpinned)\n");
+	printf("  -k cpu        with -c, cpu of those left without a sleeper for the trace drainer and sched sampling (default: the first one, -1 for none)\n");
+	printf("  -p seconds    print overshoot stats this often (default %llu)\n", PeriodNs / 1000000000ULL);
+	printf("  -o ms         trace overshoots above this (default %llu)\n", TraceThresholdNs / 1000000ULL);
+	RuntimeConfigPrintUsage();
+	printf("  trace_file    where overshoots are traced (default zero_load.<pid>.trace)\n");
+}
+
+int main(int argc, char* const argv[])
+{
+	const char* DurationList = DEFAULT_DURATIONS;
+	const char* MechanismList = DEFAULT_MECHANISMS;
+	const char* CpuList = NULL;
+	const char* Failed = "";
+	char TracePath[256];
+	struct Sleeper* Sleepers;
+	int Cpus[CPU_SETSIZE];
+	int NumSleepers = 1, IdxSleeper, IdxMechanism, Opt;
+	int HousekeepingCpu = -2;
+	cpu_set_t HousekeepingSet;
+	int Result;
+
+	RuntimeConfigInit(&Runtime);
+
+	while ((Opt = getopt(argc, argv, "d:m:c:k:p:o:h" RUNTIME_CONFIG_OPTIONS)) != -1)
+	{
+		switch (Opt)
+		{
+			case 'd':
+				DurationList = optarg;
+				break;
+			case 'm':
+				MechanismList = optarg;
+				break;
+			case 'c':
+				CpuList = optarg;
+				break;
+			case 'k':
+				HousekeepingCpu = (atoi(optarg) < 0) ? -1 : atoi(optarg);
+				break;
+			case 'p':
+				PeriodNs = strtoull(optarg, NULL, 10) * 1000000000ULL;
+				break;
+			case 'o':
+				TraceThresholdNs = strtoull(optarg, NULL, 10) * 1000000ULL;
+				break;
+			default:
+				if (RuntimeConfigParseOption(&Runtime, Opt, optarg) == 0)
+				{
+					break;
+				}
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (ParseDurations(DurationList) != 0 || ParseMechanisms(MechanismList) != 0 || PeriodNs == 0)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	/* before the cpu list, "all" means the cpus the process is restricted to */
+	Result = RuntimeConfigApply(&Runtime, &Failed);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not apply %s, error %d (%s)\n", Failed, Result, strerror(Result));
+		return 1;
+	}
+
+	if (CpuList != NULL)
+	{
+		NumSleepers = ParseCpus(CpuList, Cpus, CPU_SETSIZE);
+		if (NumSleepers <= 0)
+		{
+			fprintf(stderr, "Could not get the cpus to run on from '%s'\n", CpuList);
+			return 1;
+		}
+
+		/* the drainer reads /proc/interrupts every few ms, on a sleeper's cpu that delays its wake-ups and shows up as overshoot */
+		if (HousekeepingCpu == -2)
+		{
+			HousekeepingCpu = (NumSleepers > 1) ? Cpus[0] : -1;
+		}
+		if (HousekeepingCpu >= 0)
+		{
+			for (IdxSleeper = 0; IdxSleeper < NumSleepers && Cpus[IdxSleeper] != HousekeepingCpu; ++IdxSleeper)
 			{
-				Time = time(NULL);
-				UtcTime = gmtime(&Time);
-				
-				printf("pid %d: clock_nanosleep() failed with %d (%s) at %s",
-					getpid(),
-					SleepResult,
-					strerror(SleepResult),
-					asctime(UtcTime)
-				);
-
-				exit(1);
 			}
+			if (IdxSleeper == NumSleepers || NumSleepers == 1)
+			{
+				fprintf(stderr, "Housekeeping cpu %d is not one of the sleepers' cpus, or the only one\n", HousekeepingCpu);
+				return 1;
+			}
+			memmove(&Cpus[IdxSleeper], &Cpus[IdxSleeper + 1], (NumSleepers - IdxSleeper - 1) * sizeof(int));
+			--NumSleepers;
+		}
+	}
+
+	/* Every overshoot is also written to a binary trace, see trace-dump */
+	if (optind < argc)
+	{
+		snprintf(TracePath, sizeof(TracePath), "%s", argv[optind]);
+	}
+	else
+	{
+		snprintf(TracePath, sizeof(TracePath), "zero_load.%d.trace", getpid());
+	}
 
-			// got interrupted, repeat
-			memcpy(&TimeSpec, &TimeSpecRemain, sizeof(TimeSpec));
+	Sleepers = (struct Sleeper*)calloc(NumSleepers, sizeof(struct Sleeper));
+	for (IdxSleeper = 0; IdxSleeper < NumSleepers; ++IdxSleeper)
+	{
+		Result = InitSleeper(&Sleepers[IdxSleeper], IdxSleeper, (CpuList != NULL) ? Cpus[IdxSleeper] : -1);
+		if (Result != 0)
+		{
+			fprintf(stderr, "Could not set up sleeper %d, error %d (%s)\n", IdxSleeper, Result, strerror(Result));
+			return 1;
 		}
-	
-		clock_gettime(CLOCK_MONOTONIC_RAW, &TimeSpec);
-		EndNs = (unsigned long long)(TimeSpec.tv_sec) * 1000000000ULL + (unsigned long long)(TimeSpec.tv_nsec);
+	}
 
-		DiffNs = EndNs - StartNs;
+	Result = TracerStart(&Tracer, TracePath, "zero_load", NumSleepers, PrintSleepEvent, NULL);
+	if (Result != 0)
+	{
+		fprintf(stderr, "Could not start tracing to %s, error %d (%s)\n", TracePath, Result, strerror(Result));
+		return 1;
+	}
+	printf("%d: Tracing overshoots to %s\n", getpid(), TracePath);
+	if (CpuList != NULL && HousekeepingCpu >= 0)
+	{
+		CPU_ZERO(&HousekeepingSet);
+		CPU_SET(HousekeepingCpu, &HousekeepingSet);
+		Result = pthread_setaffinity_np(Tracer.Drainer, sizeof(HousekeepingSet), &HousekeepingSet);
+		if (Result == 0)
+		{
+			Result = PinThreadToCpu(HousekeepingCpu);
+		}
+		if (Result != 0)
+		{
+			fprintf(stderr, "Could not pin housekeeping to cpu %d, error %d (%s)\n", HousekeepingCpu, Result, strerror(Result));
+			return 1;
+		}
+		printf("%d: Trace drainer and sched sampling on cpu %d, no sleeper there\n", getpid(), HousekeepingCpu);
+	}
+	else if (CpuList != NULL)
+	{
+		printf("%d: No housekeeping cpu, the trace drainer shares the sleepers' cpus and can cause overshoots of its own\n", getpid());
+	}
 
-		if (DiffNs > 100000000)	/* if instead of 33 ms it took more than 100 ms, something is really wrong */
+	/* the kernel may defer any wake-up by up to the timer slack, so it bounds what can be seen below */
+	printf("%d: Resolution of CLOCK_MONOTONIC is %llu nsec, timer slack is %llu nsec\n", getpid(),
+		GetClockResolutionNs(BENCH_SLEEP_CLOCK_ID), RuntimeConfigEffectiveSlackNs(&Runtime));
+	RuntimeConfigPrint(&Runtime);
+	printf("%d: Sleeping for %s us with", getpid(), DurationList);
+	for (IdxMechanism = 0; IdxMechanism < NumMechanisms; ++IdxMechanism)
+	{
+		printf(" %s", SleepMechanismNames[Mechanisms[IdxMechanism]]);
+	}
+	printf(", printing overshoot stats every %llu seconds\n", PeriodNs / 1000000000ULL);
+
+	if (CpuList != NULL)
+	{
+		printf("Checking how much sleeps overshoot on %d cpus at once (program never exits).\n", NumSleepers);
+	}
+	else
+	{
+		printf("Checking how much sleeps overshoot, and if ever for too long (program never exits).\n");
+	}
+	fflush(stdout);
+
+	for (IdxSleeper = 0; IdxSleeper < NumSleepers; ++IdxSleeper)
+	{
+		Result = pthread_create(&Sleepers[IdxSleeper].Thread, NULL, SleeperThread, &Sleepers[IdxSleeper]);
+		if (Result != 0)
 		{
-			Time = time(NULL);
-			UtcTime = gmtime(&Time);
+			fprintf(stderr, "Could not start sleeper %d, error %d (%s)\n", IdxSleeper, Result, strerror(Result));
+			return 1;
+		}
+	}
 
-			printf( "pid %d: clock_nanosleep() took %llu nanoseconds instead of 33000000, at %s",
-				getpid(),
-				DiffNs,
-				asctime(UtcTime)
-			);
-		}		
+	for (IdxSleeper = 0; IdxSleeper < NumSleepers; ++IdxSleeper)
+	{
+		pthread_join(Sleepers[IdxSleeper].Thread, NULL);
 	}
 
-	return 0;
-};
+	/* sleepers only return once one of them failed, the drainer prints why */
+	TracerStop(&Tracer);
+	return 1;
+}